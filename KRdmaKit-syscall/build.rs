@@ -21,6 +21,41 @@ const INCLUDED_TYPES: &[&str] = &[
     "pop_msgs_t",
     "push_recv_t",
     "push_recv_req_t",
+    "recv_buf_t",
+    "share_t",
+    "share_req_t",
+    "batch_t",
+    "batch_req_t",
+    "stats_t",
+    "query_stats_t",
+    "query_stats_req_t",
+    "stats_reply_t",
+    "vq_stats_t",
+    "stage_hists_t",
+    "stage_hists_reply_t",
+];
+
+const INCLUDED_FUNCS: &[&str] = &[
+    "krc_pin_user_pages",
+    "krc_unpin_user_page",
+    "krc_page_to_phys",
+    "krc_num_possible_cpus",
+    "krc_debugfs_init",
+    "krc_debugfs_exit",
+    "krc_tsc_khz",
+    "krc_trace_push_enabled",
+    "krc_trace_connect",
+    "krc_trace_push",
+    "krc_trace_pop",
+    "krc_trace_migrate",
+    "krc_trace_bind",
+    "krc_trace_error",
+    "krc_alloc_huge",
+    "krc_free_huge",
+    "krc_max_page_order",
+    "krc_usleep_range",
+    "krc_signal_pending",
+    "krc_ktime_get_us",
 ];
 
 
@@ -29,6 +64,13 @@ const INCLUDED_ENUMS: &[&str] = &[
     "lib_r_cmd",
     "lib_r_req",
     "wc_consts",
+    "stats_counter",
+    "stats_scope",
+    "stats_stage",
+    "stats_hist_consts",
+    "krc_trace_path",
+    "batch_consts",
+    "req_flags",
 ];
 
 fn handle_ofed_version() -> String {
@@ -129,6 +171,10 @@ fn main() {
         builder = builder.whitelist_type(t);
         builder = builder.constified_enum_module(t);
     };
+
+    for f in INCLUDED_FUNCS {
+        builder = builder.whitelist_function(f);
+    }
     {
         let mut builder = cc::Build::new();
         builder.compiler(env::var("CC").unwrap_or_else(|_| "clang".to_string()));
@@ -136,7 +182,11 @@ fn main() {
         builder.warnings(false);
         println!("cargo:rerun-if-changed=src/native/kernel_helper.c");
 
+        println!("cargo:rerun-if-changed=src/native/krcore_trace.h");
+
         builder.file("src/native/kernel_helper.c");
+        // for the TRACE_INCLUDE_PATH of krcore_trace.h
+        builder.include("src/native");
 
         for arg in kernel_args.iter() {
             builder.flag(&arg);
@@ -0,0 +1,79 @@
+//! Chunk size of the push ioctl.
+//!
+//! The requests of one push are copied in and posted `chunk` at a time. A VQ either uses a
+//! fixed chunk set by `SetBatch`, or lets `BatchTuner` adapt it: the chunk grows additively
+//! while larger chunks keep lowering the cost per request (copy-in, build, post and the
+//! optional wait), shrinks once the cost rises, and is halved whenever the requests still
+//! outstanding on the send queue plus one chunk would exceed `SQ_BUDGET`.
+use crate::bindings::*;
+
+pub const DEFAULT_CHUNK: usize = 64;
+pub const MAX_CHUNK: usize = batch_consts::batch_max_chunk as usize;
+pub const MIN_CHUNK: usize = 8;
+/// Requests allowed in flight on the send queue of a VQ before the chunk is cut
+pub const SQ_BUDGET: usize = 128;
+
+pub struct BatchTuner {
+    adaptive: bool,
+    chunk: usize,
+    // EWMA of the cycles per request, 0 before the first sample
+    cost: u64,
+}
+
+impl BatchTuner {
+    pub fn new() -> Self {
+        Self {
+            adaptive: false,
+            chunk: DEFAULT_CHUNK,
+            cost: 0,
+        }
+    }
+
+    /// Apply `SetBatch`
+    pub fn set(&mut self, chunk: u32) -> u32 {
+        if chunk == batch_consts::batch_adaptive {
+            self.adaptive = true;
+            self.cost = 0;
+            return reply_status::ok;
+        }
+        if chunk as usize > MAX_CHUNK {
+            return reply_status::err;
+        }
+        self.adaptive = false;
+        self.chunk = chunk as usize;
+        reply_status::ok
+    }
+
+    #[inline]
+    pub fn chunk(&self) -> usize {
+        self.chunk
+    }
+
+    #[inline]
+    pub fn is_adaptive(&self) -> bool {
+        self.adaptive
+    }
+
+    /// Feed one posted chunk of `reqs` requests, which took `cycles`,
+    /// with `outstanding` requests left on the send queue
+    pub fn observe(&mut self, reqs: usize, cycles: u64, outstanding: usize) {
+        if !self.adaptive || reqs == 0 {
+            return;
+        }
+        if outstanding + self.chunk > SQ_BUDGET {
+            self.chunk = core::cmp::max(MIN_CHUNK, self.chunk / 2);
+            return;
+        }
+        // only a full chunk tells how the chunk size performs
+        if reqs < self.chunk {
+            return;
+        }
+        let cost = cycles / reqs as u64;
+        if self.cost == 0 || cost <= self.cost + self.cost / 8 {
+            self.chunk = core::cmp::min(MAX_CHUNK, self.chunk + MIN_CHUNK);
+        } else {
+            self.chunk = core::cmp::max(MIN_CHUNK, self.chunk - self.chunk / 4);
+        }
+        self.cost = if self.cost == 0 { cost } else { (self.cost * 7 + cost) / 8 };
+    }
+}
@@ -21,11 +21,15 @@ use nostd_async::{Runtime, Task};
 use KRdmaKit::cm::{EndPoint, SidrCM};
 use KRdmaKit::consts::DEFAULT_RPC_HINT;
 use KRdmaKit::ib_path_explorer::IBExplorer;
-use KRdmaKit::mem::{RMemPhy};
 use KRdmaKit::net_util::gid_to_str;
 use KRdmaKit::rpc::RPCClient;
 use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::{debug, info};
 use crate::consts::{RPC_BUFFER_N};
+use crate::fair_share::{FairShare, FAIR_SHARES};
+use crate::reaper::Reaper;
+use crate::stats::{exit_stats, init_stats};
+use crate::huge_mem::{exit_huge_arena, init_huge_arena, ScratchMem};
+use crate::srq_pool::SRQ_POOLS;
 use crate::rpc::caller::{call_connect_rc, call_dereg_dc_meta, call_disconnect_rc, call_query_dc_meta, call_reg_dc_meta};
 use crate::rpc::handler::{dereg_dc_meta_handler, fill_handler_table, query_dc_meta_handler, reg_dc_meta_handler};
 use crate::rpc::RPCReqType::{DeregisterDcMeta, QueryDCMeta, RegisterDCMeta};
@@ -33,8 +37,9 @@ use crate::rpc::RPCReqType::{DeregisterDcMeta, QueryDCMeta, RegisterDCMeta};
 type UnsafeGlobal<T> = ThreadLocal<T>;
 
 // global memory of 4K. used for simple test
+// carved from one huge page if `huge_page_shift` is set
 lazy_static! {
-    pub static ref GLOBAL_MEM: UnsafeGlobal<Vec<RMemPhy>> = UnsafeGlobal::new(Vec::new());
+    pub static ref GLOBAL_MEM: UnsafeGlobal<Vec<ScratchMem>> = UnsafeGlobal::new(Vec::new());
 }
 
 lazy_static! {
@@ -100,7 +105,7 @@ pub fn get_global_test_mem_len() -> usize {
 }
 
 #[inline]
-pub fn get_global_meta_kv_mem() -> &'static mut RMemPhy {
+pub fn get_global_meta_kv_mem() -> &'static mut ScratchMem {
     &mut GLOBAL_MEM.get_mut()[1]
 }
 
@@ -137,7 +142,9 @@ pub fn evict_remote_dc_meta(remote_gid: &String) {
     META_INFO.get_mut().remove(remote_gid);
 }
 
-pub struct Client {}
+pub struct Client {
+    reaper: Option<Reaper>,
+}
 
 impl Client {
     pub fn create() -> Option<Self> {
@@ -164,6 +171,8 @@ impl Client {
         for i in 0..ALLRCONTEXTS.len() {
             info!("ctx {} info {:?}", i, ALLRCONTEXTS.get_ref()[i]);
         }
+        init_stats(ALLNICS.len());
+        init_huge_arena();
 
         // create necessary rctrl for qp server one-sided connection
         let core_num = MAX_SERVICE_NUM;
@@ -177,6 +186,19 @@ impl Client {
             }
         }
 
+        // one fair share scheduler per rctrl, whose DC/UD QPs are shared among the VQs
+        for _ in 0..RCTRL.len() {
+            FAIR_SHARES.get_mut().push(FairShare::new());
+        }
+
+        #[cfg(feature = "shared_srq")]
+        for i in 0..ALLRCONTEXTS.len() {
+            match crate::srq_pool::SrqPool::new(get_global_rcontext(i)) {
+                Some(pool) => SRQ_POOLS.get_mut().push(pool),
+                None => return None,
+            }
+        }
+
         for i in 0..2 {
             let ctx = get_global_rcontext(0);
             let ctrl = get_global_rctrl(i * 2);
@@ -198,7 +220,7 @@ impl Client {
 
         for _ in 0..12 {
             GLOBAL_MEM.get_mut().push(
-                RMemPhy::new(1024 * 4)
+                ScratchMem::new(1024 * 4)
             );
         }
         #[cfg(feature = "rpc_server")]
@@ -230,7 +252,7 @@ impl Client {
         if conn_meta().is_none() {
             return None;
         }
-        Some(Self {})
+        Some(Self { reaper: Some(Reaper::start()) })
     }
 }
 
@@ -287,6 +309,8 @@ fn conn_meta() -> Option<()> {
 impl Drop for Client {
     fn drop(&mut self) {
         debug!("core client exit, free {} devs", ALLNICS.get_mut().len());
+        // stop reaping before the QPs are destroyed
+        self.reaper.take();
         #[cfg(feature = "meta_kv")]
         {
             let remote_gid = crate::get_meta_server_gid();
@@ -296,7 +320,12 @@ impl Drop for Client {
         META_INFO.get_mut().clear();
         // first clear all the rctrl
         RPC_CLIENTS.get_mut().clear();
+        FAIR_SHARES.get_mut().clear();
+        SRQ_POOLS.get_mut().clear();
+        exit_stats();
         RCTRL.get_mut().clear();
+        GLOBAL_MEM.get_mut().clear();
+        exit_huge_arena();
         for ctx in ALLRCONTEXTS.get_mut() {
             ctx.reset();
         }
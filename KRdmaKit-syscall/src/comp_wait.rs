@@ -0,0 +1,200 @@
+//! Bounded waits for a send completion inside the ioctls.
+//!
+//! `RCOp/UDOp::wait_til_comp` poll the CQ until a completion arrives, so a dead remote hangs
+//! the calling thread in the kernel. `wait_comp` instead polls for a short spin window, then
+//! sleeps between the polls with an exponential backoff until the deadline set by the module
+//! param `comp_timeout_ms`. The CQs are created by KRdmaKit without a completion handler, so
+//! the sleeps are hrtimer based (`usleep_range`) rather than on the CQ event.
+//!
+//! The spin window of each VQ adapts to its waits: a completion polled while spinning fits the
+//! window to twice its latency, one polled shortly after the first sleep doubles the window
+//! (spinning a bit longer would have saved the sleep), and a longer one halves it.
+//!
+//! A wait which times out leaves its completion in the CQ. It is recorded in `StaleComps`,
+//! and `wait_fresh_comp` skips it before trusting the next completion of that CQ.
+use alloc::collections::VecDeque;
+use alloc::vec::Vec;
+use hashbrown::HashMap;
+
+use KRdmaKit::rust_kernel_rdma_base::*;
+
+use crate::bindings::*;
+
+pub const MIN_SPIN_USEC: u64 = 2;
+pub const MAX_SPIN_USEC: u64 = 64;
+const INIT_SPIN_USEC: u64 = 8;
+/// Bounds of one sleep between the polls
+const MIN_SLEEP_USEC: u64 = 10;
+const MAX_SLEEP_USEC: u64 = 1000;
+/// Polls between two reads of the clock while spinning
+const POLLS_PER_CHECK: usize = 32;
+
+/// Monotonic, so a wall clock step neither times a wait out early nor extends it
+#[inline]
+fn now_usec() -> u64 {
+    unsafe { krc_ktime_get_us() }
+}
+
+/// The deadline of a wait started at `start`, None if unbounded
+#[inline]
+fn deadline(start: u64) -> Option<u64> {
+    let timeout = crate::comp_timeout_ms::read();
+    if timeout <= 0 {
+        None
+    } else {
+        Some(start + timeout as u64 * 1000)
+    }
+}
+
+pub struct SpinWindow {
+    usec: u64,
+}
+
+impl SpinWindow {
+    pub fn new() -> Self {
+        Self { usec: INIT_SPIN_USEC }
+    }
+
+    #[inline]
+    pub fn usec(&self) -> u64 {
+        self.usec
+    }
+
+    /// Feed a completion which took `waited` usecs, `slept` if it arrived after the window
+    fn observe(&mut self, waited: u64, slept: bool) {
+        let usec = if !slept {
+            (self.usec * 3 + waited * 2) / 4
+        } else if waited < self.usec * 2 {
+            self.usec * 2
+        } else {
+            self.usec / 2
+        };
+        self.usec = core::cmp::min(MAX_SPIN_USEC, core::cmp::max(MIN_SPIN_USEC, usec));
+    }
+}
+
+#[inline]
+fn poll_one(cq: *mut ib_cq, wc: &mut ib_wc) -> Result<bool, u32> {
+    let ret = unsafe { bd_ib_poll_cq(cq, 1, wc as *mut ib_wc) };
+    if ret < 0 {
+        return Err(reply_status::err);
+    }
+    Ok(ret == 1)
+}
+
+/// Wait for one completion on `cq`, return it by value.
+/// Return `Err(reply_status::timeout)` once the deadline passes or a signal is pending,
+/// and `Err(reply_status::err)` if the CQ fails.
+pub fn wait_comp(cq: *mut ib_cq, window: &mut SpinWindow) -> Result<ib_wc, u32> {
+    let mut wc: ib_wc = Default::default();
+    if cq.is_null() {
+        return Err(reply_status::err);
+    }
+    if poll_one(cq, &mut wc)? {
+        return Ok(wc);
+    }
+
+    let start = now_usec();
+    let deadline = deadline(start);
+    let mut polls = 0;
+    loop {
+        if poll_one(cq, &mut wc)? {
+            window.observe(now_usec().saturating_sub(start), false);
+            return Ok(wc);
+        }
+        polls += 1;
+        if polls % POLLS_PER_CHECK == 0 && now_usec().saturating_sub(start) >= window.usec() {
+            break;
+        }
+    }
+
+    let mut sleep = MIN_SLEEP_USEC;
+    loop {
+        let now = now_usec();
+        if deadline.map_or(false, |d| now >= d) || unsafe { krc_signal_pending() } != 0 {
+            return Err(reply_status::timeout);
+        }
+        let sleep_to = deadline.map_or(sleep, |d| core::cmp::min(sleep, d - now));
+        unsafe { krc_usleep_range(sleep_to, sleep_to + sleep_to / 2) };
+        if poll_one(cq, &mut wc)? {
+            window.observe(now_usec().saturating_sub(start), true);
+            return Ok(wc);
+        }
+        sleep = core::cmp::min(MAX_SLEEP_USEC, sleep * 2);
+    }
+}
+
+/// Completions left behind by the timed-out waits, per CQ in the order of the waits.
+/// Each one is either reported to the user (its request is signaled by the user),
+/// or internal to the kernel (e.g., a rendezvous READ) and dropped once polled.
+pub struct StaleComps {
+    // <ib_cq address, whether each stale completion is reported>
+    cqs: HashMap<usize, VecDeque<bool>>,
+}
+
+impl StaleComps {
+    pub fn new() -> Self {
+        Self {
+            cqs: Default::default(),
+        }
+    }
+
+    #[inline]
+    pub fn leave(&mut self, cq: *mut ib_cq, reported: bool) {
+        self.cqs.entry(cq as usize).or_insert_with(VecDeque::new).push_back(reported);
+    }
+
+    /// Whether the oldest stale completion of `cq` is reported, None if there is none
+    #[inline]
+    pub fn front(&self, cq: *mut ib_cq) -> Option<bool> {
+        self.cqs.get(&(cq as usize)).and_then(|q| q.front().copied())
+    }
+
+    /// Forget the oldest stale completion of `cq`, which has been polled
+    #[inline]
+    pub fn pop(&mut self, cq: *mut ib_cq) -> Option<bool> {
+        self.cqs.get_mut(&(cq as usize)).and_then(|q| q.pop_front())
+    }
+
+    /// The CQs with any internal stale completion, i.e., a request which may still be running
+    pub fn internal_cqs(&self) -> Vec<*mut ib_cq> {
+        self.cqs.iter()
+            .filter(|(_, q)| q.iter().any(|reported| !*reported))
+            .map(|(cq, _)| *cq as *mut ib_cq)
+            .collect()
+    }
+
+    /// Forget all of them, e.g., once a flush has polled every completion of `cq`
+    #[inline]
+    pub fn reset(&mut self, cq: *mut ib_cq) {
+        self.cqs.remove(&(cq as usize));
+    }
+}
+
+/// Wait for the completion of the latest signaled request on `cq`.
+/// The stale completions ahead of it are polled first and passed to `on_stale`,
+/// with whether they are reported. On timeout, the completion is left as stale.
+pub fn wait_fresh_comp(cq: *mut ib_cq, window: &mut SpinWindow, stale: &mut StaleComps,
+                       reported: bool, on_stale: &mut dyn FnMut(*mut ib_cq, ib_wc, bool))
+                       -> Result<ib_wc, u32> {
+    drain_stale(cq, window, stale, on_stale)?;
+    let res = wait_comp(cq, window);
+    if let Err(status) = res {
+        if status == reply_status::timeout {
+            stale.leave(cq, reported);
+        }
+    }
+    res
+}
+
+/// Poll all the stale completions of `cq`, passed to `on_stale` as in `wait_fresh_comp`.
+/// Once it returns Ok, none of their requests is running.
+pub fn drain_stale(cq: *mut ib_cq, window: &mut SpinWindow, stale: &mut StaleComps,
+                   on_stale: &mut dyn FnMut(*mut ib_cq, ib_wc, bool)) -> Result<(), u32> {
+    while let Some(kind) = stale.front(cq) {
+        let wc = wait_comp(cq, window)?;
+        stale.pop(cq);
+        on_stale(cq, wc, kind);
+    }
+    Ok(())
+}
@@ -1,4 +1,6 @@
 // Default gid of the meta server
 pub const META_SERVER_GID: &str = "fe80:0000:0000:0000:ec0d:9a03:0078:645e";
 pub const RPC_BUFFER_N: usize = 16;
+// UD hint of the bound services receiving on the shared SRQ pool (feature `shared_srq`)
+pub const SRQ_UD_HINT: usize = 74;
 
@@ -0,0 +1,78 @@
+//! User cookies of the pushed requests.
+//!
+//! The `cookie` of a `core_req_t` is returned in `wc_wr_id` of the completion of that request.
+//! The sends posted through KRdmaKit always carry a zero wr_id, so the cookies are kept aside:
+//! the cookie of each signaled request is queued per send CQ in post order, and attached to
+//! the next completion polled from that CQ. The requests on the RC of a VQ are already kept
+//! by `InflightLog` for the recovery, which returns the cookie upon retiring them instead.
+//!
+//! The UD sends (built by `UDDoorbell`) and the DC requests (posted by `post_dc`) put the
+//! cookie in the wr_id itself, so the completions of those QPs (registered by
+//! `carry_in_wr_id`) already carry their cookies. Both QPs are shared by the VQs of a port,
+//! where the post order is not the completion order of any single VQ.
+use alloc::collections::VecDeque;
+use hashbrown::{HashMap, HashSet};
+
+use KRdmaKit::rust_kernel_rdma_base::*;
+
+/// Max queued cookies per CQ. The oldest are dropped beyond it, which only happens when
+/// the completions are never polled.
+pub const MAX_COOKIES: usize = 4096;
+
+pub struct CookieTable {
+    // <ib_cq address, cookies of the signaled requests in post order>
+    queues: HashMap<usize, VecDeque<u64>>,
+    // ib_qp addresses of the QPs whose sends carry the cookie in the wr_id
+    in_wr_id: HashSet<usize>,
+}
+
+impl CookieTable {
+    pub fn new() -> Self {
+        Self {
+            queues: Default::default(),
+            in_wr_id: Default::default(),
+        }
+    }
+
+    /// Record the cookie of a signaled request posted on the QP of `cq`
+    #[inline]
+    pub fn record(&mut self, cq: *mut ib_cq, cookie: u64) {
+        let queue = self.queues.entry(cq as usize).or_insert_with(VecDeque::new);
+        if queue.len() >= MAX_COOKIES {
+            queue.pop_front();
+        }
+        queue.push_back(cookie);
+    }
+
+    /// The cookie of the oldest signaled request on `cq`, 0 if none is recorded
+    #[inline]
+    pub fn take(&mut self, cq: *mut ib_cq) -> u64 {
+        self.queues.get_mut(&(cq as usize)).and_then(|q| q.pop_front()).unwrap_or(0)
+    }
+
+    /// Signaled requests on `cq` whose completions have not been polled yet
+    #[inline]
+    pub fn pending(&self, cq: *mut ib_cq) -> usize {
+        self.queues.get(&(cq as usize)).map_or(0, |q| q.len())
+    }
+
+    /// The sends of `qp` set their cookies in the wr_id, so its completions are left as is
+    #[inline]
+    pub fn carry_in_wr_id(&mut self, qp: *mut ib_qp) {
+        self.in_wr_id.insert(qp as usize);
+    }
+
+    /// Attach the cookie to a completion polled from `cq`
+    #[inline]
+    pub fn attach(&mut self, cq: *mut ib_cq, mut wc: ib_wc) -> ib_wc {
+        if !self.in_wr_id.contains(&(wc.qp as usize)) {
+            set_cookie(&mut wc, self.take(cq));
+        }
+        wc
+    }
+}
+
+#[inline]
+pub fn set_cookie(wc: &mut ib_wc, cookie: u64) {
+    wc.__bindgen_anon_1.wr_id = cookie;
+}
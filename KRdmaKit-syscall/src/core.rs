@@ -14,6 +14,7 @@ use KRdmaKit::consts::MAX_KMALLOC_SZ;
 use KRdmaKit::mem::{RMemPhy, TempMR};
 use linux_kernel_module::c_types::c_void;
 use linux_kernel_module::bindings::{_copy_to_user};
+use crate::user_mr::{is_kernel_va, UserMR};
 
 /// Main func for qp connection in kernel space.
 /// The runtime latency of this function should be profiled in a more detailed way.
@@ -67,7 +68,8 @@ pub fn pop_recv(core_id: usize, pop_cnt: usize, offset: usize) -> (Option<*mut i
 pub fn handle_pop_ret(pop_ret: Option<*mut ib_wc>,
                       req: &mut req_t,
                       wc_len: usize,
-                      payload_sz: u32) -> u32 {
+                      payload_sz: u32,
+                      payload_buf: u64) -> u32 {
     match pop_ret {
         Some(wc) => {
 
@@ -82,12 +84,22 @@ pub fn handle_pop_ret(pop_ret: Option<*mut ib_wc>,
                 user_wc.wc_wr_id = wc.get_wr_id() as u64;
                 user_wc.wc_status = wc.status;
                 user_wc.imm_data = unsafe { wc.ex.imm_data } as u32;
+                user_wc.byte_len = wc.byte_len;
                 unsafe {
-                    rust_kernel_linux_util::bindings::memcpy(
-                        (va + payload_sz as u64) as *mut c_void,
-                        (va as u64) as *mut c_void,
-                        payload_sz as u64,
-                    );
+                    // messages in the user supplied buffers are left untouched
+                    if is_kernel_va(va) && payload_buf != 0 {
+                        _copy_to_user(
+                            (payload_buf + i * payload_sz as u64) as *mut c_void,
+                            va as *mut c_void,
+                            payload_sz as u64,
+                        );
+                    } else if is_kernel_va(va) {
+                        rust_kernel_linux_util::bindings::memcpy(
+                            (va + payload_sz as u64) as *mut c_void,
+                            (va as u64) as *mut c_void,
+                            payload_sz as u64,
+                        );
+                    }
                     // copy to user
                     _copy_to_user(
                         (req.reply_buf as u64 +
@@ -122,6 +134,8 @@ use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module::c_types::*;
 use KRdmaKit::thread_local::ThreadLocal;
 use crate::client::{get_global_rcontext, get_global_test_mem_pa};
 use crate::virtual_queue::VQ;
+use crate::reaper::register_rc_holder;
+use core::sync::atomic::{AtomicBool, Ordering};
 use lazy_static::lazy_static;
 use crate::println;
 
@@ -131,6 +145,8 @@ pub struct RCConnectParam<'a> {
     pub port: usize,
     pub path: sa_path_rec,
     pub vq: *mut VQ<'a>,
+    // set when the background connection finishes, the VQ must outlive it
+    pub done: AtomicBool,
 }
 
 #[cfg(feature = "migrate_qp")]
@@ -145,6 +161,11 @@ pub unsafe extern "C" fn bg_rc_migrate_thread(
                 #[cfg(feature = "virtual_queue")]
                     {
                         (*connect_param.vq).virtual_queue = qp;
+                        if (*connect_param.vq).virtual_queue.is_some() {
+                            register_rc_holder(connect_param.vq, &(*connect_param.vq).activity);
+                            (*connect_param.vq).stat(stats_counter::StatMigrations, 1);
+                            crate::trace::migrate((*connect_param.vq).trace_id(), port, vid, true);
+                        }
                         // println!("RCQP migration success")
                     }
                 reply_status::ok
@@ -152,7 +173,7 @@ pub unsafe extern "C" fn bg_rc_migrate_thread(
             Err(_) => reply_status::err
         };
     }
-
+    connect_param.done.store(true, Ordering::Release);
     0
 }
 
@@ -177,6 +198,9 @@ pub struct LocalCache {
     // for twosided client side
     // used for two-sided client side / dc client side
     pub(crate) remote_endpoint: Option<EndPoint>,
+
+    // user registered memory regions <hint, mr>, used for user supplied receive buffers
+    pub(crate) user_mrs: HashMap<u32, UserMR>,
 }
 
 
@@ -190,6 +214,7 @@ impl Default for LocalCache {
                                        MAX_KMALLOC_SZ as u32,
                                        unsafe { get_global_rcontext(0).get_lkey() }, )),
             remote_endpoint: None,
+            user_mrs: Default::default(),
         }
     }
 }
@@ -0,0 +1,213 @@
+//! Weighted fair sharing of one physical QP among the virtual queues.
+//!
+//! Unconnected VQs of the same port share the port's DC/UD QP. Each VQ is a tenant
+//! scheduled with deficit round robin (DRR) on bytes: in every round a tenant earns
+//! `DRR_QUANTUM * weight` bytes of credit, and it can only post while it has credit left.
+//! A round ends once all the backlogged tenants have run out of credit, so a single tenant
+//! is never throttled by the DRR itself. An optional per-tenant byte rate caps the tenant
+//! regardless of the rounds.
+use alloc::boxed::Box;
+use alloc::vec::Vec;
+use core::pin::Pin;
+use hashbrown::HashMap;
+use lazy_static::lazy_static;
+
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::kthread::yield_now;
+use KRdmaKit::thread_local::ThreadLocal;
+use linux_kernel_module::mutex::LinuxMutex;
+use linux_kernel_module::sync::Mutex;
+
+use crate::bindings::*;
+
+/// Credit (in bytes) per unit of weight earned in one round
+pub const DRR_QUANTUM: u64 = 16 * 1024;
+pub const DEFAULT_WEIGHT: u32 = 1;
+/// Burst allowed by the rate limit, in usec worth of bytes
+const RATE_BURST_USEC: u64 = 1000;
+
+struct Tenant {
+    weight: u32,
+    deficit: u64,
+    round: u64,
+    backlogged: bool,
+    waiting: bool,
+
+    // byte rate limit, 0 means unlimited
+    max_bytes_per_sec: u64,
+    tokens: u64,
+    last_refill_usec: u64,
+}
+
+impl Tenant {
+    fn new() -> Self {
+        Self {
+            weight: DEFAULT_WEIGHT,
+            deficit: 0,
+            round: 0,
+            backlogged: false,
+            waiting: false,
+            max_bytes_per_sec: 0,
+            tokens: 0,
+            last_refill_usec: now_usec(),
+        }
+    }
+
+    #[inline]
+    fn quantum(&self) -> u64 {
+        DRR_QUANTUM * self.weight as u64
+    }
+
+    #[inline]
+    fn rate_admit(&mut self, bytes: u64) -> bool {
+        if self.max_bytes_per_sec == 0 {
+            return true;
+        }
+        let now = now_usec();
+        // u128, since the rate is set by the user
+        let burst = bytes_in(RATE_BURST_USEC, self.max_bytes_per_sec);
+        let refill = bytes_in(now.saturating_sub(self.last_refill_usec), self.max_bytes_per_sec);
+        if refill > 0 {
+            self.tokens = core::cmp::min(self.tokens.saturating_add(refill),
+                                         core::cmp::max(burst, bytes));
+            self.last_refill_usec = now;
+        }
+        if self.tokens >= bytes {
+            self.tokens -= bytes;
+            return true;
+        }
+        false
+    }
+}
+
+#[derive(Default)]
+struct DrrState {
+    tenants: HashMap<usize, Tenant>,
+    round: u64,
+}
+
+impl DrrState {
+    fn admit(&mut self, id: usize, bytes: u64) -> bool {
+        let round = self.round;
+        let t = self.tenants.entry(id).or_insert_with(Tenant::new);
+        if t.round != round {
+            // a fresh round: earn the quantum. An idle tenant does not keep its old credit.
+            t.deficit = if t.backlogged { t.deficit.saturating_add(t.quantum()) } else { t.quantum() };
+            t.round = round;
+        }
+        t.backlogged = true;
+        if t.deficit >= bytes && t.rate_admit(bytes) {
+            t.deficit -= bytes;
+            t.waiting = false;
+            return true;
+        }
+        t.waiting = true;
+        self.try_next_round();
+        false
+    }
+
+    /// Start the next round if every backlogged tenant is waiting for credit
+    #[inline]
+    fn try_next_round(&mut self) {
+        if self.tenants.values().all(|t| !t.backlogged || t.waiting) {
+            self.round += 1;
+        }
+    }
+
+    fn done(&mut self, id: usize) {
+        if let Some(t) = self.tenants.get_mut(&id) {
+            t.backlogged = false;
+            t.waiting = false;
+        }
+        self.try_next_round();
+    }
+}
+
+/// DRR scheduler of one physical QP
+pub struct FairShare {
+    state: LinuxMutex<DrrState>,
+}
+
+impl FairShare {
+    pub fn new() -> Pin<Box<Self>> {
+        let res = Box::pin(Self {
+            state: LinuxMutex::new(Default::default()),
+        });
+        res.state.init();
+        res
+    }
+
+    /// Try to post `bytes` for tenant `id`. On false, the caller should yield and retry.
+    #[inline]
+    pub fn admit(&self, id: usize, bytes: u64) -> bool {
+        self.state.lock_f(|s| s.admit(id, bytes))
+    }
+
+    /// Wait (yielding the CPU) until `bytes` of tenant `id` are admitted.
+    /// Return `Err(reply_status::timeout)` after `timeout_ms` (if positive) or once a signal
+    /// is pending, with the tenant no longer backlogged.
+    pub fn wait_admit(&self, id: usize, bytes: u64, timeout_ms: i32) -> Result<(), u32> {
+        let deadline = if timeout_ms > 0 {
+            Some(now_usec() + timeout_ms as u64 * 1000)
+        } else {
+            None
+        };
+        while !self.admit(id, bytes) {
+            if deadline.map_or(false, |d| now_usec() >= d) || unsafe { krc_signal_pending() } != 0 {
+                self.done(id);
+                return Err(reply_status::timeout);
+            }
+            yield_now();
+        }
+        Ok(())
+    }
+
+    /// The tenant has posted all of its pending requests, i.e., every chunk of its push.
+    /// Its credit is kept until then, so it is not reset by each chunk.
+    #[inline]
+    pub fn done(&self, id: usize) {
+        self.state.lock_f(|s| s.done(id))
+    }
+
+    /// Set the weight and the rate limit of a tenant. A zero weight resets it to the default.
+    pub fn set_share(&self, id: usize, weight: u32, max_bytes_per_sec: u64) {
+        self.state.lock_f(|s| {
+            let t = s.tenants.entry(id).or_insert_with(Tenant::new);
+            t.weight = if weight == 0 { DEFAULT_WEIGHT } else { weight };
+            t.max_bytes_per_sec = max_bytes_per_sec;
+            t.tokens = 0;
+            t.last_refill_usec = now_usec();
+        })
+    }
+
+    /// Forget the tenant, e.g., when its VQ is closed
+    pub fn remove(&self, id: usize) {
+        self.state.lock_f(|s| {
+            s.tenants.remove(&id);
+            s.try_next_round();
+        })
+    }
+}
+
+/// Monotonic, so a wall clock step never stalls (or floods) the refill
+#[inline]
+fn now_usec() -> u64 {
+    unsafe { krc_ktime_get_us() }
+}
+
+/// Bytes earned in `usec` at `bytes_per_sec`, saturated
+#[inline]
+fn bytes_in(usec: u64, bytes_per_sec: u64) -> u64 {
+    core::cmp::min(usec as u128 * bytes_per_sec as u128 / 1000_000, u64::MAX as u128) as u64
+}
+
+lazy_static! {
+    // one scheduler per RCtrl, i.e., per shared physical QP
+    pub static ref FAIR_SHARES: ThreadLocal<Vec<Pin<Box<FairShare>>>> = ThreadLocal::new(Vec::new());
+}
+
+#[inline]
+pub fn get_fair_share(idx: usize) -> &'static Pin<Box<FairShare>> {
+    let len = FAIR_SHARES.len();
+    &FAIR_SHARES.get_ref()[idx % len]
+}
@@ -0,0 +1,157 @@
+//! Kernel buffers backed by large physically contiguous pages.
+//!
+//! With the module param `huge_page_shift` set (e.g., 21 for 2MB), the long-lived scratch
+//! buffers are carved out of `2^huge_page_shift`-byte compound pages instead of being
+//! kmalloc-ed one by one, so that they share a few large translations in the MMU / IOMMU.
+//! The buddy allocator serves at most `krc_max_page_order` (4MB on x86), and a larger shift
+//! (e.g., 30 for 1GB) is clamped to it.
+use alloc::vec::Vec;
+use core::ptr::null_mut;
+use lazy_static::lazy_static;
+
+use KRdmaKit::mem::{Memory, RMemPhy};
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use KRdmaKit::thread_local::ThreadLocal;
+use linux_kernel_module::c_types::c_void;
+use linux_kernel_module::println;
+
+use crate::bindings::*;
+
+const PAGE_SHIFT: u32 = 12;
+/// Alignment of the buffers carved from a chunk
+const CARVE_ALIGN: usize = 64;
+
+/// The page order configured by `huge_page_shift`, None if disabled
+pub fn huge_page_order() -> Option<u32> {
+    let shift = crate::huge_page_shift::read();
+    if shift <= PAGE_SHIFT as i32 {
+        return None;
+    }
+    let max_order = unsafe { krc_max_page_order() };
+    let order = shift as u32 - PAGE_SHIFT;
+    if order > max_order {
+        println!("[huge mem] page shift {} is beyond the buddy allocator, use {}",
+                 shift, max_order + PAGE_SHIFT);
+    }
+    Some(core::cmp::min(order, max_order))
+}
+
+/// One compound page of 2^order base pages
+pub struct HugeChunk {
+    va: *mut c_void,
+    pa: u64,
+    order: u32,
+}
+
+impl HugeChunk {
+    pub fn new(order: u32) -> Option<Self> {
+        let mut pa: u64 = 0;
+        let va = unsafe { krc_alloc_huge(order, &mut pa as *mut _) };
+        if va.is_null() {
+            return None;
+        }
+        Some(Self { va, pa, order })
+    }
+
+    #[inline]
+    pub fn get_sz(&self) -> usize {
+        1 << (self.order + PAGE_SHIFT)
+    }
+}
+
+impl Drop for HugeChunk {
+    fn drop(&mut self) {
+        unsafe { krc_free_huge(self.va, self.order) };
+        self.va = null_mut();
+    }
+}
+
+/// Bump allocator over the huge chunks. The buffers live until the arena is destroyed.
+pub struct HugeArena {
+    chunks: Vec<HugeChunk>,
+    // offset of the free space in the last chunk
+    off: usize,
+    order: u32,
+}
+
+impl HugeArena {
+    pub fn new(order: u32) -> Self {
+        Self {
+            chunks: Vec::new(),
+            off: 0,
+            order,
+        }
+    }
+
+    /// Carve `size` bytes, return their (va, pa).
+    /// A buffer never spans two chunks, so it is always physically contiguous.
+    pub fn alloc(&mut self, size: usize) -> Option<(u64, u64)> {
+        let size = (size + CARVE_ALIGN - 1) & !(CARVE_ALIGN - 1);
+        if size > (1 << (self.order + PAGE_SHIFT)) {
+            return None;
+        }
+        let full = self.chunks.last().map_or(true, |c| self.off + size > c.get_sz());
+        if full {
+            self.chunks.push(HugeChunk::new(self.order)?);
+            self.off = 0;
+        }
+        let chunk = self.chunks.last().unwrap();
+        let res = (chunk.va as u64 + self.off as u64, chunk.pa + self.off as u64);
+        self.off += size;
+        Some(res)
+    }
+}
+
+lazy_static! {
+    pub static ref HUGE_ARENA: ThreadLocal<Option<HugeArena>> = ThreadLocal::new(None);
+}
+
+pub fn init_huge_arena() {
+    if let Some(order) = huge_page_order() {
+        *HUGE_ARENA.get_mut() = Some(HugeArena::new(order));
+    }
+}
+
+/// Free the chunks. All the buffers carved from them must be dropped before.
+pub fn exit_huge_arena() {
+    HUGE_ARENA.get_mut().take();
+}
+
+/// A long-lived kernel DMA buffer, carved from the huge arena if enabled
+pub enum ScratchMem {
+    Small(RMemPhy),
+    Huge { va: u64, pa: u64, sz: usize },
+}
+
+impl ScratchMem {
+    pub fn new(sz: usize) -> Self {
+        match HUGE_ARENA.get_mut().as_mut().and_then(|a| a.alloc(sz)) {
+            Some((va, pa)) => ScratchMem::Huge { va, pa, sz },
+            None => ScratchMem::Small(RMemPhy::new(sz)),
+        }
+    }
+
+    #[inline]
+    pub fn get_dma_buf(&mut self) -> u64 {
+        match self {
+            ScratchMem::Small(mem) => mem.get_dma_buf(),
+            ScratchMem::Huge { pa, .. } => *pa,
+        }
+    }
+
+    #[inline]
+    pub fn get_ptr(&self) -> *mut i8 {
+        match self {
+            ScratchMem::Small(mem) => mem.get_ptr(),
+            ScratchMem::Huge { va, .. } => *va as *mut i8,
+        }
+    }
+
+    #[inline]
+    pub fn get_sz(&self) -> usize {
+        match self {
+            ScratchMem::Small(mem) => mem.get_sz() as usize,
+            ScratchMem::Huge { sz, .. } => *sz,
+        }
+    }
+}
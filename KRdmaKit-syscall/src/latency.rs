@@ -0,0 +1,88 @@
+//! TSC-based latency breakdown of push / pop.
+//!
+//! When the module param `profile_stages` is set, each push / pop ioctl carries a
+//! `StageClock`, which splits the time from the ioctl entry into the stages of
+//! `stats_stage` and records them in the per-CPU histograms of `stats.rs`.
+//! A disabled clock costs one branch per stage.
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::timer::RTimer;
+
+use crate::bindings::*;
+use crate::stats::record_stage;
+
+#[inline]
+pub fn profile_enabled() -> bool {
+    crate::profile_stages::read() != 0
+}
+
+pub struct StageClock {
+    timer: RTimer,
+    // cycles (since the ioctl entry) of the last stage boundary
+    last: u64,
+    // cycles spent in posting since the last boundary
+    post: u64,
+}
+
+impl StageClock {
+    pub fn new() -> Self {
+        Self {
+            timer: RTimer::new(),
+            last: 0,
+            post: 0,
+        }
+    }
+
+    /// End `stage` now
+    #[inline]
+    pub fn mark(&mut self, stage: u32) {
+        let now = self.timer.passed();
+        record_stage(stage, now.saturating_sub(self.last));
+        self.last = now;
+    }
+
+    /// Add the cycles of posting, which interleaves with building the requests
+    #[inline]
+    pub fn add_post(&mut self, cycles: u64) {
+        self.post += cycles;
+    }
+
+    /// End the build and post stages now. The time not spent in posting is building.
+    #[inline]
+    pub fn mark_build_post(&mut self) {
+        let now = self.timer.passed();
+        let elapsed = now.saturating_sub(self.last);
+        record_stage(stats_stage::StageBuild, elapsed.saturating_sub(self.post));
+        record_stage(stats_stage::StagePost, core::cmp::min(self.post, elapsed));
+        self.post = 0;
+        self.last = now;
+    }
+
+    /// The ioctl returns
+    #[inline]
+    pub fn finish(self) {
+        record_stage(stats_stage::StageTotal, self.timer.passed());
+    }
+}
+
+/// Accumulates the cycles of the post calls in a push implementation
+pub struct PostTimer {
+    on: bool,
+    pub cycles: u64,
+}
+
+impl PostTimer {
+    #[inline]
+    pub fn new(on: bool) -> Self {
+        Self { on, cycles: 0 }
+    }
+
+    #[inline]
+    pub fn time<T>(&mut self, f: impl FnOnce() -> T) -> T {
+        if !self.on {
+            return f();
+        }
+        let timer = RTimer::new();
+        let res = f();
+        self.cycles += timer.passed();
+        res
+    }
+}
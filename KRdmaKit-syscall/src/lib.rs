@@ -1,5 +1,5 @@
 #![no_std]
-#![feature(get_mut_unchecked, allocator_api, min_const_generics, maybe_uninit_extra)]
+#![feature(get_mut_unchecked, allocator_api, min_const_generics, maybe_uninit_extra, new_uninit)]
 
 struct KRdmaKitSyscallModule {
     _client: Option<client::Client>,
@@ -15,6 +15,20 @@ mod consts;
 mod rpc;
 mod client;
 mod bindings;
+mod user_mr;
+mod rndv;
+mod ud_batch;
+mod fair_share;
+mod reaper;
+mod recovery;
+mod stats;
+mod latency;
+mod trace;
+mod huge_mem;
+mod srq_pool;
+mod batch;
+mod comp_wait;
+mod cookie;
 // mod mem;
 
 use alloc::string::String;
@@ -27,6 +41,14 @@ use krdmakit_macros::declare_module_param;
 use linux_kernel_module::{println, cstr};
 use crate::linux_kernel_module::c_types::c_uint;
 declare_module_param!(meta_server_gid, *mut u8);
+// idle seconds before the RC of a VQ is released, 0 disables the reaping
+declare_module_param!(rc_idle_timeout_sec, i32);
+// profile the latency of the push / pop stages if nonzero
+declare_module_param!(profile_stages, i32);
+// back the kernel scratch buffers with 2^shift-byte contiguous pages, 0 disables (e.g., 21 for 2MB)
+declare_module_param!(huge_page_shift, i32);
+// msecs a push waits for its completion before returning timeout, 0 waits forever
+declare_module_param!(comp_timeout_ms, i32);
 
 pub fn get_meta_server_gid() -> String {
     unsafe { ptr2string(meta_server_gid::read()) }
@@ -69,6 +91,26 @@ pub fn op_code_table(op: u32) -> u32 {
     }
 }
 
+/// Map the `req_flags` of a request to the `ib_send_flags`
+#[inline]
+pub fn send_flag_table(flags: u32) -> i32 {
+    use KRdmaKit::rust_kernel_rdma_base::*;
+    use crate::bindings::*;
+    let mut res = 0;
+    if flags & req_flags::req_signaled != 0 {
+        res |= ib_send_flags::IB_SEND_SIGNALED;
+    }
+    if flags & req_flags::req_fence != 0 {
+        res |= ib_send_flags::IB_SEND_FENCE;
+    }
+    res
+}
+
+#[inline]
+pub fn is_signaled(req: &bindings::core_req_t) -> bool {
+    req.send_flags & bindings::req_flags::req_signaled != 0
+}
+
 impl Drop for KRdmaKitSyscallModule {
     fn drop(&mut self) {
         println!("Goodbye KRdma syscall module!");
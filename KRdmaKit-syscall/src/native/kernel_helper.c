@@ -6,3 +6,238 @@ char gids_arr[BUF_LENGTH] = "fe80:0000:0000:0000:ec0d:9a03:0078:645e";
 char* meta_server_gid = gids_arr;
 module_param_string(meta_server_gid, gids_arr, BUF_LENGTH, DEFAULT_PERMISSION);
 
+int rc_idle_timeout_sec = 60;
+module_param(rc_idle_timeout_sec, int, DEFAULT_PERMISSION);
+
+int profile_stages = 0;
+module_param(profile_stages, int, DEFAULT_PERMISSION);
+
+int huge_page_shift = 0;
+module_param(huge_page_shift, int, DEFAULT_PERMISSION);
+
+int comp_timeout_ms = 1000;
+module_param(comp_timeout_ms, int, DEFAULT_PERMISSION);
+
+
+#include <linux/mm.h>
+#include <linux/io.h>
+
+long
+krc_pin_user_pages(unsigned long start, unsigned long nr_pages, void **pages) {
+    return get_user_pages_fast(start, nr_pages, FOLL_WRITE, (struct page **) pages);
+}
+
+void
+krc_unpin_user_page(void *page) {
+    set_page_dirty_lock((struct page *) page);
+    put_page((struct page *) page);
+}
+
+unsigned long long
+krc_page_to_phys(void *page) {
+    return page_to_phys((struct page *) page);
+}
+
+unsigned int
+krc_max_page_order(void) {
+#ifdef MAX_PAGE_ORDER
+    return MAX_PAGE_ORDER;
+#else
+    return MAX_ORDER - 1;
+#endif
+}
+
+void *
+krc_alloc_huge(unsigned int order, unsigned long long *pa) {
+    struct page *page;
+    if (order > krc_max_page_order())
+        return NULL;
+    page = alloc_pages(GFP_KERNEL | __GFP_COMP | __GFP_ZERO | __GFP_NOWARN, order);
+    if (!page)
+        return NULL;
+    *pa = page_to_phys(page);
+    return page_address(page);
+}
+
+void
+krc_free_huge(void *va, unsigned int order) {
+    __free_pages(virt_to_page(va), order);
+}
+
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+unsigned int
+krc_num_possible_cpus(void) {
+    return num_possible_cpus();
+}
+
+#include <asm/tsc.h>
+
+unsigned long long
+krc_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/* implemented in stats.rs */
+extern int krc_stats_read_nic(unsigned int nic, stats_t *out);
+extern unsigned int krc_stats_read_vqs(vq_stats_t *out, unsigned int cap);
+extern void krc_stats_read_stages(stage_hists_t *out);
+
+#define MAX_DUMP_VQS 1024
+
+static const char *krc_stats_names[StatCounterNum] = {
+    "read", "write", "send", "send_imm", "write_imm",
+    "bytes", "batches", "signaled", "unsignaled", "pop_empty",
+    "path_rc", "path_dc", "path_ud", "migrations", "errors",
+};
+
+static const char *krc_stage_names[StageNum] = {
+    "copy_in", "build", "post", "comp", "copy_out", "total",
+};
+
+static struct dentry *krc_debugfs_root = NULL;
+
+static int
+krc_nic_stats_show(struct seq_file *m, void *v) {
+    stats_t stats;
+    int i;
+    if (krc_stats_read_nic((unsigned int) (unsigned long) m->private, &stats) != 0)
+        return -ENODEV;
+    for (i = 0; i < StatCounterNum; ++i)
+        seq_printf(m, "%s %llu\n", krc_stats_names[i], stats.counters[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(krc_nic_stats);
+
+static int
+krc_vq_stats_show(struct seq_file *m, void *v) {
+    vq_stats_t *vqs;
+    unsigned int n, i, j;
+    vqs = kvmalloc_array(MAX_DUMP_VQS, sizeof(vq_stats_t), GFP_KERNEL);
+    if (!vqs)
+        return -ENOMEM;
+    n = krc_stats_read_vqs(vqs, MAX_DUMP_VQS);
+
+    seq_puts(m, "id port");
+    for (j = 0; j < StatCounterNum; ++j)
+        seq_printf(m, " %s", krc_stats_names[j]);
+    seq_putc(m, '\n');
+    for (i = 0; i < n; ++i) {
+        seq_printf(m, "%llu %u", vqs[i].id, vqs[i].port);
+        for (j = 0; j < StatCounterNum; ++j)
+            seq_printf(m, " %llu", vqs[i].stats.counters[j]);
+        seq_putc(m, '\n');
+    }
+    kvfree(vqs);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(krc_vq_stats);
+
+static int
+krc_stage_stats_show(struct seq_file *m, void *v) {
+    stage_hists_t *hists;
+    unsigned int s, i;
+    hists = kvmalloc(sizeof(stage_hists_t), GFP_KERNEL);
+    if (!hists)
+        return -ENOMEM;
+    krc_stats_read_stages(hists);
+
+    // one line per stage: name, then `lower bound (cycles):count` of the non-empty buckets
+    seq_printf(m, "tsc_khz %llu\n", hists->tsc_khz);
+    for (s = 0; s < StageNum; ++s) {
+        seq_printf(m, "%s", krc_stage_names[s]);
+        for (i = 0; i < hist_bucket_num; ++i) {
+            if (hists->buckets[s][i])
+                seq_printf(m, " %llu:%llu", i == 0 ? 0ULL : 1ULL << (i - 1), hists->buckets[s][i]);
+        }
+        seq_putc(m, '\n');
+    }
+    kvfree(hists);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(krc_stage_stats);
+
+int
+krc_debugfs_init(unsigned int nic_num) {
+    char name[16];
+    unsigned int i;
+    krc_debugfs_root = debugfs_create_dir("krcore", NULL);
+    if (IS_ERR_OR_NULL(krc_debugfs_root))
+        return -ENODEV;
+    for (i = 0; i < nic_num; ++i) {
+        snprintf(name, sizeof(name), "nic%u", i);
+        debugfs_create_file(name, 0444, krc_debugfs_root,
+                            (void *) (unsigned long) i, &krc_nic_stats_fops);
+    }
+    debugfs_create_file("vqs", 0444, krc_debugfs_root, NULL, &krc_vq_stats_fops);
+    debugfs_create_file("stages", 0444, krc_debugfs_root, NULL, &krc_stage_stats_fops);
+    return 0;
+}
+
+void
+krc_debugfs_exit(void) {
+    debugfs_remove_recursive(krc_debugfs_root);
+    krc_debugfs_root = NULL;
+}
+
+#define CREATE_TRACE_POINTS
+#include "krcore_trace.h"
+
+int
+krc_trace_push_enabled(void) {
+    return trace_vq_push_enabled();
+}
+
+void
+krc_trace_connect(unsigned long long vq, unsigned int port, unsigned int vid, unsigned int status) {
+    trace_vq_connect(vq, port, vid, status);
+}
+
+void
+krc_trace_push(unsigned long long vq, unsigned int op, unsigned int len, unsigned int batch,
+               unsigned int path) {
+    trace_vq_push(vq, op, len, batch, path);
+}
+
+void
+krc_trace_pop(unsigned long long vq, unsigned int cmd, unsigned int status, unsigned int count) {
+    trace_vq_pop(vq, cmd, status, count);
+}
+
+void
+krc_trace_migrate(unsigned long long vq, unsigned int port, unsigned int vid, unsigned int to_rc) {
+    trace_vq_migrate(vq, port, vid, to_rc);
+}
+
+void
+krc_trace_bind(unsigned long long vq, unsigned int port, unsigned int bind, unsigned int status) {
+    trace_vq_bind(vq, port, bind, status);
+}
+
+void
+krc_trace_error(unsigned long long vq, unsigned int cmd, unsigned int status, unsigned int wc_status) {
+    trace_vq_error(vq, cmd, status, wc_status);
+}
+
+#include <linux/delay.h>
+#include <linux/sched/signal.h>
+
+void
+krc_usleep_range(unsigned long long min_us, unsigned long long max_us) {
+    usleep_range(min_us, max_us);
+}
+
+int
+krc_signal_pending(void) {
+    return signal_pending(current);
+}
+
+#include <linux/timekeeping.h>
+
+unsigned long long
+krc_ktime_get_us(void) {
+    return ktime_get_ns() / 1000;
+}
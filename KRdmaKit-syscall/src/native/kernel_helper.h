@@ -2,3 +2,91 @@
 #include <linux/stat.h>
 #include <linux/types.h>
 
+/* Pin `nr_pages` user pages starting from `start` for DMA.
+ * Return the number of pinned pages, or a negative errno. */
+long
+krc_pin_user_pages(unsigned long start, unsigned long nr_pages, void **pages);
+
+void
+krc_unpin_user_page(void *page);
+
+unsigned long long
+krc_page_to_phys(void *page);
+
+#include "../../../include/common.h"
+
+/* Statistics of one VQ, dumped to debugfs */
+typedef struct {
+    unsigned long long id;
+    unsigned int port;
+    stats_t stats;
+} vq_stats_t;
+
+unsigned int
+krc_num_possible_cpus(void);
+
+unsigned long long
+krc_tsc_khz(void);
+
+/* Create /sys/kernel/debug/krcore, with one file per NIC and a `vqs` file.
+ * Return 0 on success. */
+int
+krc_debugfs_init(unsigned int nic_num);
+
+void
+krc_debugfs_exit(void);
+
+/* Tracepoints, see krcore_trace.h */
+enum krc_trace_path {
+    TracePathBind = 0,
+    TracePathRC,
+    TracePathDC,
+    TracePathUD,
+};
+
+/* Whether `vq_push` is on. The per-request events are only assembled if so. */
+int
+krc_trace_push_enabled(void);
+
+void
+krc_trace_connect(unsigned long long vq, unsigned int port, unsigned int vid, unsigned int status);
+
+void
+krc_trace_push(unsigned long long vq, unsigned int op, unsigned int len, unsigned int batch,
+               unsigned int path);
+
+void
+krc_trace_pop(unsigned long long vq, unsigned int cmd, unsigned int status, unsigned int count);
+
+void
+krc_trace_migrate(unsigned long long vq, unsigned int port, unsigned int vid, unsigned int to_rc);
+
+void
+krc_trace_bind(unsigned long long vq, unsigned int port, unsigned int bind, unsigned int status);
+
+void
+krc_trace_error(unsigned long long vq, unsigned int cmd, unsigned int status, unsigned int wc_status);
+
+/* Allocate 2^`order` physically contiguous pages (zeroed) as one compound page.
+ * Return its kernel va and set `pa`, or NULL if the order is too large or on OOM. */
+void *
+krc_alloc_huge(unsigned int order, unsigned long long *pa);
+
+void
+krc_free_huge(void *va, unsigned int order);
+
+/* The largest order served by the buddy allocator */
+unsigned int
+krc_max_page_order(void);
+
+/* Sleep on an hrtimer for [min_us, max_us] usecs */
+void
+krc_usleep_range(unsigned long long min_us, unsigned long long max_us);
+
+/* Whether the current task has a pending signal */
+int
+krc_signal_pending(void);
+
+/* Monotonic time in usecs, unaffected by the wall clock changes */
+unsigned long long
+krc_ktime_get_us(void);
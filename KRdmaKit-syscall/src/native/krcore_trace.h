@@ -0,0 +1,141 @@
+/* Tracepoints of the VQs, under /sys/kernel/tracing/events/krcore.
+ * `vq` is the id of the VQ, the same as in /sys/kernel/debug/krcore/vqs. */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM krcore
+
+#if !defined(_KRCORE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KRCORE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(vq_connect,
+    TP_PROTO(u64 vq, u32 port, u32 vid, u32 status),
+    TP_ARGS(vq, port, vid, status),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, port)
+        __field(u32, vid)
+        __field(u32, status)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->port = port;
+        __entry->vid = vid;
+        __entry->status = status;
+    ),
+    TP_printk("vq=%llu port=%u vid=%u status=%u",
+              __entry->vq, __entry->port, __entry->vid, __entry->status)
+);
+
+/* one event per request, `batch` is the size of the batch it is posted in */
+TRACE_EVENT(vq_push,
+    TP_PROTO(u64 vq, u32 op, u32 len, u32 batch, u32 path),
+    TP_ARGS(vq, op, len, batch, path),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, op)
+        __field(u32, len)
+        __field(u32, batch)
+        __field(u32, path)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->op = op;
+        __entry->len = len;
+        __entry->batch = batch;
+        __entry->path = path;
+    ),
+    TP_printk("vq=%llu op=%u len=%u batch=%u path=%s",
+              __entry->vq, __entry->op, __entry->len, __entry->batch,
+              __print_symbolic(__entry->path,
+                               /* enum krc_trace_path */
+                               { 0, "bind" }, { 1, "rc" }, { 2, "dc" }, { 3, "ud" }))
+);
+
+TRACE_EVENT(vq_pop,
+    TP_PROTO(u64 vq, u32 cmd, u32 status, u32 count),
+    TP_ARGS(vq, cmd, status, count),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, cmd)
+        __field(u32, status)
+        __field(u32, count)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->cmd = cmd;
+        __entry->status = status;
+        __entry->count = count;
+    ),
+    TP_printk("vq=%llu cmd=%u status=%u count=%u",
+              __entry->vq, __entry->cmd, __entry->status, __entry->count)
+);
+
+/* the VQ switches between its RC (to_rc = 1) and the shared DC/UD QP (to_rc = 0) */
+TRACE_EVENT(vq_migrate,
+    TP_PROTO(u64 vq, u32 port, u32 vid, u32 to_rc),
+    TP_ARGS(vq, port, vid, to_rc),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, port)
+        __field(u32, vid)
+        __field(u32, to_rc)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->port = port;
+        __entry->vid = vid;
+        __entry->to_rc = to_rc;
+    ),
+    TP_printk("vq=%llu port=%u vid=%u %s",
+              __entry->vq, __entry->port, __entry->vid, __entry->to_rc ? "dc->rc" : "rc->dc")
+);
+
+TRACE_EVENT(vq_bind,
+    TP_PROTO(u64 vq, u32 port, u32 bind, u32 status),
+    TP_ARGS(vq, port, bind, status),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, port)
+        __field(u32, bind)
+        __field(u32, status)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->port = port;
+        __entry->bind = bind;
+        __entry->status = status;
+    ),
+    TP_printk("vq=%llu port=%u %s status=%u",
+              __entry->vq, __entry->port, __entry->bind ? "bind" : "unbind", __entry->status)
+);
+
+/* a failed ioctl (`status` is the reply status), or a failed RC completion
+ * (`wc_status` is the ib_wc_status) */
+TRACE_EVENT(vq_error,
+    TP_PROTO(u64 vq, u32 cmd, u32 status, u32 wc_status),
+    TP_ARGS(vq, cmd, status, wc_status),
+    TP_STRUCT__entry(
+        __field(u64, vq)
+        __field(u32, cmd)
+        __field(u32, status)
+        __field(u32, wc_status)
+    ),
+    TP_fast_assign(
+        __entry->vq = vq;
+        __entry->cmd = cmd;
+        __entry->status = status;
+        __entry->wc_status = wc_status;
+    ),
+    TP_printk("vq=%llu cmd=%u status=%u wc_status=%u",
+              __entry->vq, __entry->cmd, __entry->status, __entry->wc_status)
+);
+
+#endif /* _KRCORE_TRACE_H */
+
+/* the helper is not built by kbuild, so the header is found via the include path of build.rs */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE krcore_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,185 @@
+//! Lifecycle of the physical resources held by the VQs.
+//!
+//! A VQ holding an RC registers itself here. The reaper kthread periodically scans
+//! the registered VQs and releases the RCs which have been idle for longer than
+//! the `rc_idle_timeout_sec` module parameter, unless work is still outstanding on them.
+//! The released VQ falls back to the shared DC QP (or reconnects on its next push
+//! without `dct_qp`).
+//!
+//! The reaper kthread also asks the remotes to deregister the released RCs, so no
+//! detached kthread outlives the module.
+use alloc::collections::VecDeque;
+use alloc::string::ToString;
+use alloc::vec::Vec;
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use hashbrown::HashMap;
+use lazy_static::lazy_static;
+
+use KRdmaKit::cm::EndPoint;
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::kthread;
+use linux_kernel_module::c_types::c_void;
+use linux_kernel_module::mutex::LinuxMutex;
+use linux_kernel_module::sync::Mutex;
+
+use crate::bindings::krc_ktime_get_us;
+use crate::virtual_queue::VQ;
+
+/// Guards a VQ against the concurrent reaper, and records its last activity
+pub struct VQActivity {
+    in_use: AtomicBool,
+    last_active_usec: AtomicU64,
+}
+
+impl VQActivity {
+    pub fn new() -> Self {
+        Self {
+            in_use: AtomicBool::new(false),
+            last_active_usec: AtomicU64::new(now_usec()),
+        }
+    }
+
+    /// Claim the VQ, wait if the reaper is releasing its resources
+    #[inline]
+    pub fn enter(&self) {
+        while !self.try_enter() {
+            kthread::yield_now();
+        }
+    }
+
+    #[inline]
+    pub fn try_enter(&self) -> bool {
+        self.in_use
+            .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+            .is_ok()
+    }
+
+    #[inline]
+    pub fn leave(&self, touch: bool) {
+        if touch {
+            self.last_active_usec.store(now_usec(), Ordering::Relaxed);
+        }
+        self.in_use.store(false, Ordering::Release);
+    }
+
+    #[inline]
+    pub fn idle_usec(&self) -> u64 {
+        now_usec().saturating_sub(self.last_active_usec.load(Ordering::Relaxed))
+    }
+}
+
+/// Monotonic, so a wall clock step neither reaps the busy RCs nor keeps the idle ones
+#[inline]
+fn now_usec() -> u64 {
+    unsafe { krc_ktime_get_us() }
+}
+
+lazy_static! {
+    // <VQ address, VQActivity address> of the VQs holding an RC
+    static ref RC_HOLDERS: LinuxMutex<HashMap<usize, usize>> = LinuxMutex::new(Default::default());
+    // disconnections left to the reaper kthread
+    static ref PENDING_DISCONNECTS: LinuxMutex<VecDeque<DisconnectParam>> =
+        LinuxMutex::new(Default::default());
+}
+
+static REAPER_RUNNING: AtomicBool = AtomicBool::new(false);
+
+#[inline]
+pub fn register_rc_holder(vq: *mut VQ, activity: &VQActivity) {
+    RC_HOLDERS.lock_f(|m| m.insert(vq as usize, activity as *const VQActivity as usize));
+}
+
+#[inline]
+pub fn unregister_rc_holder(vq: *mut VQ) {
+    RC_HOLDERS.lock_f(|m| m.remove(&(vq as usize)));
+}
+
+extern "C" fn reaper_thread(_param: *mut c_void) -> i32 {
+    while !kthread::should_stop() {
+        kthread::sleep(1);
+        serve_disconnects();
+        let timeout_sec = crate::rc_idle_timeout_sec::read();
+        if timeout_sec <= 0 {
+            continue;
+        }
+        let timeout_usec = timeout_sec as u64 * 1000_000;
+        // the victims are claimed and unregistered under the lock, but released after it,
+        // so a slow teardown does not block the VQs (un)registering meanwhile
+        let victims: Vec<(usize, usize)> = RC_HOLDERS.lock_f(|m| {
+            let claimed: Vec<(usize, usize)> = m.iter()
+                .filter(|(_, act)| {
+                    let act = unsafe { &*(**act as *const VQActivity) };
+                    act.idle_usec() > timeout_usec && act.try_enter()
+                })
+                .map(|(vq, act)| (*vq, *act))
+                .collect();
+            let mut victims = Vec::new();
+            for (vq, act) in claimed {
+                let vq_ref = unsafe { &*(vq as *const VQ) };
+                // keep the RC (and retry later) while work is outstanding on it
+                if vq_ref.rc_drained() {
+                    m.remove(&vq);
+                    victims.push((vq, act));
+                } else {
+                    unsafe { &*(act as *const VQActivity) }.leave(false);
+                }
+            }
+            victims
+        });
+        // claimed, so the VQs are not dropped meanwhile
+        for (vq, act) in victims {
+            unsafe { &mut *(vq as *mut VQ) }.release_rc();
+            unsafe { &*(act as *const VQActivity) }.leave(false);
+        }
+    }
+    0
+}
+
+pub struct Reaper {
+    handler: Option<kthread::JoinHandler>,
+}
+
+impl Reaper {
+    pub fn start() -> Self {
+        RC_HOLDERS.init();
+        PENDING_DISCONNECTS.init();
+        let handler = kthread::Builder::new()
+            .set_name("KRdma reaper".to_string())
+            .spawn(reaper_thread)
+            .ok();
+        REAPER_RUNNING.store(handler.is_some(), Ordering::Release);
+        Self { handler }
+    }
+}
+
+impl Drop for Reaper {
+    fn drop(&mut self) {
+        REAPER_RUNNING.store(false, Ordering::Release);
+        self.handler.take().map(|h| h.join());
+        // the ones queued after the last scan
+        serve_disconnects();
+    }
+}
+
+/// Parameters of the background disconnection
+pub struct DisconnectParam {
+    pub point: EndPoint,
+    pub qd: usize,
+}
+
+/// Ask the remote to deregister the RC via RPC, without blocking the caller.
+/// The RPC is issued by the reaper kthread, or right here if it is not running.
+pub fn bg_disconnect_rc(point: EndPoint, qd: usize) {
+    let param = DisconnectParam { point, qd };
+    if !REAPER_RUNNING.load(Ordering::Acquire) {
+        let _ = crate::rpc::caller::call_disconnect_rc(&param.point, param.qd);
+        return;
+    }
+    PENDING_DISCONNECTS.lock_f(|q| q.push_back(param));
+}
+
+fn serve_disconnects() {
+    while let Some(param) = PENDING_DISCONNECTS.lock_f(|q| q.pop_front()) {
+        let _ = crate::rpc::caller::call_disconnect_rc(&param.point, param.qd);
+    }
+}
@@ -0,0 +1,145 @@
+//! Recovery from the fatal errors of the RC.
+//!
+//! Once the RC of a VQ enters the error state (e.g., the remote reboots or the retry count
+//! is exceeded), the VQ falls back to the DC QP and reconnects the RC in the background.
+//! The requests still in flight on the failed RC are tracked by `InflightLog`: the idempotent
+//! ones (READ / WRITE) are replayed on the DC QP, the others are failed back to the user,
+//! since they may or may not have reached the remote.
+use alloc::collections::VecDeque;
+use alloc::vec::Vec;
+use core::ptr::null_mut;
+
+use KRdmaKit::rust_kernel_rdma_base::*;
+
+use crate::bindings::*;
+use crate::is_signaled;
+
+/// Max tracked requests. The oldest are dropped beyond it, which only happens when the user
+/// keeps posting unsignaled requests without ever polling a completion.
+pub const MAX_INFLIGHT: usize = 1024;
+
+// ib_wc_status / ib_wc_opcode values used by the synthesized completions
+pub const IB_WC_SUCCESS: u32 = 0;
+pub const IB_WC_WR_FLUSH_ERR: u32 = 5;
+const IB_WC_SEND: u32 = 0;
+const IB_WC_RDMA_WRITE: u32 = 1;
+const IB_WC_RDMA_READ: u32 = 2;
+
+/// Marks a logged request posted by the kernel itself, e.g., a signaled rendezvous
+/// descriptor, whose completion only reclaims the send queue and is not reported
+const REQ_INTERNAL: u32 = 1 << 31;
+
+/// Requests posted on the RC whose completions have not been observed yet
+pub struct InflightLog {
+    reqs: VecDeque<core_req_t>,
+}
+
+impl InflightLog {
+    pub fn new() -> Self {
+        Self {
+            reqs: VecDeque::new(),
+        }
+    }
+
+    #[inline]
+    pub fn record(&mut self, req: &core_req_t) {
+        let mut req = *req;
+        req.send_flags &= !REQ_INTERNAL;
+        self.push(req);
+    }
+
+    /// Log a signaled send posted by the kernel itself
+    #[inline]
+    pub fn record_internal(&mut self) {
+        let mut req: core_req_t = Default::default();
+        req.type_ = lib_r_req::Send;
+        req.send_flags = req_flags::req_signaled | REQ_INTERNAL;
+        self.push(req);
+    }
+
+    #[inline]
+    fn push(&mut self, req: core_req_t) {
+        if self.reqs.len() >= MAX_INFLIGHT {
+            self.reqs.pop_front();
+        }
+        self.reqs.push_back(req);
+    }
+
+    /// A successful completion retires the requests up to the oldest signaled one,
+    /// since the RC completes the requests in order. Return the cookie of that one,
+    /// or None if it is internal and must not be reported.
+    #[inline]
+    pub fn retire_one(&mut self) -> Option<u64> {
+        while let Some(req) = self.reqs.pop_front() {
+            if is_signaled(&req) {
+                return if is_internal(&req) { None } else { Some(req.cookie) };
+            }
+        }
+        Some(0)
+    }
+
+    /// Whether an internal completion is still to be polled
+    #[inline]
+    pub fn internal_pending(&self) -> bool {
+        self.reqs.iter().any(|req| is_internal(req))
+    }
+
+    #[inline]
+    pub fn clear(&mut self) {
+        self.reqs.clear();
+    }
+
+    /// Requests posted but not known to be completed
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.reqs.len()
+    }
+
+    /// Signaled requests whose completions have not been observed yet, internal included
+    #[inline]
+    pub fn signaled(&self) -> usize {
+        self.reqs.iter().filter(|req| is_signaled(req)).count()
+    }
+
+    /// Whether a replay of the log generates any completion
+    #[inline]
+    pub fn has_signaled_replayable(&self) -> bool {
+        self.reqs.iter().any(|req| is_signaled(req) && is_replayable(req))
+    }
+
+    /// Take all the user requests, split into (replayable, failed)
+    pub fn drain(&mut self) -> (Vec<core_req_t>, Vec<core_req_t>) {
+        self.reqs.drain(..).filter(|req| !is_internal(req)).partition(|req| is_replayable(req))
+    }
+}
+
+#[inline]
+fn is_internal(req: &core_req_t) -> bool {
+    req.send_flags & REQ_INTERNAL != 0
+}
+
+/// Whether posting the request again is harmless
+#[inline]
+pub fn is_replayable(req: &core_req_t) -> bool {
+    req.type_ == lib_r_req::Read || req.type_ == lib_r_req::Write
+}
+
+/// Assemble the completion of a failed request
+#[inline]
+pub fn failed_wc(req: &core_req_t, status: u32) -> ib_wc {
+    failed_wc_with(req.type_, req.cookie, status)
+}
+
+#[inline]
+pub fn failed_wc_with(req_type: u32, wr_id: u64, status: u32) -> ib_wc {
+    let mut wc: ib_wc = Default::default();
+    wc.opcode = match req_type {
+        lib_r_req::Read => IB_WC_RDMA_READ,
+        lib_r_req::Write | lib_r_req::WriteImm => IB_WC_RDMA_WRITE,
+        _ => IB_WC_SEND,
+    };
+    wc.status = status;
+    wc.__bindgen_anon_1.wr_id = wr_id;
+    wc.qp = null_mut();
+    wc
+}
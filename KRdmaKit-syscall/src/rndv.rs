@@ -0,0 +1,313 @@
+//! Rendezvous protocol for large two-sided messages.
+//!
+//! Messages smaller than `RNDV_THRESHOLD` are sent eagerly. For a larger one, the sender only
+//! sends a descriptor of its buffer (tagged by `RNDV_IMM_FLAG` in the imm). The receiver pulls
+//! the payload with RDMA READ and writes an ack back to the sender,
+//! so that each side observes a single logical completion of the message.
+use alloc::boxed::Box;
+use core::pin::Pin;
+use core::ptr::null_mut;
+use hashbrown::HashMap;
+
+use KRdmaKit::ctrl::RCtrl;
+use KRdmaKit::mem::{Memory, RMemPhy};
+use KRdmaKit::qp::RCOp;
+use KRdmaKit::rust_kernel_rdma_base::*;
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use linux_kernel_module::bindings::{_copy_from_user, _copy_to_user};
+use linux_kernel_module::c_types::c_void;
+use linux_kernel_module::println;
+
+use crate::bindings::*;
+use crate::comp_wait::{drain_stale, SpinWindow, StaleComps, wait_fresh_comp};
+use crate::user_mr::{is_kernel_va, UserMR};
+
+/// Payload size (in bytes) from which the rendezvous protocol is used
+pub const RNDV_THRESHOLD: usize = 64 * 1024;
+/// Set in the imm of a descriptor message. The low bits still carry the vid.
+pub const RNDV_IMM_FLAG: u32 = 1 << 31;
+/// The descriptor sends are unsignaled, except one in every `RNDV_SIGNAL_EVERY`,
+/// whose (internal) completion reclaims the send queue of the RC
+pub const RNDV_SIGNAL_EVERY: usize = 32;
+/// READs into a registered user buffer posted per wait, one per physically contiguous run
+const RNDV_READ_BATCH: usize = 16;
+
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct RndvDesc {
+    pub addr: u64,
+    pub len: u64,
+    pub rkey: u32,
+    pub ack_rkey: u32,
+    pub ack_addr: u64,
+}
+
+#[repr(C, align(64))]
+struct RndvSlot {
+    desc: RndvDesc,
+    ack: u64,
+    wr_id: u64,
+}
+
+const SLOT_MEM_SZ: usize = 4096;
+const SLOT_NUM: usize = SLOT_MEM_SZ / core::mem::size_of::<RndvSlot>();
+
+/// Sender side states. Each in-flight rendezvous message holds one slot,
+/// which keeps its descriptor and the ack word written by the receiver.
+pub struct RndvSender {
+    mem: RMemPhy,
+    head: usize,
+    tail: usize,
+}
+
+impl RndvSender {
+    pub fn new() -> Self {
+        Self {
+            mem: RMemPhy::new(SLOT_MEM_SZ),
+            head: 0,
+            tail: 0,
+        }
+    }
+
+    #[inline]
+    fn slot(&self, i: usize) -> *mut RndvSlot {
+        (self.mem.get_ptr() as u64 +
+            ((i % SLOT_NUM) * core::mem::size_of::<RndvSlot>()) as u64) as *mut RndvSlot
+    }
+
+    #[inline]
+    fn slot_pa(&mut self, i: usize) -> u64 {
+        self.mem.get_pa(((i % SLOT_NUM) * core::mem::size_of::<RndvSlot>()) as u64)
+    }
+
+    /// Fill the descriptor of the payload at physical address `addr`.
+    /// Return the physical address of the descriptor, or None if all the slots are in use.
+    pub fn prepare(&mut self, addr: u64, len: usize, rkey: u32, wr_id: u64) -> Option<u64> {
+        if self.head - self.tail >= SLOT_NUM {
+            return None;
+        }
+        let idx = self.head;
+        let slot_pa = self.slot_pa(idx);
+        let ack_addr = slot_pa + core::mem::size_of::<RndvDesc>() as u64;
+        unsafe {
+            let slot = &mut *self.slot(idx);
+            slot.desc = RndvDesc {
+                addr,
+                len: len as u64,
+                rkey,
+                ack_rkey: rkey,
+                ack_addr,
+            };
+            core::ptr::write_volatile(&mut slot.ack as *mut u64, 0);
+            slot.wr_id = wr_id;
+        }
+        self.head += 1;
+        Some(slot_pa)
+    }
+
+    /// Pop the oldest in-flight message if it has been acked (or rejected) by the receiver.
+    /// Return the `wr_id` recorded in `prepare`, and the status of its completion.
+    #[inline]
+    pub fn pop_acked(&mut self) -> Option<(u64, u32)> {
+        if self.is_empty() {
+            return None;
+        }
+        let slot = unsafe { &*self.slot(self.tail) };
+        let ack = unsafe { core::ptr::read_volatile(&slot.ack as *const u64) };
+        if ack == 0 {
+            return None;
+        }
+        self.tail += 1;
+        let status = if ack == RNDV_ACK_VAL { IB_WC_SUCCESS } else { IB_WC_REM_INV_REQ_ERR };
+        Some((slot.wr_id, status))
+    }
+
+    /// Pop the oldest in-flight message regardless of its ack, e.g., when the RC has failed
+    #[inline]
+    pub fn pop_unacked(&mut self) -> Option<u64> {
+        if self.is_empty() {
+            return None;
+        }
+        let slot = unsafe { &*self.slot(self.tail) };
+        self.tail += 1;
+        Some(slot.wr_id)
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.head == self.tail
+    }
+}
+
+static RNDV_ACK_VAL: u64 = 1;
+// the receiver has no room for the payload
+static RNDV_NACK_VAL: u64 = 2;
+
+// ib_wc_status / ib_wc_opcode values used by the synthesized completions
+const IB_WC_SUCCESS: u32 = 0;
+const IB_WC_LOC_LEN_ERR: u32 = 1;
+const IB_WC_REM_INV_REQ_ERR: u32 = 9;
+const IB_WC_GENERAL_ERR: u32 = 21;
+const IB_WC_SEND: u32 = 0;
+
+/// Serve the rendezvous messages among the polled `wcs` on the bind side.
+/// The payload of the i-th completion is read into the i-th `payload_sz` bytes of the user
+/// `payload_buf`, and the sender is acked. A payload which lies in a region of `mrs` is read
+/// there in place, the others are staged through `landing` one chunk at a time.
+/// The completion then reports the user buffer in its `wr_id` and the payload length in
+/// `byte_len`, and its imm is restored to the vid so the user sees an ordinary message.
+/// A payload which cannot be read (no room in the user buffer, or a failed READ) is rejected on
+/// both sides, so the sender never waits for an ack which does not come.
+/// The READs wait as `wait_fresh_comp`, which passes the stale completions to `on_stale`.
+pub fn serve_rndv_recvs(ctrl: &'static Pin<Box<RCtrl<'static>>>, wcs: *mut ib_wc, cnt: usize,
+                        mrs: &HashMap<u32, UserMR>, landing: &mut RMemPhy, landing_sz: usize,
+                        lkey: u32, spin: &mut SpinWindow, stale: &mut StaleComps,
+                        on_stale: &mut dyn FnMut(*mut ib_cq, ib_wc, bool),
+                        payload_sz: u32, payload_buf: u64) -> u32 {
+    let wc_sz = core::mem::size_of::<ib_wc>() as u64;
+    for i in 0..cnt as u64 {
+        let wc = unsafe { &mut *((wcs as u64 + i * wc_sz) as *mut ib_wc) };
+        let imm = unsafe { wc.ex.imm_data } as u32;
+        if wc.status != 0 || imm & RNDV_IMM_FLAG == 0 {
+            continue;
+        }
+        let vid = (imm & !RNDV_IMM_FLAG) as usize;
+        wc.ex.imm_data = vid as _;
+
+        let rc = match ctrl.get_trc(vid) {
+            Some(rc) => rc,
+            None => {
+                // no RC to the sender, which fails its sends once the RC breaks
+                wc.status = IB_WC_GENERAL_ERR;
+                continue;
+            }
+        };
+
+        let va = wc.get_wr_id() as u64;
+        let mut desc: RndvDesc = Default::default();
+        if is_kernel_va(va) {
+            desc = unsafe { *(va as *const RndvDesc) };
+        } else {
+            // the descriptor landed in a user supplied buffer
+            unsafe {
+                _copy_from_user(
+                    (&mut desc as *mut RndvDesc).cast::<c_void>(),
+                    va as *mut c_void,
+                    core::mem::size_of::<RndvDesc>() as u64,
+                )
+            };
+        }
+
+        let mut op = RCOp::new(rc);
+        let dst = payload_buf + i * payload_sz as u64;
+        let ack = if payload_buf == 0 || desc.len > payload_sz as u64 {
+            println!("[rndv] no room for the payload, vid: {}, len: {}, room: {}",
+                     vid, desc.len, payload_sz);
+            wc.status = IB_WC_LOC_LEN_ERR;
+            &RNDV_NACK_VAL
+        } else if read_payload(&mut op, rc.get_cq(), &desc, mrs, landing, landing_sz, lkey,
+                               spin, stale, on_stale, dst) {
+            wc.__bindgen_anon_1.wr_id = dst;
+            wc.byte_len = desc.len as u32;
+            &RNDV_ACK_VAL
+        } else {
+            println!("[rndv] read payload err, vid: {}, len: {}", vid, desc.len);
+            wc.status = IB_WC_GENERAL_ERR;
+            &RNDV_NACK_VAL
+        };
+
+        if op.push(ib_wr_opcode::IB_WR_RDMA_WRITE,
+                   ack as *const u64 as u64, lkey,
+                   core::mem::size_of::<u64>(),
+                   desc.ack_addr, desc.ack_rkey, ib_send_flags::IB_SEND_INLINE).is_err() {
+            return reply_status::err;
+        }
+    }
+    reply_status::ok
+}
+
+/// Read the payload described by `desc` to the user buffer `dst`.
+/// The runs of `dst` which are physically contiguous in a region of `mrs` are read in place,
+/// up to `RNDV_READ_BATCH` of them per wait; the rest is read into `landing` and copied out
+/// chunk by chunk. Nothing is read while a timed-out READ may still write its buffer.
+fn read_payload(op: &mut RCOp<'_>, cq: *mut ib_cq, desc: &RndvDesc, mrs: &HashMap<u32, UserMR>,
+                landing: &mut RMemPhy, landing_sz: usize, lkey: u32, spin: &mut SpinWindow,
+                stale: &mut StaleComps, on_stale: &mut dyn FnMut(*mut ib_cq, ib_wc, bool),
+                dst: u64) -> bool {
+    // the READs given up by the earlier waits (on any RC) complete first
+    for stale_cq in stale.internal_cqs() {
+        if drain_stale(stale_cq, spin, stale, on_stale).is_err() {
+            return false;
+        }
+    }
+
+    let landing_pa = landing.get_dma_buf();
+    let landing_va = landing.get_ptr() as u64;
+    let mut runs = [(0 as u64, 0 as u64); RNDV_READ_BATCH];
+    let mut off = 0 as u64;
+    while off < desc.len {
+        let mut n = 0;
+        let mut end = off;
+        while n < RNDV_READ_BATCH && end < desc.len {
+            match mrs.values().find_map(|mr| mr.contiguous(dst + end, desc.len - end)) {
+                Some(run) => {
+                    runs[n] = run;
+                    n += 1;
+                    end += run.1;
+                }
+                None => break,
+            }
+        }
+        if n > 0 {
+            // in place, only the last one is signaled since the RC completes in order
+            for (j, (pa, len)) in runs[..n].iter().enumerate() {
+                let flags = if j + 1 == n { ib_send_flags::IB_SEND_SIGNALED } else { 0 };
+                if op.push(ib_wr_opcode::IB_WR_RDMA_READ, *pa, lkey, *len as usize,
+                           desc.addr + off, desc.rkey, flags).is_err() {
+                    return false;
+                }
+                off += *len;
+            }
+            if !wait_read(cq, spin, stale, on_stale) {
+                return false;
+            }
+            continue;
+        }
+
+        let len = core::cmp::min(desc.len - off, landing_sz as u64) as usize;
+        if op.push(ib_wr_opcode::IB_WR_RDMA_READ, landing_pa, lkey, len,
+                   desc.addr + off, desc.rkey, ib_send_flags::IB_SEND_SIGNALED).is_err() ||
+            !wait_read(cq, spin, stale, on_stale) {
+            return false;
+        }
+        let left = unsafe {
+            _copy_to_user((dst + off) as *mut c_void, landing_va as *mut c_void, len as u64)
+        };
+        if left != 0 {
+            return false;
+        }
+        off += len as u64;
+    }
+    true
+}
+
+/// Wait for the last READ posted on `cq`. A timed-out one is internal, dropped once polled.
+#[inline]
+fn wait_read(cq: *mut ib_cq, spin: &mut SpinWindow, stale: &mut StaleComps,
+             on_stale: &mut dyn FnMut(*mut ib_cq, ib_wc, bool)) -> bool {
+    match wait_fresh_comp(cq, spin, stale, false, on_stale) {
+        Ok(res) => res.status == IB_WC_SUCCESS,
+        Err(_) => false,
+    }
+}
+
+/// Assemble the completion of an acked rendezvous send
+#[inline]
+pub fn rndv_send_wc(wr_id: u64, status: u32) -> ib_wc {
+    let mut wc: ib_wc = Default::default();
+    wc.opcode = IB_WC_SEND;
+    wc.status = status;
+    wc.__bindgen_anon_1.wr_id = wr_id;
+    wc.qp = null_mut();
+    wc
+}
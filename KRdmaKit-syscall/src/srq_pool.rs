@@ -0,0 +1,253 @@
+//! Per-NIC receive pool shared by all the bound services (feature `shared_srq`).
+//!
+//! Without it, each bound port receives on the UD QP of its own RCtrl, whose receives are
+//! reposted one by one upon the replies, so the posted receive memory grows with the number
+//! of services. With it, a bound port gets a UD QP attached to the NIC's SRQ and recv CQ,
+//! registered under `SRQ_UD_HINT` (the hint the clients resolve with SIDR). All the ports
+//! draw from one pool of `POOL_DEPTH` buffers, refilled once fewer than `LOW_WATERMARK`
+//! remain posted. The completions are demultiplexed to the ports by their QP, and the
+//! ones polled on behalf of the other ports are kept in per-port backlogs.
+//!
+//! A buffer is only reposted once it is free: not while its message waits in a backlog,
+//! nor while the port it was handed to may still read it (i.e., until that port polls again).
+use alloc::boxed::Box;
+use alloc::collections::VecDeque;
+use alloc::sync::Arc;
+use alloc::vec::Vec;
+use core::pin::Pin;
+use core::ptr::null_mut;
+use hashbrown::HashMap;
+use lazy_static::lazy_static;
+
+use KRdmaKit::device::RContext;
+use KRdmaKit::mem::{pa_to_va, Memory};
+use KRdmaKit::qp::{RecvHelper, UD};
+use KRdmaKit::rust_kernel_rdma_base::*;
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use KRdmaKit::thread_local::ThreadLocal;
+use linux_kernel_module::mutex::LinuxMutex;
+use linux_kernel_module::println;
+use linux_kernel_module::sync::Mutex;
+
+use crate::huge_mem::ScratchMem;
+
+/// Posted receives of one NIC, each of `ENTRY_SZ` bytes
+pub const POOL_DEPTH: usize = 2048;
+pub const ENTRY_SZ: usize = 2048;
+/// Refill the pool once fewer receives remain posted
+pub const LOW_WATERMARK: usize = POOL_DEPTH / 4;
+
+struct PoolState {
+    recvs: Arc<RecvHelper<POOL_DEPTH>>,
+    // kernel va of the first buffer, by which a completion finds its buffer
+    base_va: u64,
+    posted: usize,
+    // buffers neither posted nor holding a message
+    free: Vec<usize>,
+    // <ib_qp address, port> of the attached UDs
+    ports: HashMap<usize, usize>,
+    // completions polled for the other ports
+    backlogs: HashMap<usize, VecDeque<ib_wc>>,
+    // buffers handed to each port by its last poll
+    lent: HashMap<usize, Vec<usize>>,
+}
+
+impl PoolState {
+    #[inline]
+    fn slot_of(&self, wc: &ib_wc) -> usize {
+        ((wc.get_wr_id() as u64 - self.base_va) / ENTRY_SZ as u64) as usize
+    }
+
+    /// Repost the free buffers, chained into one post
+    fn refill(&mut self, srq: *mut ib_srq) {
+        if self.posted >= LOW_WATERMARK || self.free.is_empty() {
+            return;
+        }
+        let recvs = unsafe { Arc::get_mut_unchecked(&mut self.recvs) };
+        let last = self.free.len() - 1;
+        for i in 0..last {
+            let next = recvs.get_recv_wr_ptr(self.free[i + 1]);
+            unsafe { (*recvs.get_recv_wr_ptr(self.free[i])).next = next };
+        }
+        unsafe { (*recvs.get_recv_wr_ptr(self.free[last])).next = null_mut() };
+
+        let mut bad_wr: *mut ib_recv_wr = null_mut();
+        let err = unsafe {
+            bd_ib_post_srq_recv(srq, recvs.get_recv_wr_ptr(self.free[0]), &mut bad_wr as *mut _)
+        };
+        if err != 0 {
+            println!("[srq pool] error when post recv {}", err);
+            return;
+        }
+        self.posted += self.free.len();
+        self.free.clear();
+    }
+
+    /// The buffers of the messages handed to `port` have been read
+    #[inline]
+    fn reclaim(&mut self, port: usize) {
+        if let Some(lent) = self.lent.get_mut(&port) {
+            self.free.append(lent);
+        }
+    }
+}
+
+pub struct SrqPool {
+    ctx: &'static RContext<'static>,
+    srq: *mut ib_srq,
+    recv_cq: *mut ib_cq,
+    // backs the receive buffers, kept alive with the pool
+    _mem: ScratchMem,
+    state: LinuxMutex<PoolState>,
+}
+
+impl SrqPool {
+    pub fn new(ctx: &'static RContext<'static>) -> Option<Pin<Box<Self>>> {
+        let mut cq_attr: ib_cq_init_attr = Default::default();
+        cq_attr.cqe = POOL_DEPTH as u32;
+        let recv_cq = unsafe {
+            ib_create_cq(ctx.get_raw_dev(), None, None, null_mut(), &mut cq_attr as *mut _)
+        };
+        if recv_cq.is_null() {
+            println!("[srq pool] fail to create the recv cq");
+            return None;
+        }
+        let mut srq_attr: ib_srq_init_attr = Default::default();
+        srq_attr.attr.max_wr = POOL_DEPTH as u32;
+        srq_attr.attr.max_sge = 1;
+        let srq = unsafe { ib_create_srq(ctx.get_pd(), &mut srq_attr as *mut _) };
+        if srq.is_null() {
+            println!("[srq pool] fail to create the srq");
+            unsafe { ib_destroy_cq(recv_cq) };
+            return None;
+        }
+
+        let mut mem = ScratchMem::new(POOL_DEPTH * ENTRY_SZ);
+        let base_pa = mem.get_dma_buf();
+        let recvs = RecvHelper::<POOL_DEPTH>::create(ENTRY_SZ, unsafe { ctx.get_lkey() }, base_pa);
+        let res = Box::pin(Self {
+            ctx,
+            srq,
+            recv_cq,
+            _mem: mem,
+            state: LinuxMutex::new(PoolState {
+                recvs,
+                base_va: unsafe { pa_to_va(base_pa as *mut i8) } as u64,
+                posted: 0,
+                free: (0..POOL_DEPTH).collect(),
+                ports: Default::default(),
+                backlogs: Default::default(),
+                lent: Default::default(),
+            }),
+        });
+        res.state.init();
+        res.state.lock_f(|s| s.refill(srq));
+        Some(res)
+    }
+
+    /// Create the UD QP of `port` on the pool
+    pub fn attach(&self, port: usize) -> Option<Arc<UD>> {
+        let ud = UD::new_with_srq(self.ctx, self.recv_cq, self.srq)?;
+        self.state.lock_f(|s| {
+            s.ports.insert(ud.get_qp() as usize, port);
+            s.backlogs.insert(port, VecDeque::new());
+            s.lent.insert(port, Vec::new());
+        });
+        Some(ud)
+    }
+
+    /// Forget the UD of `port`. Its pending messages are dropped.
+    pub fn detach(&self, ud: &Arc<UD>) {
+        self.state.lock_f(|s| {
+            if let Some(port) = s.ports.remove(&(ud.get_qp() as usize)) {
+                s.reclaim(port);
+                s.lent.remove(&port);
+                if let Some(backlog) = s.backlogs.remove(&port) {
+                    for wc in backlog.iter() {
+                        let slot = s.slot_of(wc);
+                        s.free.push(slot);
+                    }
+                }
+            }
+            s.refill(self.srq);
+        });
+    }
+
+    /// Poll the messages of `port` into `out`, return the number of them.
+    /// Their buffers stay valid until the next poll of `port`.
+    pub fn poll(&self, port: usize, out: &mut [ib_wc]) -> usize {
+        self.state.lock_f(|s| {
+            s.reclaim(port);
+            let mut n = 0;
+            if let Some(backlog) = s.backlogs.get_mut(&port) {
+                while n < out.len() {
+                    match backlog.pop_front() {
+                        Some(wc) => {
+                            out[n] = wc;
+                            n += 1;
+                        }
+                        None => break,
+                    }
+                }
+            }
+            if n < out.len() {
+                let polled = unsafe {
+                    bd_ib_poll_cq(self.recv_cq, (out.len() - n) as i32, &mut out[n] as *mut _)
+                };
+                let polled = core::cmp::max(polled, 0) as usize;
+                s.posted = s.posted.saturating_sub(polled);
+                // keep ours in place, and move the others to their backlogs
+                let mut kept = n;
+                for i in n..n + polled {
+                    let owner = s.ports.get(&(out[i].qp as usize)).copied();
+                    if owner == Some(port) {
+                        out[kept] = out[i];
+                        kept += 1;
+                    } else if let Some(backlog) = owner.and_then(|p| s.backlogs.get_mut(&p)) {
+                        backlog.push_back(out[i]);
+                    } else {
+                        // of a detached port
+                        let slot = s.slot_of(&out[i]);
+                        s.free.push(slot);
+                    }
+                }
+                n = kept;
+            }
+            for i in 0..n {
+                let slot = s.slot_of(&out[i]);
+                s.lent.entry(port).or_insert_with(Vec::new).push(slot);
+            }
+            s.refill(self.srq);
+            n
+        })
+    }
+}
+
+impl Drop for SrqPool {
+    fn drop(&mut self) {
+        // the attached UDs must have been destroyed
+        unsafe {
+            ib_destroy_srq(self.srq);
+            ib_destroy_cq(self.recv_cq);
+        }
+    }
+}
+
+unsafe impl Send for SrqPool {}
+
+unsafe impl Sync for SrqPool {}
+
+lazy_static! {
+    // one pool per NIC
+    pub static ref SRQ_POOLS: ThreadLocal<Vec<Pin<Box<SrqPool>>>> = ThreadLocal::new(Vec::new());
+}
+
+/// The pool of the NIC serving the `ctrl_idx`th RCtrl
+#[inline]
+pub fn get_srq_pool(ctrl_idx: usize) -> Option<&'static Pin<Box<SrqPool>>> {
+    let pools = SRQ_POOLS.get_ref();
+    if pools.is_empty() {
+        return None;
+    }
+    Some(&pools[ctrl_idx % pools.len()])
+}
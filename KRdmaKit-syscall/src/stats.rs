@@ -0,0 +1,235 @@
+//! Runtime statistics of the VQs.
+//!
+//! Each VQ keeps its own counters, which are only updated by its ioctl (the VQ is claimed
+//! by one caller at a time). Each NIC keeps one set of counters per CPU, so the updates from
+//! the VQs on different CPUs never contend. The latency histograms of the push / pop stages
+//! (see `latency.rs`) are kept per CPU as well. All of them can be read via the `QueryStats`
+//! command, or from `/sys/kernel/debug/krcore`.
+use alloc::boxed::Box;
+use alloc::vec::Vec;
+use core::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use hashbrown::HashMap;
+use lazy_static::lazy_static;
+
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::kthread::get_cpu_id;
+use KRdmaKit::thread_local::ThreadLocal;
+use linux_kernel_module::mutex::LinuxMutex;
+use linux_kernel_module::sync::Mutex;
+
+use crate::bindings::*;
+
+pub const COUNTER_NUM: usize = stats_counter::StatCounterNum as usize;
+
+/// One set of counters, padded to avoid false sharing among the CPUs
+#[repr(C, align(64))]
+pub struct Counters {
+    c: [AtomicU64; COUNTER_NUM],
+}
+
+impl Counters {
+    pub fn new() -> Self {
+        Self {
+            c: unsafe { core::mem::zeroed() },
+        }
+    }
+
+    #[inline]
+    pub fn add(&self, counter: u32, v: u64) {
+        self.c[counter as usize].fetch_add(v, Ordering::Relaxed);
+    }
+
+    /// Accumulate the counters to `out`
+    #[inline]
+    pub fn sum_to(&self, out: &mut stats_t) {
+        for i in 0..COUNTER_NUM {
+            out.counters[i] += self.c[i].load(Ordering::Relaxed);
+        }
+    }
+}
+
+/// Counters of one NIC, one set per CPU
+pub struct PerCpuCounters {
+    cpus: Vec<Counters>,
+}
+
+impl PerCpuCounters {
+    pub fn new() -> Self {
+        let cpu_num = unsafe { krc_num_possible_cpus() } as usize;
+        let mut cpus = Vec::with_capacity(cpu_num);
+        for _ in 0..cpu_num {
+            cpus.push(Counters::new());
+        }
+        Self { cpus }
+    }
+
+    #[inline]
+    pub fn add(&self, counter: u32, v: u64) {
+        // being preempted to another CPU is harmless, since the counters are atomic
+        let cpu = get_cpu_id() as usize;
+        self.cpus[cpu % self.cpus.len()].add(counter, v);
+    }
+
+    pub fn sum_to(&self, out: &mut stats_t) {
+        for c in self.cpus.iter() {
+            c.sum_to(out);
+        }
+    }
+}
+
+/// Ids of the VQs, allocated in order, so no kernel address is exposed
+static NEXT_VQ_ID: AtomicU64 = AtomicU64::new(1);
+
+/// Counters of one VQ
+pub struct VQStats {
+    /// Id of the VQ in debugfs and the tracepoints
+    pub id: u64,
+    pub port: AtomicUsize,
+    pub counters: Counters,
+}
+
+impl VQStats {
+    /// Create the counters and make them visible in debugfs until `unregister`
+    pub fn register() -> Box<Self> {
+        let res = Box::new(Self {
+            id: NEXT_VQ_ID.fetch_add(1, Ordering::Relaxed),
+            port: AtomicUsize::new(0),
+            counters: Counters::new(),
+        });
+        let ptr = &*res as *const Self as usize;
+        VQ_STATS.lock_f(|m| m.insert(res.id, ptr));
+        res
+    }
+
+    pub fn unregister(&self) {
+        VQ_STATS.lock_f(|m| m.remove(&self.id));
+    }
+}
+
+pub const STAGE_NUM: usize = stats_stage::StageNum as usize;
+pub const BUCKET_NUM: usize = stats_hist_consts::hist_bucket_num as usize;
+
+/// Log2-bucketed latency histograms of the stages on one CPU
+#[repr(C, align(64))]
+pub struct StageHists {
+    buckets: [[AtomicU64; BUCKET_NUM]; STAGE_NUM],
+}
+
+impl StageHists {
+    pub fn new() -> Self {
+        Self {
+            buckets: unsafe { core::mem::zeroed() },
+        }
+    }
+
+    #[inline]
+    pub fn record(&self, stage: u32, cycles: u64) {
+        // bucket i holds [2^(i-1), 2^i)
+        let bucket = (64 - cycles.leading_zeros()) as usize;
+        self.buckets[stage as usize][core::cmp::min(bucket, BUCKET_NUM - 1)]
+            .fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn sum_to(&self, out: &mut stage_hists_t) {
+        for s in 0..STAGE_NUM {
+            for i in 0..BUCKET_NUM {
+                out.buckets[s][i] += self.buckets[s][i].load(Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+lazy_static! {
+    pub static ref STAGE_HISTS: ThreadLocal<Vec<StageHists>> = ThreadLocal::new(Vec::new());
+    pub static ref NIC_STATS: ThreadLocal<Vec<PerCpuCounters>> = ThreadLocal::new(Vec::new());
+    // <id, VQStats address> of the open VQs
+    static ref VQ_STATS: LinuxMutex<HashMap<u64, usize>> = LinuxMutex::new(Default::default());
+}
+
+/// Create the counters of `nic_num` NICs and the debugfs entries
+pub fn init_stats(nic_num: usize) {
+    VQ_STATS.init();
+    let cpu_num = unsafe { krc_num_possible_cpus() } as usize;
+    for _ in 0..cpu_num {
+        STAGE_HISTS.get_mut().push(StageHists::new());
+    }
+    for _ in 0..nic_num {
+        NIC_STATS.get_mut().push(PerCpuCounters::new());
+    }
+    if unsafe { krc_debugfs_init(nic_num as _) } != 0 {
+        linux_kernel_module::println!("[stats] fail to create the debugfs entries");
+    }
+}
+
+pub fn exit_stats() {
+    unsafe { krc_debugfs_exit() };
+    NIC_STATS.get_mut().clear();
+    STAGE_HISTS.get_mut().clear();
+}
+
+/// Record one sample of `stage` on the current CPU
+#[inline]
+pub fn record_stage(stage: u32, cycles: u64) {
+    let hists = STAGE_HISTS.get_ref();
+    if !hists.is_empty() {
+        hists[get_cpu_id() as usize % hists.len()].record(stage, cycles);
+    }
+}
+
+pub fn read_stages(out: &mut stage_hists_t) {
+    out.tsc_khz = unsafe { krc_tsc_khz() };
+    for h in STAGE_HISTS.get_ref().iter() {
+        h.sum_to(out);
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn krc_stats_read_stages(out: *mut stage_hists_t) {
+    let out = unsafe { &mut *out };
+    *out = unsafe { core::mem::zeroed() };
+    read_stages(out);
+}
+
+#[inline]
+pub fn nic_stats(nic: usize) -> Option<&'static PerCpuCounters> {
+    NIC_STATS.get_ref().get(nic)
+}
+
+/// Count on the NIC of the `ctrl_idx`th RCtrl, which are created round-robin over the NICs
+#[inline]
+pub fn add_nic_stat(ctrl_idx: usize, counter: u32, v: u64) {
+    let nics = NIC_STATS.get_ref();
+    if !nics.is_empty() {
+        nics[ctrl_idx % nics.len()].add(counter, v);
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn krc_stats_read_nic(nic: u32, out: *mut stats_t) -> i32 {
+    match nic_stats(nic as usize) {
+        Some(c) => {
+            let out = unsafe { &mut *out };
+            *out = Default::default();
+            c.sum_to(out);
+            0
+        }
+        None => -1,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn krc_stats_read_vqs(out: *mut vq_stats_t, cap: u32) -> u32 {
+    VQ_STATS.lock_f(|m| {
+        let mut n = 0;
+        for (id, stats) in m.iter().take(cap as usize) {
+            let stats = unsafe { &*(*stats as *const VQStats) };
+            let entry = unsafe { &mut *out.add(n) };
+            *entry = Default::default();
+            entry.id = *id;
+            entry.port = stats.port.load(Ordering::Relaxed) as u32;
+            stats.counters.sum_to(&mut entry.stats);
+            n += 1;
+        }
+        n as u32
+    })
+}
@@ -0,0 +1,41 @@
+//! Tracepoints of the VQs (see `native/krcore_trace.h`).
+//!
+//! Each event is one call into the C helper, whose static key is a patched-out jump while
+//! the event is off. The per-request push events are only assembled when `vq_push` is on.
+use crate::bindings::*;
+
+#[inline]
+pub fn connect(vq: u64, port: usize, vid: usize, status: u32) {
+    unsafe { krc_trace_connect(vq, port as _, vid as _, status) };
+}
+
+/// Trace a batch of requests posted on `path` (`krc_trace_path`)
+#[inline]
+pub fn push(vq: u64, req_list: &[core_req_t], path: u32) {
+    if unsafe { krc_trace_push_enabled() } == 0 {
+        return;
+    }
+    for req in req_list.iter() {
+        unsafe { krc_trace_push(vq, req.type_, req.length, req_list.len() as _, path) };
+    }
+}
+
+#[inline]
+pub fn pop(vq: u64, cmd: u32, status: u32, count: usize) {
+    unsafe { krc_trace_pop(vq, cmd, status, count as _) };
+}
+
+#[inline]
+pub fn migrate(vq: u64, port: usize, vid: usize, to_rc: bool) {
+    unsafe { krc_trace_migrate(vq, port as _, vid as _, to_rc as _) };
+}
+
+#[inline]
+pub fn bind(vq: u64, port: usize, bind: bool, status: u32) {
+    unsafe { krc_trace_bind(vq, port as _, bind as _, status) };
+}
+
+#[inline]
+pub fn error(vq: u64, cmd: u32, status: u32, wc_status: u32) {
+    unsafe { krc_trace_error(vq, cmd, status, wc_status) };
+}
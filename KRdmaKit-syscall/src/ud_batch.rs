@@ -0,0 +1,138 @@
+use alloc::boxed::Box;
+use core::ptr::null_mut;
+
+use KRdmaKit::cm::EndPoint;
+use KRdmaKit::qp::UD;
+use KRdmaKit::rust_kernel_rdma_base::*;
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use linux_kernel_module::{Error, KernelResult};
+
+pub const DEFAULT_BATCH_SZ: usize = 64;
+/// The largest message a UD send carries, i.e., the path MTU of the UD QPs (IB_MTU_4096)
+pub const UD_MAX_PAYLOAD: usize = 4096;
+
+/// Doorbell batching for UD sends.
+/// The requests are linked into one chain and posted with a single `ib_post_send`,
+/// so a batch costs one doorbell instead of one per message.
+/// Each send has up to two sges: an optional header, then the payload.
+/// The arrays take ~7KB, so it lives on the heap (see `new_boxed`) and is reused across pushes.
+pub struct UDDoorbell {
+    wrs: [ib_ud_wr; DEFAULT_BATCH_SZ],
+    sges: [[ib_sge; 2]; DEFAULT_BATCH_SZ],
+    cur_sz: usize,
+}
+
+impl UDDoorbell {
+    /// Allocated in place, since the arrays are too large for the kernel stack
+    pub fn new_boxed() -> Box<Self> {
+        // all-zero is an empty batch
+        unsafe { Box::new_zeroed().assume_init() }
+    }
+
+    /// Drop the sends not flushed, e.g., by a failed push
+    #[inline]
+    pub fn clear(&mut self) {
+        self.cur_sz = 0;
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.cur_sz == 0
+    }
+
+    #[inline]
+    pub fn is_full(&self) -> bool {
+        self.cur_sz >= DEFAULT_BATCH_SZ
+    }
+
+    /// Add one send to the batch. The batch is flushed to `qp` first if it is full.
+    /// The address handle of `end_point` is reused, so callers should keep the endpoint cached.
+    /// `wr_id` is returned in the completion of the send, e.g., the cookie of the request.
+    #[inline]
+    pub fn push(
+        &mut self,
+        qp: &UD,
+        op: u32,
+        local_ptr: u64,
+        lkey: u32,
+        end_point: &EndPoint,
+        sz: usize,
+        imm_data: u32,
+        send_flag: i32,
+        wr_id: u64,
+    ) -> KernelResult<()> {
+        self.push_with_header(qp, op, None, local_ptr, lkey, end_point, sz, imm_data, send_flag, wr_id)
+    }
+
+    /// As `push`, while the message starts with the `header` (address, size) ahead of the payload
+    #[inline]
+    pub fn push_with_header(
+        &mut self,
+        qp: &UD,
+        op: u32,
+        header: Option<(u64, usize)>,
+        local_ptr: u64,
+        lkey: u32,
+        end_point: &EndPoint,
+        sz: usize,
+        imm_data: u32,
+        send_flag: i32,
+        wr_id: u64,
+    ) -> KernelResult<()> {
+        if self.is_full() {
+            self.flush(qp)?;
+        }
+        let idx = self.cur_sz;
+        let sges = &mut self.sges[idx];
+        let mut num_sge = 0;
+        if let Some((addr, len)) = header {
+            sges[0].addr = addr;
+            sges[0].length = len as u32;
+            sges[0].lkey = lkey;
+            num_sge += 1;
+        }
+        let sge = &mut sges[num_sge];
+        sge.addr = local_ptr;
+        sge.length = sz as u32;
+        sge.lkey = lkey;
+        num_sge += 1;
+
+        let wr = &mut self.wrs[idx];
+        wr.remote_qpn = end_point.qpn as u32;
+        wr.remote_qkey = end_point.qkey as u32;
+        wr.ah = end_point.ah;
+        wr.wr.wr_id = wr_id;
+        wr.wr.opcode = op;
+        wr.wr.send_flags = send_flag;
+        wr.wr.ex.imm_data = imm_data;
+        wr.wr.num_sge = num_sge as i32;
+        wr.wr.sg_list = sges.as_mut_ptr();
+        wr.wr.next = null_mut();
+        if idx > 0 {
+            self.wrs[idx - 1].wr.next = &mut self.wrs[idx].wr as *mut ib_send_wr;
+        }
+        self.cur_sz += 1;
+        Ok(())
+    }
+
+    /// Post all the pending sends with one doorbell.
+    #[inline]
+    pub fn flush(&mut self, qp: &UD) -> KernelResult<()> {
+        if self.is_empty() {
+            return Ok(());
+        }
+        let mut bad_wr: *mut ib_send_wr = null_mut();
+        let err = unsafe {
+            bd_ib_post_send(
+                qp.get_qp(),
+                &mut self.wrs[0].wr as *mut _,
+                &mut bad_wr as *mut _,
+            )
+        };
+        self.cur_sz = 0;
+        if err != 0 {
+            return Err(Error::from_kernel_errno(err));
+        }
+        Ok(())
+    }
+}
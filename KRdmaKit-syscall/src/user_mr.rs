@@ -0,0 +1,162 @@
+use alloc::vec::Vec;
+use core::ptr::null_mut;
+use hashbrown::HashMap;
+
+use KRdmaKit::rust_kernel_rdma_base::*;
+use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module;
+use linux_kernel_module::c_types::c_void;
+use linux_kernel_module::println;
+
+use crate::bindings::*;
+
+const PAGE_SHIFT: u64 = 12;
+const PAGE_SZ: u64 = 1 << PAGE_SHIFT;
+
+/// User memory region registered by `qreg_mr`.
+/// The pages are pinned until the region is dropped, so the NIC can DMA into the
+/// user buffers directly with the physical address and the context lkey.
+/// Physically contiguous pages are merged into one extent, so a region backed by
+/// huge pages (e.g., `MAP_HUGETLB`) is a few extents, and a buffer may span its base pages.
+pub struct UserMR {
+    va: u64,
+    size: u64,
+    pages: Vec<*mut c_void>,
+    // (index of the first page, physical address of the first page), sorted
+    extents: Vec<(usize, u64)>,
+    // whether any receive has been posted in the region on the current RC
+    pub(crate) recv_posted: bool,
+}
+
+impl UserMR {
+    pub fn new(va: u64, size: u64) -> Option<Self> {
+        if size == 0 {
+            return None;
+        }
+        // both from the user, so never trust `va + size`
+        let end = va.checked_add(size - 1)?;
+        let first = va >> PAGE_SHIFT;
+        let last = end >> PAGE_SHIFT;
+        let nr_pages = (last - first + 1) as usize;
+
+        let mut pages: Vec<*mut c_void> = Vec::with_capacity(nr_pages);
+        pages.resize(nr_pages, null_mut());
+        let pinned = unsafe {
+            krc_pin_user_pages(first << PAGE_SHIFT, nr_pages as _, pages.as_mut_ptr())
+        };
+        if pinned < 0 || pinned as usize != nr_pages {
+            println!("[user mr] pin user pages err, expect {} got {}", nr_pages, pinned);
+            for i in 0..core::cmp::max(pinned, 0) as usize {
+                unsafe { krc_unpin_user_page(pages[i]) };
+            }
+            return None;
+        }
+        let mut extents: Vec<(usize, u64)> = Vec::new();
+        let mut next_pa = 0;
+        for (i, page) in pages.iter().enumerate() {
+            let pa = unsafe { krc_page_to_phys(*page) };
+            if extents.is_empty() || pa != next_pa {
+                extents.push((i, pa));
+            }
+            next_pa = pa + PAGE_SZ;
+        }
+        Some(Self { va, size, pages, extents, recv_posted: false })
+    }
+
+    /// Translate the user buffer `[va, va + len)` to its physical address.
+    /// Return None if the buffer is out of the region or not physically contiguous.
+    #[inline]
+    pub fn translate(&self, va: u64, len: u64) -> Option<u64> {
+        match self.contiguous(va, len) {
+            Some((pa, run)) if run == len => Some(pa),
+            _ => None,
+        }
+    }
+
+    /// The physical address of `va`, and how many of the `len` bytes from it are physically
+    /// contiguous (and in the region). Return None if `va` is out of the region.
+    #[inline]
+    pub fn contiguous(&self, va: u64, len: u64) -> Option<(u64, u64)> {
+        // `va` and `len` are from the user, so only `va - self.va` is computed
+        if len == 0 || va < self.va || va - self.va >= self.size {
+            return None;
+        }
+        let base = self.va >> PAGE_SHIFT;
+        let first = ((va >> PAGE_SHIFT) - base) as usize;
+        // the extent holding the first page
+        let e = match self.extents.binary_search_by_key(&first, |(start, _)| *start) {
+            Ok(e) => e,
+            Err(e) => e - 1,
+        };
+        let end = self.extents.get(e + 1).map_or(self.pages.len(), |(start, _)| *start);
+        // the last byte of the extent, bounded by the last byte of the region
+        let last = core::cmp::min(((base + end as u64) << PAGE_SHIFT) - 1,
+                                  self.va + (self.size - 1));
+        let (start, pa) = self.extents[e];
+        Some((pa + ((first - start) as u64) * PAGE_SZ + (va & (PAGE_SZ - 1)),
+              core::cmp::min(len, last - va + 1)))
+    }
+}
+
+impl Drop for UserMR {
+    fn drop(&mut self) {
+        for page in self.pages.iter() {
+            unsafe { krc_unpin_user_page(*page) };
+        }
+    }
+}
+
+/// Post receives that land directly in the user buffers.
+/// The `wr_id` of each receive is the user va, which is returned to the user in `wc_wr_id`.
+pub fn post_user_recvs(qp: *mut ib_qp, lkey: u32,
+                       mr: &UserMR, bufs: &[recv_buf_t]) -> u32 {
+    const DEFAULT_BATCH_SZ: usize = 64;
+    let mut wrs: [ib_recv_wr; DEFAULT_BATCH_SZ] = unsafe { core::mem::zeroed() };
+    let mut sges: [ib_sge; DEFAULT_BATCH_SZ] = unsafe { core::mem::zeroed() };
+
+    for chunk in bufs.chunks(DEFAULT_BATCH_SZ) {
+        for (i, buf) in chunk.iter().enumerate() {
+            let pa = match mr.translate(buf.addr, buf.length as u64) {
+                Some(pa) => pa,
+                None => return reply_status::addr_error,
+            };
+            sges[i].addr = pa;
+            sges[i].length = buf.length;
+            sges[i].lkey = lkey;
+
+            wrs[i].num_sge = 1;
+            wrs[i].sg_list = &mut sges[i] as *mut _;
+            wrs[i].next = if i + 1 < chunk.len() {
+                &mut wrs[i + 1] as *mut _
+            } else {
+                null_mut()
+            };
+            unsafe { bd_set_recv_wr_id(&mut wrs[i] as *mut _, buf.addr) };
+        }
+        let mut bad_wr: *mut ib_recv_wr = null_mut();
+        let err = unsafe { bd_ib_post_recv(qp, &mut wrs[0] as *mut _, &mut bad_wr as *mut _) };
+        if err != 0 {
+            println!("[user mr] error when post recv {}", err);
+            return reply_status::err;
+        }
+    }
+    reply_status::ok
+}
+
+/// Physical address of the local buffer of `req`: an offset in the kernel buffer at `local_pa`,
+/// or with `req_user_buf`, a user va in the region registered with the hint `req.lkey`.
+/// Return None if the user buffer is out of the region or not physically contiguous.
+#[inline]
+pub fn local_addr(mrs: &HashMap<u32, UserMR>, req: &core_req_t, local_pa: u64) -> Option<u64> {
+    if req.send_flags & req_flags::req_user_buf == 0 {
+        return local_pa.checked_add(req.addr as u64);
+    }
+    // a zero-length request still needs a valid address
+    let len = core::cmp::max(req.length, 1) as u64;
+    mrs.get(&req.lkey).and_then(|mr| mr.translate(req.addr as u64, len))
+}
+
+/// The wr_id of a user-buffer receive is a user address, which must not be touched in the kernel.
+#[inline]
+pub fn is_kernel_va(va: u64) -> bool {
+    (va as i64) < 0
+}
@@ -1,11 +1,14 @@
 use alloc::borrow::ToOwned;
 use alloc::boxed::Box;
+use alloc::collections::VecDeque;
 use alloc::string::{String, ToString};
 use alloc::sync::Arc;
 use alloc::vec;
+use alloc::vec::Vec;
 use core::cmp::min;
 use core::pin::Pin;
 use core::ptr::null_mut;
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
 use nostd_async::{Runtime, Task};
 
 use KRdmaKit::cm::{EndPoint, SidrCM};
@@ -16,7 +19,7 @@ use KRdmaKit::ib_path_explorer::IBExplorer;
 use KRdmaKit::mem::{pa_to_va, RMemPhy, TempMR};
 use KRdmaKit::net_util::{gid_eq, gid_to_str, str_to_gid};
 use KRdmaKit::Profile;
-use KRdmaKit::qp::{DC, DCOp, DCTargetMeta, RC, RCOp, UD, UDOp};
+use KRdmaKit::qp::{DC, DCOp, DCTargetMeta, RC, RCOp, UD};
 use KRdmaKit::rust_kernel_rdma_base::*;
 use KRdmaKit::rust_kernel_rdma_base::linux_kernel_module::bindings::GFP_KERNEL;
 use linux_kernel_module::{bindings, KernelResult, println};
@@ -27,8 +30,24 @@ use linux_kernel_module::c_types::c_void;
 use crate::bindings::*;
 use crate::client::*;
 use crate::core::*;
-use crate::op_code_table;
+use crate::{op_code_table, send_flag_table, is_signaled};
 use crate::rpc::caller::{call_query_dc_meta, call_reg_dc_meta};
+use crate::user_mr::{local_addr, post_user_recvs, UserMR};
+use crate::rndv::*;
+use crate::ud_batch::{UD_MAX_PAYLOAD, UDDoorbell};
+use crate::fair_share::{DEFAULT_WEIGHT, get_fair_share};
+use crate::reaper::{register_rc_holder, unregister_rc_holder, VQActivity};
+use crate::recovery::*;
+use crate::stats::{nic_stats, add_nic_stat, read_stages, VQStats};
+use crate::latency::{profile_enabled, PostTimer, StageClock};
+use crate::trace;
+use crate::srq_pool::get_srq_pool;
+use crate::consts::SRQ_UD_HINT;
+use crate::batch::{BatchTuner, MAX_CHUNK};
+use crate::comp_wait::{SpinWindow, StaleComps, wait_comp, wait_fresh_comp};
+use crate::cookie::{CookieTable, set_cookie};
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::timer::RTimer;
+use KRdmaKit::rust_kernel_rdma_base::rust_kernel_linux_util::kthread::yield_now;
 /// Virtual queue
 #[allow(dead_code)]
 pub struct VQ<'a> {
@@ -44,6 +63,53 @@ pub struct VQ<'a> {
     // for client side (assigned when connection)
     local_connect_port: Option<usize>,
     put_ud_info: bool,
+    // in-flight rendezvous sends (created at the first large message)
+    rndv_sender: Option<RndvSender>,
+    // staging buffer of the rendezvous payloads on the bind side outside the registered regions
+    rndv_recv_buf: Option<RMemPhy>,
+    // whether the last RC push posted any signaled eager request
+    rc_signaled: bool,
+    // rendezvous descriptors posted unsignaled since the last signaled request on the RC
+    rndv_unsignaled: usize,
+    // (weight, max bytes per sec) of this VQ on the shared DC/UD QP
+    share: (u32, u64),
+    // (port, vid, path) of the RC, kept to reconnect after the RC is reaped
+    rc_conn: Option<(usize, usize, sa_path_rec)>,
+    // whether the RC has been released by the reaper
+    rc_released: bool,
+    // whether any receive has been posted on the RC, which keeps it from the reaper
+    rc_recvs_posted: bool,
+    // boxed, since the reaper refers to it while the VQ may be moved before the first request
+    pub(crate) activity: Box<VQActivity>,
+    // requests in flight on the RC, replayed or failed if the RC breaks
+    inflight: InflightLog,
+    // completions of the requests failed by the RC recovery, reported before the others
+    failed_wcs: VecDeque<ib_wc>,
+    // completions polled by a flush ahead of its own, reported by the following pops
+    early_wcs: VecDeque<ib_wc>,
+    // wr_ids of the flush READs on the DC QP which timed out before completing
+    dc_flushes: Vec<u64>,
+    pub(crate) stats: Box<VQStats>,
+    // stage timestamps of the on-going push / pop, if profiled
+    prof: Option<StageClock>,
+    // the on-going ioctl cmd, for tracing
+    cur_cmd: u32,
+    // UD of the bound port on the NIC's shared SRQ pool (feature `shared_srq`)
+    srq_ud: Option<Arc<UD>>,
+    // landing area of the completions polled from the pool
+    srq_wcs: Vec<ib_wc>,
+    // chunk size of the push
+    batch: BatchTuner,
+    // requests of the current push chunk, allocated at the first push
+    push_buf: Vec<core_req_t>,
+    // UD sends of the current push, allocated at the first UD push
+    ud_doorbell: Option<Box<UDDoorbell>>,
+    // spin window of the completion waits
+    spin: SpinWindow,
+    // completions left in the CQs by the timed-out waits
+    stale: StaleComps,
+    // user cookies of the signaled requests outside the RC
+    cookies: CookieTable,
 }
 
 
@@ -58,10 +124,57 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
             put_ud_info: false,
             rc_connect_param: None,
             local_cache: Default::default(),
+            rndv_sender: None,
+            rndv_recv_buf: None,
+            rc_signaled: false,
+            rndv_unsignaled: 0,
+            share: (DEFAULT_WEIGHT, 0),
+            rc_conn: None,
+            rc_released: false,
+            rc_recvs_posted: false,
+            activity: Box::new(VQActivity::new()),
+            inflight: InflightLog::new(),
+            failed_wcs: VecDeque::new(),
+            early_wcs: VecDeque::new(),
+            dc_flushes: Vec::new(),
+            stats: VQStats::register(),
+            prof: None,
+            cur_cmd: lib_r_cmd::Nil,
+            srq_ud: None,
+            srq_wcs: Vec::new(),
+            batch: BatchTuner::new(),
+            push_buf: Vec::new(),
+            ud_doorbell: None,
+            spin: SpinWindow::new(),
+            stale: StaleComps::new(),
+            cookies: CookieTable::new(),
         })
     }
 
     fn ioctrl(&mut self, cmd: c_uint, arg: c_ulong) -> c_long {
+        if profile_enabled() &&
+            (cmd == lib_r_cmd::Push || cmd == lib_r_cmd::Pop || cmd == lib_r_cmd::PopMsgs) {
+            self.prof = Some(StageClock::new());
+        }
+        // the reaper must not release the RC under an on-going request
+        self.activity.enter();
+        let ret = self.ioctrl_impl(cmd, arg);
+        self.activity.leave(true);
+        if let Some(clock) = self.prof.take() {
+            clock.finish();
+        }
+        ret
+    }
+
+    fn mmap(&mut self, _vma: *mut bindings::vm_area_struct) -> c_int {
+        unimplemented!()
+    }
+}
+
+
+impl<'a> VQ<'a> {
+    fn ioctrl_impl(&mut self, cmd: c_uint, arg: c_ulong) -> c_long {
+        self.cur_cmd = cmd;
         let mut req: req_t = Default::default();
         unsafe {
             _copy_from_user(
@@ -97,28 +210,20 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                 // now get addr of GID format
                 let addr = core::str::from_utf8(&addr_buf).unwrap();
                 let service_id = conn.port % MAX_SERVICE_NUM as i32;
-                self.connect_impl(addr, service_id as usize, conn.vid as usize)
+                let ret = self.connect_impl(addr, service_id as usize, conn.vid as usize);
+                trace::connect(self.trace_id(), service_id as usize, conn.vid as usize, ret);
+                ret
             }
             lib_r_cmd::RegMRs => {
-                // let mut reg_mr_req: reg_mr_t =
-                //     unsafe { core::mem::MaybeUninit::uninit().assume_init() };
-                // unsafe {
-                //     // get mread_core_req
-                //     _copy_from_user(
-                //         (&mut reg_mr_req as *mut reg_mr_t).cast::<c_void>(),
-                //         (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
-                //         core::mem::size_of_val(&reg_mr_req) as u64,
-                //     );
-                // }
-                // let ctx = get_global_rcontext(0);
-                // let pd = ctx.get_pd();
-                // let address = reg_mr_req.address as u64;
-                // let size = reg_mr_req.size as u64;
-                // let hint = reg_mr_req.hint as usize;
-                // let pg_sz = unsafe { page_size() } as u64;
-                //
-
-                reply_status::ok
+                let mut reg_mr_req: reg_mr_t = Default::default();
+                unsafe {
+                    _copy_from_user(
+                        (&mut reg_mr_req as *mut reg_mr_t).cast::<c_void>(),
+                        (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
+                        core::mem::size_of_val(&reg_mr_req) as u64,
+                    );
+                }
+                self.reg_mr_impl(reg_mr_req.address, reg_mr_req.size as u64, reg_mr_req.hint)
             }
             lib_r_cmd::Push => {
                 let mut push_req: push_core_req_t =
@@ -142,28 +247,38 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                         core::mem::size_of_val(&push_ext) as u64,
                     );
                 }
+                self.prof_mark(stats_stage::StageCopyIn);
                 let pop_at_once: bool = if push_ext.pop_res == 0 { false } else { true };
                 let push_recv_cnt: u32 = push_ext.push_recv_cnt;
 
                 let mut ret = reply_status::ok;
 
+                if self.rc_released {
+                    self.reconnect_rc();
+                }
                 // push recv at first
                 if !self.is_bind_mode() && push_recv_cnt > 0 {
                     ret = self.push_recv_impl(push_recv_cnt as usize);
                 }
 
-                const DEFAULT_BATCH_SZ: usize = 64;
                 let req_len = push_req.req_len as usize;
                 // no need to handle
                 let mut send_offset: usize = 0;
-                let mut core_req_list: [core_req_t; DEFAULT_BATCH_SZ] =
-                    [unsafe { core::mem::MaybeUninit::uninit().assume_init() }; DEFAULT_BATCH_SZ];
-                let sizeof: usize = core::mem::size_of_val(&core_req_list[0]);  // sizeof each wqe
+                // taken out of the VQ during the push, since the push impls borrow the VQ
+                let mut core_req_list = core::mem::take(&mut self.push_buf);
+                if core_req_list.len() < MAX_CHUNK {
+                    core_req_list.resize(MAX_CHUNK, Default::default());
+                }
+                let sizeof: usize = core::mem::size_of::<core_req_t>();  // sizeof each wqe
+                // the shared QP the push is backlogged on, left once all the chunks are posted,
+                // so the DRR credit carries across the chunks
+                let mut fair_port = None;
                 // batch send
                 while send_offset < req_len {
-                    let send_len = min(DEFAULT_BATCH_SZ, req_len - send_offset);
+                    let send_len = min(self.batch.chunk(), req_len - send_offset);
+                    let chunk_timer = if self.batch.is_adaptive() { Some(RTimer::new()) } else { None };
 
-                    // get req from ptr. max length is 64
+                    // get req from ptr. max length is the chunk size
                     unsafe {
                         _copy_from_user(
                             (&mut core_req_list[0] as *mut core_req_t).cast::<c_void>(),
@@ -172,6 +287,21 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                             (send_len * sizeof) as u64,
                         );
                     };
+                    self.prof_mark(stats_stage::StageCopyIn);
+                    // the unconnected path shares the port's DC/UD QP with other VQs
+                    let shared_port = if !self.is_bind_mode() && self.virtual_queue.is_none() {
+                        self.local_connect_port
+                    } else {
+                        None
+                    };
+                    if let Some(port) = shared_port {
+                        ret = self.wait_fair_share(port, &core_req_list[0..send_len]);
+                        if ret != reply_status::ok {
+                            break;
+                        }
+                        fair_port = Some(port);
+                    }
+                    self.stat_reqs(&core_req_list[0..send_len]);
                     ret = match self.is_bind_mode() {
                         true => {
                             self.bind_server_push_impl(&core_req_list[0..send_len], pop_at_once)
@@ -180,13 +310,28 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                             if self.virtual_queue.is_some() {
                                 self.rc_push_impl(&core_req_list[0..send_len])
                             } else {
-                                self.dc_push_impl(&core_req_list[0..send_len]) // todo: replace with UD
-                                // self.ud_push_impl(&core_req_list[0..send_len])
+                                #[cfg(feature = "dct_qp")]
+                                    {
+                                        // two-sided messages go through the batched UD path
+                                        if fits_ud(&core_req_list[0..send_len]) {
+                                            self.ud_push_impl(&core_req_list[0..send_len])
+                                        } else {
+                                            self.dc_push_impl(&core_req_list[0..send_len])
+                                        }
+                                    }
+                                // the RC is down and could not be reconnected
+                                #[cfg(not(feature = "dct_qp"))]
+                                    reply_status::not_connected
                             }
                         }
                     };
+                    self.prof_build_post();
+                    if let Some(timer) = chunk_timer {
+                        let outstanding = if self.virtual_queue.is_some() { self.inflight.len() } else { 0 };
+                        self.batch.observe(send_len, timer.passed(), outstanding);
+                    }
                     send_offset += send_len;
-                    if reply_status::err == ret {
+                    if reply_status::err == ret || reply_status::not_connected == ret {
                         println!(
                             "cmd push err, send len = {}, offset = {}",
                             send_len, send_offset
@@ -194,20 +339,40 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                         break;
                     }
                 }
+                self.push_buf = core_req_list;
+                if let Some(port) = fair_port {
+                    get_fair_share(port).done(self.tenant_id());
+                }
 
                 if !self.is_bind_mode() && pop_at_once && ret == reply_status::ok { // pop res
                     let pop_res = if self.virtual_queue.is_none() {
                         // dc
-                        let qp = self.get_ud();
-                        let mut op = UDOp::new(qp);
-                        op.wait_til_comp()
+                        let cq = self.get_ud().get_cq();
+                        self.wait_signaled(cq).map(|wc| {
+                            self.cookies.attach(cq, wc);
+                        })
+                    } else if !self.rc_signaled {
+                        // only rendezvous sends, which complete upon the receiver's ack
+                        Ok(())
                     } else {
-                        let mut op = RCOp::new(self.virtual_queue.as_ref().unwrap());
-                        op.wait_til_comp()
+                        let cq = self.virtual_queue.as_ref().unwrap().get_cq();
+                        loop {
+                            match self.wait_signaled(cq) {
+                                Ok(wc) if wc.status != IB_WC_SUCCESS => break self.recover_and_wait(wc.status),
+                                // skip the completions of the signaled rendezvous descriptors
+                                Ok(_) => if self.inflight.retire_one().is_some() {
+                                    break Ok(());
+                                },
+                                Err(status) => break Err(status),
+                            }
+                        }
                     };
-                    if pop_res.is_none() {
-                        ret = reply_status::err;
+                    match pop_res {
+                        Err(status) => ret = status,
+                        Ok(()) if !self.wait_rndv_acks() => ret = reply_status::timeout,
+                        Ok(()) => {}
                     }
+                    self.prof_mark(stats_stage::StageComp);
                 }
                 ret
             }
@@ -223,7 +388,11 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                         core::mem::size_of_val(&push_req) as u64,
                     );
                 }
-                self.push_recv_impl(push_req.push_count as usize)
+                if push_req.bufs.is_null() {
+                    self.push_recv_impl(push_req.push_count as usize)
+                } else {
+                    self.push_user_recv_impl(push_req.bufs, push_req.push_count as usize)
+                }
             }
             lib_r_cmd::Pop => {
                 let mut vid: u32 = 0;
@@ -234,27 +403,23 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                         core::mem::size_of_val(&vid) as u64,
                     );
                 }
-                self.pop_impl(&mut req, vid as usize)
+                self.prof_mark(stats_stage::StageCopyIn);
+                let ret = self.pop_impl(&mut req, vid as usize);
+                trace::pop(self.trace_id(), cmd, ret, (ret == reply_status::ok) as usize);
+                ret
             }
             lib_r_cmd::PopMsgs => {
-                let mut least_pop_cnt = 0 as u32;
-                let mut payload_sz = 0 as u32;
+                let mut pop_msgs: pop_msgs_t = Default::default();
                 unsafe {
                     _copy_from_user(
-                        (&mut least_pop_cnt as *mut u32).cast::<c_void>(),
-                        (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
-                        core::mem::size_of_val(&least_pop_cnt) as u64,
-                    );
-
-                    _copy_from_user(
-                        (&mut payload_sz as *mut u32).cast::<c_void>(),
-                        (arg +
-                            core::mem::size_of_val(&req) as u64 +
-                            core::mem::size_of_val(&least_pop_cnt) as u64) as *mut c_void,
-                        core::mem::size_of_val(&payload_sz) as u64,
+                        (&mut pop_msgs as *mut pop_msgs_t).cast::<c_void>(),
+                        arg as *mut c_void,
+                        core::mem::size_of_val(&pop_msgs) as u64,
                     );
                 }
-                self.pop_msg_impl(&mut req, least_pop_cnt, payload_sz)
+                self.prof_mark(stats_stage::StageCopyIn);
+                self.pop_msg_impl(&mut req, pop_msgs.pop_count, pop_msgs.payload_sz,
+                                  pop_msgs.payload_buf as u64)
             }
             lib_r_cmd::Binds => {
                 let mut bind: bind_t = Default::default();
@@ -266,14 +431,22 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                     )
                 };
                 let port = bind.port as usize;
-                if self.bind_port.is_some() {
+                let ret = if self.bind_port.is_some() {
                     reply_status::already_bind
                 } else if port > MAX_SERVICE_NUM {
                     reply_status::nil
                 } else {
                     self.bind_port = Some(port);
-                    reply_status::ok
-                }
+                    self.stats.port.store(port * 2, Ordering::Relaxed);
+                    #[cfg(feature = "shared_srq")]
+                        {
+                            self.attach_srq_ud(port)
+                        }
+                    #[cfg(not(feature = "shared_srq"))]
+                        reply_status::ok
+                };
+                trace::bind(self.trace_id(), port, true, ret);
+                ret
             }
             lib_r_cmd::UnBinds => {
                 let mut bind: bind_t = Default::default();
@@ -291,11 +464,53 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                 } else {
                     // clean up the message buffer
                     pop_recv(self.bind_port.unwrap() * 2, 2048, 0);
+                    self.detach_srq_ud();
                     self.bind_port = None;
+                    // destroy the address handles of the clients
+                    self.local_cache.cached_client_endpoint.clear();
                     reply_status::ok
                 };
+                trace::bind(self.trace_id(), port, false, ret);
                 ret
             }
+            lib_r_cmd::SetShare => {
+                let mut share: share_t = Default::default();
+                unsafe {
+                    _copy_from_user(
+                        (&mut share as *mut share_t).cast::<c_void>(),
+                        (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
+                        core::mem::size_of_val(&share) as u64,
+                    )
+                };
+                self.share = (share.weight, share.max_bytes_per_sec);
+                if let Some(port) = self.local_connect_port {
+                    get_fair_share(port).set_share(self.tenant_id(), share.weight, share.max_bytes_per_sec);
+                }
+                reply_status::ok
+            }
+            lib_r_cmd::SetBatch => {
+                let mut batch: batch_t = Default::default();
+                unsafe {
+                    _copy_from_user(
+                        (&mut batch as *mut batch_t).cast::<c_void>(),
+                        (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
+                        core::mem::size_of_val(&batch) as u64,
+                    )
+                };
+                self.batch.set(batch.chunk)
+            }
+            lib_r_cmd::QueryStats => {
+                let mut query: query_stats_t = Default::default();
+                unsafe {
+                    _copy_from_user(
+                        (&mut query as *mut query_stats_t).cast::<c_void>(),
+                        (arg + core::mem::size_of_val(&req) as u64) as *mut c_void,
+                        core::mem::size_of_val(&query) as u64,
+                    )
+                };
+                self.query_stats_impl(&mut req, &query)
+            }
+            lib_r_cmd::Flush => self.flush_impl(),
             lib_r_cmd::RpcPoll => {
                 #[cfg(not(feature = "rpc_server"))]
                     {
@@ -314,21 +529,23 @@ impl<'a> linux_kernel_module::file_operations::FileOperations for VQ<'a> {
                 reply_status::err
             }
         };
+        if status == reply_status::err || status == reply_status::timeout {
+            self.stat(stats_counter::StatErrors, 1);
+            trace::error(self.trace_id(), cmd, status, IB_WC_SUCCESS);
+        }
         let mut reply: reply_t = Default::default();
         reply.status = status as i32;
 
         // copy the reply and return to user
-        unsafe {
+        let res = unsafe {
             _copy_to_user(
                 req.reply_buf,
                 (&reply as *const reply_t).cast::<c_void>(),
                 core::mem::size_of_val(&reply) as u64,
             ) as c_long
-        }
-    }
-
-    fn mmap(&mut self, _vma: *mut bindings::vm_area_struct) -> c_int {
-        unimplemented!()
+        };
+        self.prof_mark(stats_stage::StageCopyOut);
+        res
     }
 }
 
@@ -357,6 +574,10 @@ impl<'a> VQ<'a> {
             )
         );
         self.local_connect_port = Some(port);
+        self.stats.port.store(port, Ordering::Relaxed);
+        if self.share != (DEFAULT_WEIGHT, 0) {
+            get_fair_share(port).set_share(self.tenant_id(), self.share.0, self.share.1);
+        }
         // first check local_dc
         if self.local_dc.is_none() {
             let ctrl = get_global_rctrl(port as usize);
@@ -378,24 +599,15 @@ impl<'a> VQ<'a> {
                     None => {
                         // background connection thread for DCQP => RCQP migration
                         #[cfg(feature = "migrate_qp")]
-                            unsafe {
+                            {
                             let path_res = self.explore_path(port, &String::from(addr));
                             if path_res.is_err() {
                                 return reply_status::err;
                             }
                             let path_res = path_res.unwrap();
-                            self.rc_connect_param = Option::from(RCConnectParam {
-                                vid,
-                                port,
-                                path: path_res,
-                                vq: self as *mut VQ,
-                            });
-                            rust_kernel_linux_util::bindings::bd_kthread_run(
-                                Some(bg_rc_migrate_thread),
-                                (self.rc_connect_param.as_mut().unwrap() as *mut RCConnectParam).cast::<c_void>(),
-                                b"bg thread\0".as_ptr() as *const i8,
-                            )
-                        };
+                            self.rc_conn = Some((port, vid, path_res));
+                            self.spawn_rc_migrate(port, vid, path_res);
+                        }
 
                         let ctx = ctrl.get_context();
                         let mut point: Option<EndPoint> = None;
@@ -413,9 +625,13 @@ impl<'a> VQ<'a> {
                             let path_res = path_res.unwrap();
                             let mut sidr_cm =
                                 SidrCM::new(ctx, core::ptr::null_mut()).unwrap();
+                            #[cfg(feature = "shared_srq")]
+                                let hint = SRQ_UD_HINT;
+                            #[cfg(not(feature = "shared_srq"))]
+                                let hint = DEFAULT_RPC_HINT;
                             let remote_info = sidr_cm.sidr_connect(
                                 path_res, port as u64,
-                                DEFAULT_RPC_HINT as u64);
+                                hint as u64);
                             if remote_info.is_err() {
                                 return reply_status::err;
                             }
@@ -452,11 +668,15 @@ impl<'a> VQ<'a> {
                     return reply_status::err;
                 }
                 let path_res = path_res.unwrap();
+                self.rc_conn = Some((port, vid, path_res));
                 return match qp_connect(vid, port, &path_res) {
                     Ok(qp) => {
                         #[cfg(feature = "virtual_queue")]
                             {
                                 self.virtual_queue = qp;
+                                if self.virtual_queue.is_some() {
+                                    register_rc_holder(self as *mut VQ, &self.activity);
+                                }
                             }
                         reply_status::ok
                     }
@@ -469,7 +689,7 @@ impl<'a> VQ<'a> {
 /// Push recv and pop msg implementation
 impl<'a> VQ<'a> {
     #[inline]
-    fn push_recv_impl(&self, push_cnt: usize) -> u32 {
+    fn push_recv_impl(&mut self, push_cnt: usize) -> u32 {
         return if self.is_bind_mode() {
             // Bind mode
             if !self.check_bind(1) { // use backup UD
@@ -485,6 +705,7 @@ impl<'a> VQ<'a> {
             } else {
                 let ctrl = get_global_rctrl(self.local_connect_port.unwrap());
                 let qp = if self.is_rc_connected() {
+                    self.rc_recvs_posted = true;
                     self.virtual_queue.as_ref().unwrap().get_qp()
                 } else {
                     self.get_ud().get_qp()
@@ -501,16 +722,67 @@ impl<'a> VQ<'a> {
         };
     }
 
+    /// Post receives with the user supplied buffers.
+    /// The buffers are copied in chunks to bound the kernel stack usage.
+    /// They are only posted on the RC of this VQ: the QPs of the bind ctrl and the UD are shared
+    /// by the other VQs, which may outlive the pinned pages. Destroying the RC flushes the receives.
+    fn push_user_recv_impl(&mut self, bufs: *mut recv_buf_t, push_cnt: usize) -> u32 {
+        if self.is_bind_mode() || !self.is_rc_connected() {
+            return reply_status::not_connected;
+        }
+        let qp = self.virtual_queue.as_ref().unwrap().get_qp();
+        // the region is pinned (and translated) for the NIC of the serving port
+        let ctrl = get_global_rctrl(self.local_connect_port.unwrap());
+        let lkey = unsafe { ctrl.get_context().get_lkey() };
+
+        const DEFAULT_BATCH_SZ: usize = 64;
+        let mut buf_list: [recv_buf_t; DEFAULT_BATCH_SZ] = [Default::default(); DEFAULT_BATCH_SZ];
+        let sizeof = core::mem::size_of::<recv_buf_t>();
+        let mut offset = 0;
+        while offset < push_cnt {
+            let cnt = min(DEFAULT_BATCH_SZ, push_cnt - offset);
+            unsafe {
+                _copy_from_user(
+                    (&mut buf_list[0] as *mut recv_buf_t).cast::<c_void>(),
+                    (bufs as u64 + (offset * sizeof) as u64) as *mut c_void,
+                    (cnt * sizeof) as u64,
+                );
+            }
+            // all buffers in one call must come from the same region
+            let mr = match self.local_cache.user_mrs.get_mut(&buf_list[0].hint) {
+                Some(mr) => mr,
+                None => return reply_status::addr_error,
+            };
+            if buf_list[..cnt].iter().any(|b| b.hint != buf_list[0].hint) {
+                return reply_status::addr_error;
+            }
+            mr.recv_posted = true;
+            self.rc_recvs_posted = true;
+            let ret = post_user_recvs(qp, lkey, mr, &buf_list[..cnt]);
+            if ret != reply_status::ok {
+                return ret;
+            }
+            offset += cnt;
+        }
+        reply_status::ok
+    }
+
     #[inline]
-    fn pop_msg_impl(&self, req: &mut req_t, least_pop_cnt: u32, payload_sz: u32) -> u32 {
+    fn pop_msg_impl(&mut self, req: &mut req_t, least_pop_cnt: u32, payload_sz: u32,
+                    payload_buf: u64) -> u32 {
         let mut ret = reply_status::ok;
         let mut retry = 0;
         let mut act_pop_cnt = 0 as usize;
+        let mut popped = 0 as usize;
         // self.timer.reset();
         loop {
             let (pop_ret, pop_cnt) = {
                 if self.is_bind_mode() {
-                    pop_recv(2 * self.bind_port.unwrap(), 2048, 0)
+                    if self.srq_ud.is_some() {
+                        self.pop_srq_recv()
+                    } else {
+                        pop_recv(2 * self.bind_port.unwrap(), 2048, 0)
+                    }
                 } else {
                     if self.local_connect_port.is_none() {
                         (None, 0)
@@ -520,24 +792,62 @@ impl<'a> VQ<'a> {
                 }
             };
             if self.is_bind_mode() { // break when binding mode
-                ret = handle_pop_ret(pop_ret, req, pop_cnt as usize, payload_sz);
+                if pop_cnt > 0 {
+                    let ctrl = self.get_bind_ctrl_unsafe();
+                    let lkey = unsafe { ctrl.get_context().get_lkey() };
+                    let buf = self.rndv_recv_buf.get_or_insert_with(|| RMemPhy::new(MAX_KMALLOC_SZ));
+                    let cookies = &mut self.cookies;
+                    let early_wcs = &mut self.early_wcs;
+                    // the sends of the timed-out bind pushes complete on the same CQs
+                    let mut on_stale = |cq: *mut ib_cq, wc: ib_wc, reported: bool| if reported {
+                        early_wcs.push_back(cookies.attach(cq, wc));
+                    };
+                    ret = serve_rndv_recvs(ctrl, pop_ret.unwrap(), pop_cnt,
+                                           &self.local_cache.user_mrs, buf, MAX_KMALLOC_SZ,
+                                           lkey, &mut self.spin, &mut self.stale, &mut on_stale,
+                                           payload_sz, payload_buf);
+                    if ret != reply_status::ok {
+                        break;
+                    }
+                }
+                self.prof_mark(stats_stage::StageComp);
+                ret = handle_pop_ret(pop_ret, req, pop_cnt as usize, payload_sz, payload_buf);
+                popped = pop_cnt as usize;
                 break;
             } else {
                 act_pop_cnt += pop_cnt;
                 if act_pop_cnt >= least_pop_cnt as usize || retry > 50000 {
-                    ret = handle_pop_ret(pop_ret, req, act_pop_cnt as usize, payload_sz);
+                    self.prof_mark(stats_stage::StageComp);
+                    ret = handle_pop_ret(pop_ret, req, act_pop_cnt as usize, payload_sz, payload_buf);
+                    popped = act_pop_cnt;
                     break;
                 }
             }
             retry += 1;
         }
+        if ret == reply_status::nil {
+            self.stat(stats_counter::StatPopEmpty, 1);
+        }
+        trace::pop(self.trace_id(), lib_r_cmd::PopMsgs, ret, popped);
         return ret;
     }
 
 
     #[inline]
-    fn pop_impl(&self, req: &mut req_t, vid: usize) -> u32 {
-        let pop_ret = if self.is_bind_mode() {
+    fn pop_impl(&mut self, req: &mut req_t, vid: usize) -> u32 {
+        // requests failed by the RC recovery are reported first
+        if let Some(mut wc) = self.failed_wcs.pop_front() {
+            return handle_pop_ret(Some(&mut wc as *mut ib_wc), req, 1, 0, 0);
+        }
+        if let Some(mut wc) = self.early_wcs.pop_front() {
+            return handle_pop_ret(Some(&mut wc as *mut ib_wc), req, 1, 0, 0);
+        }
+        // acked rendezvous sends are reported before the other completions
+        if let Some((wr_id, status)) = self.rndv_sender.as_mut().and_then(|s| s.pop_acked()) {
+            let mut wc = rndv_send_wc(wr_id, status);
+            return handle_pop_ret(Some(&mut wc as *mut ib_wc), req, 1, 0, 0);
+        }
+        let mut pop_ret = if self.is_bind_mode() {
             // todo: handle DC=>RC migration case
             if !self.check_bind(vid as usize) {
                 None
@@ -545,18 +855,20 @@ impl<'a> VQ<'a> {
                 let ctrl = self.get_bind_ctrl_unsafe();
                 let rc = ctrl.get_trc(vid as usize).unwrap();
                 let mut op = RCOp::new(rc);
-                op.pop()
+                op.pop().and_then(|wc| self.popped_wc(rc.get_cq(), unsafe { *wc }))
             }
         } else {
             #[cfg(feature = "dct_qp")]
                 {
-                    let mut op = DCOp::new(self.get_dc());
+                    let dc = self.local_dc.unwrap();
+                    let mut op = DCOp::new(dc);
                     let res = op.pop();
-                    if res.is_some() {
-                        res
+                    if let Some(wc) = res {
+                        self.popped_wc(dc.get_cq(), unsafe { *wc })
                     } else if self.is_rc_connected() {
                         let mut op = RCOp::new(self.virtual_queue.as_ref().unwrap());
-                        op.pop()
+                        let wc = op.pop();
+                        self.check_rc_wc(wc)
                     } else {
                         None
                     }
@@ -564,12 +876,20 @@ impl<'a> VQ<'a> {
             #[cfg(not(feature = "dct_qp"))]
             if self.is_rc_connected() {
                 let mut op = RCOp::new(self.virtual_queue.as_ref().unwrap());
-                op.pop()
+                let wc = op.pop();
+                self.check_rc_wc(wc)
             } else {
                 None
             }
         };
-        handle_pop_ret(pop_ret, req, 1, 0)
+        if pop_ret.is_none() {
+            if let Some(mut wc) = self.failed_wcs.pop_front() {
+                return handle_pop_ret(Some(&mut wc as *mut ib_wc), req, 1, 0, 0);
+            }
+            self.stat(stats_counter::StatPopEmpty, 1);
+        }
+        self.prof_mark(stats_stage::StageComp);
+        handle_pop_ret(pop_ret.as_mut().map(|wc| wc as *mut ib_wc), req, 1, 0, 0)
     }
 }
 
@@ -582,6 +902,13 @@ impl<'a> VQ<'a> {
             println!("vq not exist");
             return reply_status::nil;
         }
+        self.stat(stats_counter::StatPathRC, req_list.len() as u64);
+        trace::push(self.trace_id(), req_list, krc_trace_path::TracePathRC);
+        self.reap_rndv_descs();
+        if self.virtual_queue.is_none() {
+            // broken while reaping, the failed requests are reported by the pops
+            return self.fallback_push_impl(req_list);
+        }
         let qp = self.virtual_queue.as_ref().unwrap();
         let local_mr = self.local_cache.local_mr.as_ref().unwrap();
         let remote_mr = qp.get_remote_mr();
@@ -590,19 +917,65 @@ impl<'a> VQ<'a> {
         let lkey = local_mr.get_rkey();
         let rkey = remote_mr.get_rkey() as u32;
         let mut op = RCOp::new(qp);
+        let mut post_timer = PostTimer::new(self.prof.is_some());
 
         let mut res: u32 = reply_status::ok;
+        let mut failed_at = None;
+        self.rc_signaled = false;
         for idx in 0..req_list.len() {
             let req = req_list[idx];
 
             // For all of the params
 
-            let mut laddr = local_pa + (req.addr as u64);
+            let mut laddr = match local_addr(&self.local_cache.user_mrs, &req, local_pa) {
+                Some(laddr) => laddr,
+                None => {
+                    res = reply_status::addr_error;
+                    break;
+                }
+            };
             let raddr = req.remote_addr as u64 + remote_mr.get_addr();
             let length: usize = req.length as usize;
             let vid = req.vid as u32;
             let op_code: u32 = op_code_table(req.type_);
 
+            // large message: only send the descriptor, the receiver reads the payload
+            if length >= RNDV_THRESHOLD &&
+                (op_code == ib_wr_opcode::IB_WR_SEND || op_code == ib_wr_opcode::IB_WR_SEND_WITH_IMM) {
+                let local_rkey = unsafe {
+                    get_global_rctrl(self.local_connect_port.unwrap()).get_context().get_rkey()
+                };
+                let sender = self.rndv_sender.get_or_insert_with(RndvSender::new);
+                let desc_pa = match sender.prepare(laddr, length, local_rkey, req.cookie) {
+                    Some(pa) => pa,
+                    None => {
+                        println!("too many in-flight rendezvous messages");
+                        res = reply_status::err;
+                        break;
+                    }
+                };
+                // signal every Nth descriptor, so that the send queue is reclaimed
+                // even if only rendezvous sends are posted
+                let signal = self.rndv_unsignaled + 1 >= RNDV_SIGNAL_EVERY;
+                let desc_flags = if signal { ib_send_flags::IB_SEND_SIGNALED } else { 0 };
+                if post_timer.time(|| op.push_with_imm(
+                    ib_wr_opcode::IB_WR_SEND_WITH_IMM, desc_pa, lkey,
+                    core::mem::size_of::<RndvDesc>(),
+                    0, 0, vid | RNDV_IMM_FLAG, desc_flags,
+                )).is_err() {
+                    // the descriptor is failed together with the other rendezvous sends
+                    failed_at = Some(idx + 1);
+                    break;
+                }
+                if signal {
+                    self.inflight.record_internal();
+                    self.rndv_unsignaled = 0;
+                } else {
+                    self.rndv_unsignaled += 1;
+                }
+                continue;
+            }
+
             // inline check
             let mut send_flag: i32 = if length < 64 {
                 // pa to va while inline sending
@@ -621,21 +994,30 @@ impl<'a> VQ<'a> {
             } else {
                 0
             };
-            send_flag |= match req.send_flags {
-                0 => send_flag | 0,
-                _ => send_flag | ib_send_flags::IB_SEND_SIGNALED,
-            };
-
+            send_flag |= send_flag_table(req.send_flags);
+            self.rc_signaled |= is_signaled(&req);
 
-            if op.push_with_imm(
+            if post_timer.time(|| op.push_with_imm(
                 op_code, laddr, lkey, length,
                 raddr, rkey, vid, send_flag,
-            ).is_err() {
-                res = reply_status::err;
+            )).is_err() {
+                failed_at = Some(idx);
                 break;
             }
+            self.inflight.record(&req);
+            if is_signaled(&req) {
+                self.rndv_unsignaled = 0;
+            }
         }
+        self.prof_add_post(post_timer.cycles);
 
+        // the RC is broken: recover, then post the rest on the fallback QP
+        if let Some(idx) = failed_at {
+            res = self.recover_rc(IB_WC_WR_FLUSH_ERR);
+            if idx < req_list.len() && res == reply_status::ok {
+                res = self.fallback_push_impl(&req_list[idx..]);
+            }
+        }
         return res;
     }
 
@@ -649,7 +1031,12 @@ impl<'a> VQ<'a> {
             println!("dc not connected");
             return reply_status::nil;
         }
-        let dc = self.get_dc();
+        self.stat(stats_counter::StatPathDC, req_list.len() as u64);
+        trace::push(self.trace_id(), req_list, krc_trace_path::TracePathDC);
+        let dc = self.local_dc.unwrap();
+        // the DC QP is shared by the VQs of the port, so its completions are not in the post
+        // order of this VQ: the cookies travel in the wr_id
+        self.cookies.carry_in_wr_id(dc.get_qp());
         let point = self.local_cache.remote_endpoint.as_ref().unwrap();
         let local_pa = local_mr.get_addr();
         // For all of the params
@@ -657,14 +1044,20 @@ impl<'a> VQ<'a> {
         let lkey = s_lkey;
         let rkey = remote_mr.get_rkey() as u32;
 
-        let mut op = DCOp::new(dc);
+        let mut post_timer = PostTimer::new(self.prof.is_some());
 
         let mut res: u32 = reply_status::ok;
         for idx in 0..req_list.len() {
             let req = req_list[idx];
 
             // For all of the params
-            let mut laddr = local_pa + (req.addr as u64);
+            let mut laddr = match local_addr(&self.local_cache.user_mrs, &req, local_pa) {
+                Some(laddr) => laddr,
+                None => {
+                    res = reply_status::addr_error;
+                    break;
+                }
+            };
             let raddr = req.remote_addr as u64 + remote_mr.get_addr();
 
             // let vid = req.vid as u32;
@@ -689,19 +1082,17 @@ impl<'a> VQ<'a> {
             } else {
                 0
             };
-            send_flag |= match req.send_flags {
-                0 => send_flag | 0,
-                _ => send_flag | ib_send_flags::IB_SEND_SIGNALED,
-            };
+            send_flag |= send_flag_table(req.send_flags);
 
 
-            if op.push(op_code, laddr,
-                       lkey, length, raddr, rkey,
-                       point, send_flag).is_err() {
+            if post_timer.time(|| post_dc(dc, op_code, laddr,
+                                          lkey, length, raddr, rkey,
+                                          point, send_flag, req.cookie)).is_err() {
                 res = reply_status::err;
                 break;
             }
         }
+        self.prof_add_post(post_timer.cycles);
 
         return res;
     }
@@ -709,17 +1100,20 @@ impl<'a> VQ<'a> {
     #[cfg(feature = "dct_qp")]
     #[inline]
     fn ud_push_impl(&mut self, req_list: &[core_req_t]) -> u32 {
-        let local_mr = self.local_cache.local_mr.as_ref().unwrap();
-        let s_lkey = local_mr.get_rkey();
         if self.local_ud.is_none() || self.local_connect_port.is_none() {
             // should not be here!
             println!("ud not connected");
             return reply_status::nil;
         }
+        let mut doorbell = self.take_ud_doorbell();
+        let local_mr = self.local_cache.local_mr.as_ref().unwrap();
+        let s_lkey = local_mr.get_rkey();
+        self.stat(stats_counter::StatPathUD, req_list.len() as u64);
+        trace::push(self.trace_id(), req_list, krc_trace_path::TracePathUD);
         let point = self.local_cache.remote_endpoint.as_ref().unwrap();
         let local_pa = local_mr.get_addr();
-        let mut laddr = local_pa;
-        let va = unsafe { pa_to_va(laddr as *mut i8) };
+        // the head of the kernel buffer keeps this UD's endpoint, by which the bind side replies
+        let va = unsafe { pa_to_va(local_pa as *mut i8) };
 
         let node: *mut EndPoint = va as *mut EndPoint;
         if !self.put_ud_info {
@@ -737,50 +1131,42 @@ impl<'a> VQ<'a> {
             unsafe { *node = point };
             self.put_ud_info = true;
         }
-        let ud = self.get_ud();
+        let ud = self.local_ud.unwrap();
+        self.cookies.carry_in_wr_id(ud.get_qp());
+        // every message leads with the endpoint, parsed by the bind side after the GRH
+        let header = Some((local_pa, core::mem::size_of::<EndPoint>()));
         // For all of the params
         let lkey = s_lkey;
-        let mut op = UDOp::new(ud);
+        let mut post_timer = PostTimer::new(self.prof.is_some());
 
         let mut res: u32 = reply_status::ok;
         for idx in 0..req_list.len() {
             let req = req_list[idx];
 
-            // For all of the params
-
+            let laddr = match local_addr(&self.local_cache.user_mrs, &req, local_pa) {
+                Some(laddr) => laddr,
+                None => {
+                    res = reply_status::addr_error;
+                    break;
+                }
+            };
             let length: usize = req.length as usize;
             let op_code: u32 = op_code_table(req.type_);
             let vid = req.vid;
+            // fences only order the READs / atomics, which UD has none of
+            let send_flag: i32 = send_flag_table(req.send_flags & req_flags::req_signaled);
 
-            // inline check
-            let mut send_flag: i32 = if length < 64 {
-                // pa to va while inline sending
-                match op_code {
-                    ib_wr_opcode::IB_WR_RDMA_READ => 0,
-                    ib_wr_opcode::IB_WR_RDMA_WRITE => {
-                        laddr = va as u64;
-                        ib_send_flags::IB_SEND_INLINE
-                    }
-                    ib_wr_opcode::IB_WR_RDMA_WRITE_WITH_IMM => {
-                        laddr = va as u64;
-                        ib_send_flags::IB_SEND_INLINE
-                    }
-                    _ => 0
-                }
-            } else {
-                0
-            };
-            send_flag |= match req.send_flags {
-                0 => send_flag | 0,
-                _ => send_flag | ib_send_flags::IB_SEND_SIGNALED,
-            };
-
-            if op.push(op_code, laddr, lkey,
-                       point, length, vid, send_flag).is_err() {
+            if doorbell.push_with_header(ud, op_code, header, laddr, lkey,
+                                         point, length, vid, send_flag, req.cookie).is_err() {
                 res = reply_status::err;
                 break;
             }
         }
+        if res == reply_status::ok && post_timer.time(|| doorbell.flush(ud)).is_err() {
+            res = reply_status::err;
+        }
+        self.ud_doorbell = Some(doorbell);
+        self.prof_add_post(post_timer.cycles);
 
         return res;
     }
@@ -788,6 +1174,8 @@ impl<'a> VQ<'a> {
 
     #[inline]
     fn bind_server_push_impl(&mut self, req_list: &[core_req_t], pop_at_once: bool) -> u32 {
+        trace::push(self.trace_id(), req_list, krc_trace_path::TracePathBind);
+        let mut ud_doorbell = self.take_ud_doorbell();
         let mut res: u32 = reply_status::ok;
         let ctrl = self.get_bind_ctrl_unsafe();
         let local_mr = self.local_cache.local_mr.as_ref().unwrap();
@@ -798,6 +1186,14 @@ impl<'a> VQ<'a> {
         const HOST_LEN: usize = 12;
         let mut rc_pop_cnt_cache: [u32; HOST_LEN] = [0; HOST_LEN];
         let mut ud_pop_cnt_cache: [u32; HOST_LEN] = [0; HOST_LEN];
+        // the pool refills the receives of its UD by itself
+        let on_srq = self.srq_ud.is_some();
+        let ud = match self.srq_ud.as_ref() {
+            Some(ud) => ud.clone(),
+            None => ctrl.get_ud(DEFAULT_RPC_HINT).unwrap().clone(),
+        };
+        self.cookies.carry_in_wr_id(ud.get_qp());
+        let mut post_timer = PostTimer::new(self.prof.is_some());
 
         for idx in 0..req_list.len() {
             let req = req_list[idx];
@@ -819,9 +1215,7 @@ impl<'a> VQ<'a> {
                         self.get_client_endpoint_cache(&vid).unwrap()
                     }
                 };
-                // Single UD push. TODO: migrate to DC in the future
-                let qp = ctrl.get_ud(DEFAULT_RPC_HINT).unwrap();
-                let mut op = UDOp::new(qp.as_ref());
+                // batched UD push, posted with one doorbell below. TODO: migrate to DC in the future
                 let send_flag: i32 = if ud_pop_cnt_cache[vid] == 0 {
                     ib_send_flags::IB_SEND_SIGNALED
                 } else {
@@ -831,8 +1225,8 @@ impl<'a> VQ<'a> {
 
                 let op_code: u32 = op_code_table(req.type_);
 
-                if op.push(op_code, laddr, lkey, endpoint,
-                           0, 0, send_flag).is_err() {
+                if ud_doorbell.push(ud.as_ref(), op_code, laddr, lkey, endpoint,
+                                    0, 0, send_flag, req.cookie).is_err() {
                     res = reply_status::err;
                     break;
                 }
@@ -843,46 +1237,69 @@ impl<'a> VQ<'a> {
                 let mut op = RCOp::new(qp);
 
                 // For all of the params
-                let laddr = local_pa + (req.addr as u64);
+                let laddr = match local_addr(&self.local_cache.user_mrs, &req, local_pa) {
+                    Some(laddr) => laddr,
+                    None => {
+                        res = reply_status::addr_error;
+                        break;
+                    }
+                };
                 let raddr = req.remote_addr as u64 + local_pa;
                 let length: usize = req.length as usize;
                 let op_code: u32 = op_code_table(req.type_);
-                let send_flag: i32 = if rc_pop_cnt_cache[vid] == 0 {
-                    ib_send_flags::IB_SEND_SIGNALED
-                } else {
-                    0
-                };
+                let mut send_flag: i32 = send_flag_table(req.send_flags & req_flags::req_fence);
+                if rc_pop_cnt_cache[vid] == 0 {
+                    send_flag |= ib_send_flags::IB_SEND_SIGNALED;
+                }
                 rc_pop_cnt_cache[vid] += 1;
 
-                if op.push_with_imm(op_code, laddr, lkey, length,
-                                    raddr, rkey, vid as u32, send_flag,
-                ).is_err() {
+                if post_timer.time(|| op.push_with_imm(op_code, laddr, lkey, length,
+                                                       raddr, rkey, vid as u32, send_flag,
+                )).is_err() {
                     res = reply_status::err;
                     break;
                 }
+                if send_flag & ib_send_flags::IB_SEND_SIGNALED != 0 {
+                    self.cookies.record(qp.get_cq(), req.cookie);
+                }
             }
         }
 
+        if res == reply_status::ok && post_timer.time(|| ud_doorbell.flush(ud.as_ref())).is_err() {
+            res = reply_status::err;
+        }
+        self.ud_doorbell = Some(ud_doorbell);
+        self.prof_add_post(post_timer.cycles);
+        self.stat(stats_counter::StatPathUD, ud_pop_cnt_cache.iter().sum::<u32>() as u64);
+        self.stat(stats_counter::StatPathRC, rc_pop_cnt_cache.iter().sum::<u32>() as u64);
+
         if res == reply_status::ok {
-            for vid in 1..HOST_LEN {
-                if ud_pop_cnt_cache[vid] > 0 {
-                    // post first
-                    let post_ret = ctrl.ud_post_recv(ud_pop_cnt_cache[vid] as usize);
-                    if post_ret.is_err() {
-                        res = reply_status::err;
-                        break;
-                    }
-                    // UD pop
-                    if pop_at_once {
-                        let qp = ctrl.get_ud(DEFAULT_RPC_HINT).unwrap();
-                        let mut op = UDOp::new(qp.as_ref());
-                        if op.wait_til_comp().is_none() {
-                            res = reply_status::err;
-                            break;
+            // repost the UD receives of all the clients at once
+            let ud_cnt: u32 = ud_pop_cnt_cache.iter().sum();
+            let ud_signaled = ud_pop_cnt_cache.iter().filter(|c| **c > 0).count();
+            if ud_cnt > 0 {
+                if !on_srq && ctrl.ud_post_recv(ud_cnt as usize).is_err() {
+                    res = reply_status::err;
+                } else if pop_at_once {
+                    // one signaled send per client
+                    let cq = ud.get_cq();
+                    for _ in 0..ud_signaled {
+                        match self.wait_signaled(cq) {
+                            Ok(wc) => {
+                                self.cookies.attach(cq, wc);
+                            }
+                            Err(status) => {
+                                res = status;
+                                break;
+                            }
                         }
                     }
                 }
+            }
+        }
 
+        if res == reply_status::ok {
+            for vid in 1..HOST_LEN {
                 if rc_pop_cnt_cache[vid] > 0 {
                     // post first
                     let post_ret = ctrl.trc_post_recv(vid, rc_pop_cnt_cache[vid] as usize);
@@ -891,13 +1308,12 @@ impl<'a> VQ<'a> {
                         break;
                     }
                     if pop_at_once {
-                        let qp = ctrl.get_trc(vid).unwrap();
-
-                        let mut op = RCOp::new(qp);
-                        if op.wait_til_comp().is_none() {
-                            res = reply_status::err;
+                        let cq = ctrl.get_trc(vid).unwrap().get_cq();
+                        if let Err(status) = self.wait_signaled(cq) {
+                            res = status;
                             break;
                         }
+                        self.cookies.take(cq);
                     }
                 }
             }
@@ -909,6 +1325,66 @@ impl<'a> VQ<'a> {
 }
 
 impl<'a> VQ<'a> {
+    #[inline]
+    fn tenant_id(&self) -> usize {
+        self as *const Self as usize
+    }
+
+    /// The UD doorbell of this VQ, emptied. Put it back once the push is done.
+    #[inline]
+    fn take_ud_doorbell(&mut self) -> Box<UDDoorbell> {
+        let mut doorbell = self.ud_doorbell.take().unwrap_or_else(UDDoorbell::new_boxed);
+        doorbell.clear();
+        doorbell
+    }
+
+    /// Wait for the DRR credit to post `req_list` on the shared QP of `port`,
+    /// bounded by `comp_timeout_ms` like the completion waits
+    #[inline]
+    fn wait_fair_share(&self, port: usize, req_list: &[core_req_t]) -> u32 {
+        let bytes: u64 = req_list.iter().map(|r| r.length as u64).sum();
+        match get_fair_share(port).wait_admit(self.tenant_id(), bytes, crate::comp_timeout_ms::read()) {
+            Ok(()) => reply_status::ok,
+            Err(status) => status,
+        }
+    }
+
+    /// Wait until all the in-flight rendezvous sends are acked by the receiver.
+    /// Return false if the receiver does not serve them in time.
+    fn wait_rndv_acks(&mut self) -> bool {
+        let sender = match self.rndv_sender.as_mut() {
+            Some(s) => s,
+            None => return true,
+        };
+        let mut retry = 0;
+        while !sender.is_empty() {
+            if sender.pop_acked().is_none() {
+                retry += 1;
+                if retry > 50000 {
+                    return false;
+                }
+            }
+        }
+        true
+    }
+
+    /// Pin the user memory `[address, address + size)` so that it can be used as the receive buffers.
+    /// Re-registering with the same hint replaces (and unpins) the old region, which is refused
+    /// while the RC may still hold receives posted in it.
+    fn reg_mr_impl(&mut self, address: u64, size: u64, hint: u32) -> u32 {
+        if self.is_rc_connected() &&
+            self.local_cache.user_mrs.get(&hint).map_or(false, |mr| mr.recv_posted) {
+            return reply_status::err;
+        }
+        match UserMR::new(address, size) {
+            Some(mr) => {
+                self.local_cache.user_mrs.insert(hint, mr);
+                reply_status::ok
+            }
+            None => reply_status::addr_error
+        }
+    }
+
     #[inline]
     fn explore_path(&mut self, port: usize, addr: &String) -> KernelResult<sa_path_rec> {
         let path_cache = self.get_path_rec_cache(addr);
@@ -978,6 +1454,56 @@ impl<'a> VQ<'a> {
     }
 }
 
+/// Tag of the wr_ids of the DC flush READs, kept apart from the small cookies
+const FLUSH_WR_ID: u64 = 1 << 63;
+/// Timed-out DC flushes remembered per VQ, the oldest are forgotten beyond it
+const MAX_DC_FLUSHES: usize = 64;
+static NEXT_FLUSH: AtomicU64 = AtomicU64::new(0);
+
+/// A wr_id for the flush READ on a DC QP, unique among the VQs sharing it
+#[inline]
+fn next_flush_wr_id() -> u64 {
+    FLUSH_WR_ID | NEXT_FLUSH.fetch_add(1, Ordering::Relaxed)
+}
+
+/// Post one request on the DC QP, as `DCOp::push` does, with `wr_id` returned in its completion
+#[inline]
+fn post_dc(dc: &DC, op: u32, local_ptr: u64, lkey: u32, sz: usize, remote_addr: u64, rkey: u32,
+           point: &EndPoint, send_flag: i32, wr_id: u64) -> KernelResult<()> {
+    let mut sge: ib_sge = Default::default();
+    sge.addr = local_ptr;
+    sge.length = sz as _;
+    sge.lkey = lkey;
+
+    let mut wr: ib_dc_wr = Default::default();
+    wr.wr.wr_id = wr_id;
+    wr.wr.opcode = op;
+    wr.wr.send_flags = send_flag;
+    wr.wr.sg_list = &mut sge as *mut _;
+    wr.wr.num_sge = 1;
+    wr.remote_addr = remote_addr;
+    wr.rkey = rkey;
+    wr.ah = point.ah;
+    // the dc_key of the DCTs created by KRdmaKit
+    wr.dct_access_key = 73;
+    wr.dct_number = point.dct_num;
+
+    let mut bad_wr: *mut ib_send_wr = null_mut();
+    let err = unsafe { bd_ib_post_send(dc.get_qp(), &mut wr.wr as *mut _, &mut bad_wr as *mut _) };
+    if err != 0 {
+        return Err(linux_kernel_module::Error::from_kernel_errno(err));
+    }
+    Ok(())
+}
+
+/// Whether all the requests are two-sided and fit in one UD packet behind the endpoint header,
+/// which could be served by UD
+#[inline]
+fn fits_ud(req_list: &[core_req_t]) -> bool {
+    req_list.iter().all(|req| (req.type_ == lib_r_req::Send || req.type_ == lib_r_req::SendImm) &&
+        req.length as usize + core::mem::size_of::<EndPoint>() <= UD_MAX_PAYLOAD)
+}
+
 impl<'a> VQ<'a> {
     #[inline]
     fn check_bind(&self, vid: usize) -> bool {
@@ -1063,6 +1589,526 @@ impl<'a> VQ<'a> {
     }
 }
 
+/// Statistics
+impl<'a> VQ<'a> {
+    /// Index of the RCtrl whose NIC serves this VQ
+    #[inline]
+    fn stats_ctrl_idx(&self) -> Option<usize> {
+        self.bind_port.map(|port| port * 2).or(self.local_connect_port)
+    }
+
+    #[inline]
+    pub(crate) fn stat(&self, counter: u32, v: u64) {
+        if v == 0 {
+            return;
+        }
+        self.stats.counters.add(counter, v);
+        if let Some(idx) = self.stats_ctrl_idx() {
+            add_nic_stat(idx, counter, v);
+        }
+    }
+
+    /// Count one batch of requests by type, bytes and signaling
+    fn stat_reqs(&self, req_list: &[core_req_t]) {
+        let mut by_type = [0 as u64; 5];
+        let mut bytes = 0;
+        let mut signaled = 0;
+        for req in req_list.iter() {
+            by_type[(req.type_ as usize) % by_type.len()] += 1;
+            bytes += req.length as u64;
+            signaled += is_signaled(req) as u64;
+        }
+        for (t, cnt) in by_type.iter().enumerate() {
+            self.stat(stats_counter::StatRead + t as u32, *cnt);
+        }
+        self.stat(stats_counter::StatBytes, bytes);
+        self.stat(stats_counter::StatBatches, 1);
+        self.stat(stats_counter::StatSignaled, signaled);
+        self.stat(stats_counter::StatUnsignaled, req_list.len() as u64 - signaled);
+    }
+
+    fn query_stats_impl(&self, req: &mut req_t, query: &query_stats_t) -> u32 {
+        if query.scope as u32 == stats_scope::StatsStages {
+            return query_stage_hists(req);
+        }
+        let mut stats: stats_t = Default::default();
+        match query.scope as u32 {
+            stats_scope::StatsVQ => self.stats.counters.sum_to(&mut stats),
+            stats_scope::StatsNIC => match nic_stats(query.nic as usize) {
+                Some(counters) => counters.sum_to(&mut stats),
+                None => return reply_status::nil,
+            },
+            _ => return reply_status::err,
+        }
+        unsafe {
+            _copy_to_user(
+                (req.reply_buf as u64 + core::mem::size_of::<reply_t>() as u64) as *mut c_void,
+                (&stats as *const stats_t).cast::<c_void>(),
+                core::mem::size_of_val(&stats) as u64,
+            )
+        };
+        reply_status::ok
+    }
+}
+
+/// Read the stage histograms to the user. They are too large for the kernel stack.
+fn query_stage_hists(req: &mut req_t) -> u32 {
+    let mut hists: Box<stage_hists_t> = unsafe { Box::new_zeroed().assume_init() };
+    read_stages(&mut hists);
+    unsafe {
+        _copy_to_user(
+            (req.reply_buf as u64 + core::mem::size_of::<reply_t>() as u64) as *mut c_void,
+            (&*hists as *const stage_hists_t).cast::<c_void>(),
+            core::mem::size_of::<stage_hists_t>() as u64,
+        )
+    };
+    reply_status::ok
+}
+
+/// Receiving from the shared SRQ pool
+impl<'a> VQ<'a> {
+    /// Serve the bound `port` with a UD on the pool, which the clients resolve by `SRQ_UD_HINT`
+    #[allow(dead_code)]
+    fn attach_srq_ud(&mut self, port: usize) -> u32 {
+        let ud = match get_srq_pool(port * 2).and_then(|pool| pool.attach(port)) {
+            Some(ud) => ud,
+            None => {
+                self.bind_port = None;
+                return reply_status::err;
+            }
+        };
+        get_bind_ctrl(port).reg_ud(SRQ_UD_HINT, ud.clone());
+        self.srq_ud = Some(ud);
+        if self.srq_wcs.is_empty() {
+            self.srq_wcs.resize(wc_consts::pop_wc_len as usize, Default::default());
+        }
+        reply_status::ok
+    }
+
+    fn detach_srq_ud(&mut self) {
+        if let (Some(ud), Some(port)) = (self.srq_ud.take(), self.bind_port) {
+            get_bind_ctrl(port).dereg_ud(SRQ_UD_HINT);
+            if let Some(pool) = get_srq_pool(port * 2) {
+                pool.detach(&ud);
+            }
+        }
+    }
+
+    /// Poll the UD messages from the pool, then the RC ones from the RCtrl
+    fn pop_srq_recv(&mut self) -> (Option<*mut ib_wc>, usize) {
+        let port = self.bind_port.unwrap();
+        let mut n = match get_srq_pool(port * 2) {
+            Some(pool) => pool.poll(port, &mut self.srq_wcs),
+            None => 0,
+        };
+        if n < self.srq_wcs.len() {
+            let (rc_wcs, rc_cnt) = pop_recv(port * 2, self.srq_wcs.len() - n, 0);
+            if let Some(rc_wcs) = rc_wcs {
+                for i in 0..rc_cnt {
+                    self.srq_wcs[n + i] = unsafe { *rc_wcs.add(i) };
+                }
+                n += rc_cnt;
+            }
+        }
+        (Some(self.srq_wcs.as_mut_ptr()), n)
+    }
+}
+
+/// Id of the VQ in the tracepoints, the same as in the debugfs
+impl<'a> VQ<'a> {
+    #[inline]
+    pub(crate) fn trace_id(&self) -> u64 {
+        self.stats.id
+    }
+}
+
+/// Stage profiling, no-ops unless `profile_stages` is set
+impl<'a> VQ<'a> {
+    #[inline]
+    fn prof_mark(&mut self, stage: u32) {
+        if let Some(clock) = self.prof.as_mut() {
+            clock.mark(stage);
+        }
+    }
+
+    #[inline]
+    fn prof_add_post(&mut self, cycles: u64) {
+        if let Some(clock) = self.prof.as_mut() {
+            clock.add_post(cycles);
+        }
+    }
+
+    #[inline]
+    fn prof_build_post(&mut self) {
+        if let Some(clock) = self.prof.as_mut() {
+            clock.mark_build_post();
+        }
+    }
+}
+
+/// Flush of the pushed requests
+impl<'a> VQ<'a> {
+    /// Complete once all the requests pushed before have completed at the remote NIC.
+    /// A fenced, signaled zero-length READ is posted behind them: the QP completes in order,
+    /// so its completion implies theirs. The completions of the earlier signaled requests
+    /// polled on the way are kept for the following pops.
+    fn flush_impl(&mut self) -> u32 {
+        if self.is_bind_mode() || self.local_cache.local_mr.is_none() {
+            return reply_status::err;
+        }
+        let local_mr = self.local_cache.local_mr.as_ref().unwrap();
+        let local_pa = local_mr.get_addr();
+        let lkey = local_mr.get_rkey();
+        let flags = ib_send_flags::IB_SEND_SIGNALED | ib_send_flags::IB_SEND_FENCE;
+        let mut flush_req: core_req_t = Default::default();
+        flush_req.type_ = lib_r_req::Read;
+        flush_req.send_flags = req_flags::req_signaled;
+
+        if let Some(qp) = self.virtual_queue.as_ref() {
+            let remote_mr = qp.get_remote_mr();
+            let cq = qp.get_cq();
+            let mut op = RCOp::new(qp);
+            if op.push(ib_wr_opcode::IB_WR_RDMA_READ, local_pa, lkey, 0,
+                       remote_mr.get_addr(), remote_mr.get_rkey() as u32, flags).is_err() {
+                self.recover_rc(IB_WC_WR_FLUSH_ERR);
+                return reply_status::err;
+            }
+            let earlier = self.inflight.signaled();
+            // logged as well, so that a timed out flush is retired by a later pop
+            self.inflight.record(&flush_req);
+            // the stale completions are among the earlier ones
+            self.stale.reset(cq);
+            for i in 0..=earlier {
+                let mut wc = match wait_comp(cq, &mut self.spin) {
+                    Ok(wc) => wc,
+                    Err(status) => return self.leave_stale(cq, earlier + 1 - i, status),
+                };
+                if wc.status != IB_WC_SUCCESS {
+                    self.recover_rc(wc.status);
+                    return reply_status::err;
+                }
+                if let Some(cookie) = self.inflight.retire_one() {
+                    set_cookie(&mut wc, cookie);
+                    if i < earlier {
+                        self.early_wcs.push_back(wc);
+                    }
+                }
+            }
+            return if self.wait_rndv_acks() { reply_status::ok } else { reply_status::timeout };
+        }
+
+        #[cfg(feature = "dct_qp")]
+            {
+                if let (Some(dc), Some(point)) = (self.local_dc, self.local_cache.remote_endpoint.as_ref()) {
+                    let cq = dc.get_cq();
+                    // the CQ is shared by the VQs of the port, so the fenced READ is only known
+                    // by its wr_id, which no other request carries
+                    let wr_id = next_flush_wr_id();
+                    if post_dc(dc, ib_wr_opcode::IB_WR_RDMA_READ, local_pa, lkey, 0,
+                               point.mr.get_addr(), point.mr.get_rkey() as u32, point, flags,
+                               wr_id).is_err() {
+                        return reply_status::err;
+                    }
+                    loop {
+                        let wc = match wait_comp(cq, &mut self.spin) {
+                            Ok(wc) => wc,
+                            Err(status) => {
+                                // dropped by the pop which polls it
+                                if self.dc_flushes.len() >= MAX_DC_FLUSHES {
+                                    self.dc_flushes.remove(0);
+                                }
+                                self.dc_flushes.push(wr_id);
+                                return status;
+                            }
+                        };
+                        if unsafe { wc.__bindgen_anon_1.wr_id } == wr_id {
+                            return if wc.status == IB_WC_SUCCESS { reply_status::ok } else { reply_status::err };
+                        }
+                        if let Some(wc) = self.popped_wc(cq, wc) {
+                            self.early_wcs.push_back(wc);
+                        }
+                    }
+                }
+            }
+        // a released RC leaves nothing in flight
+        if self.rc_released { reply_status::ok } else { reply_status::not_connected }
+    }
+}
+
+/// Recovery from the RC errors
+impl<'a> VQ<'a> {
+    /// Wait for the completion of the latest signaled request on `cq`. The completions left by
+    /// the timed-out waits before are polled first, and reported by the following pops.
+    fn wait_signaled(&mut self, cq: *mut ib_cq) -> Result<ib_wc, u32> {
+        let rc_cq = self.virtual_queue.as_ref().map(|rc| rc.get_cq());
+        let inflight = &mut self.inflight;
+        let cookies = &mut self.cookies;
+        let early_wcs = &mut self.early_wcs;
+        wait_fresh_comp(cq, &mut self.spin, &mut self.stale, true, &mut |cq, mut wc, reported| {
+            if !reported {
+                return;
+            }
+            if rc_cq == Some(cq) {
+                match inflight.retire_one() {
+                    Some(cookie) => set_cookie(&mut wc, cookie),
+                    None => return,
+                }
+            } else {
+                wc = cookies.attach(cq, wc);
+            }
+            early_wcs.push_back(wc);
+        })
+    }
+
+    /// Poll the completions of the signaled rendezvous descriptors without blocking. The
+    /// completions of the user requests polled on the way are reported by the following pops.
+    fn reap_rndv_descs(&mut self) {
+        while self.inflight.internal_pending() {
+            let wc = match self.virtual_queue.as_ref() {
+                Some(rc) => RCOp::new(rc).pop().map(|wc| unsafe { *wc }),
+                None => return,
+            };
+            let mut wc = match wc {
+                Some(wc) => wc,
+                None => return,
+            };
+            if let Some(wc) = self.check_rc_wc(Some(&mut wc as *mut ib_wc)) {
+                self.early_wcs.push_back(wc);
+            }
+        }
+    }
+
+    /// Record the `cnt` completions a flush has not polled in time, return `status`
+    #[inline]
+    fn leave_stale(&mut self, cq: *mut ib_cq, cnt: usize, status: u32) -> u32 {
+        if status == reply_status::timeout {
+            for _ in 0..cnt {
+                self.stale.leave(cq, true);
+            }
+        }
+        status
+    }
+
+    /// A completion polled by a pop from `cq`. The internal ones left by the timed-out
+    /// waits (and the DC flushes) are dropped, the others get their cookies.
+    #[inline]
+    fn popped_wc(&mut self, cq: *mut ib_cq, wc: ib_wc) -> Option<ib_wc> {
+        let wr_id = unsafe { wc.__bindgen_anon_1.wr_id };
+        if let Some(idx) = self.dc_flushes.iter().position(|id| *id == wr_id) {
+            self.dc_flushes.swap_remove(idx);
+            return None;
+        }
+        match self.stale.pop(cq) {
+            Some(false) => None,
+            _ => Some(self.cookies.attach(cq, wc)),
+        }
+    }
+
+    /// Check the completion polled from the RC. Recover if it reports an error,
+    /// and return the first failed completion (if any) instead. The internal
+    /// completions are consumed here.
+    #[inline]
+    fn check_rc_wc(&mut self, wc: Option<*mut ib_wc>) -> Option<ib_wc> {
+        let mut wc = unsafe { *wc? };
+        // the completions left by the timed-out waits are reported by the pops as well
+        if let Some(rc) = self.virtual_queue.as_ref() {
+            self.stale.pop(rc.get_cq());
+        }
+        if wc.status == IB_WC_SUCCESS {
+            set_cookie(&mut wc, self.inflight.retire_one()?);
+            return Some(wc);
+        }
+        self.recover_rc(wc.status);
+        None
+    }
+
+    /// Handle a fatal error of the RC: release it and reconnect in the background,
+    /// replay the idempotent in-flight requests on the DC QP, and fail the others.
+    /// Return the status of the replay.
+    fn recover_rc(&mut self, status: u32) -> u32 {
+        println!("[vq] RC error, wc status: {}, fall back", status);
+        self.stat(stats_counter::StatErrors, 1);
+        trace::error(self.trace_id(), self.cur_cmd, reply_status::err, status);
+        self.stat(stats_counter::StatMigrations, 1);
+        let (replay, failed) = self.inflight.drain();
+        for req in failed.iter() {
+            self.failed_wcs.push_back(failed_wc(req, IB_WC_WR_FLUSH_ERR));
+        }
+        if let Some(sender) = self.rndv_sender.as_mut() {
+            while let Some(wr_id) = sender.pop_unacked() {
+                self.failed_wcs.push_back(failed_wc_with(lib_r_req::Send, wr_id, IB_WC_WR_FLUSH_ERR));
+            }
+        }
+        unregister_rc_holder(self as *mut VQ);
+        self.release_rc();
+        self.reconnect_rc();
+
+        if replay.is_empty() {
+            return reply_status::ok;
+        }
+        self.fallback_push_impl(&replay)
+    }
+
+    /// Recover, then wait for the replayed requests instead of the failed completion.
+    /// Return the reply status if any request is failed, which has been reported by it.
+    fn recover_and_wait(&mut self, status: u32) -> Result<(), u32> {
+        let signaled = self.inflight.has_signaled_replayable();
+        let replayed = self.recover_rc(status);
+        if replayed != reply_status::ok || !self.failed_wcs.is_empty() || !signaled {
+            self.failed_wcs.clear();
+            return Err(reply_status::err);
+        }
+        #[cfg(feature = "dct_qp")]
+            {
+                let cq = self.get_dc().get_cq();
+                let wc = self.wait_signaled(cq)?;
+                return if wc.status == IB_WC_SUCCESS { Ok(()) } else { Err(reply_status::err) };
+            }
+        #[cfg(not(feature = "dct_qp"))]
+            Err(reply_status::err)
+    }
+
+    /// Post the requests on the QP serving the VQ when its RC is down.
+    /// Without `dct_qp` there is no such QP, so the requests are failed.
+    fn fallback_push_impl(&mut self, req_list: &[core_req_t]) -> u32 {
+        #[cfg(feature = "dct_qp")]
+            {
+                if self.local_dc.is_some() && self.local_cache.remote_endpoint.is_some() {
+                    return if fits_ud(req_list) {
+                        self.ud_push_impl(req_list)
+                    } else {
+                        self.dc_push_impl(req_list)
+                    };
+                }
+            }
+        for req in req_list.iter() {
+            self.failed_wcs.push_back(failed_wc(req, IB_WC_WR_FLUSH_ERR));
+        }
+        reply_status::err
+    }
+}
+
+/// Lifecycle of the RC
+impl<'a> VQ<'a> {
+    /// Connect the RC in the background. The VQ uses the DC QP until the RC is ready.
+    #[cfg(feature = "migrate_qp")]
+    fn spawn_rc_migrate(&mut self, port: usize, vid: usize, path: sa_path_rec) {
+        self.rc_connect_param = Option::from(RCConnectParam {
+            vid,
+            port,
+            path,
+            vq: self as *mut VQ,
+            done: AtomicBool::new(false),
+        });
+        let task = unsafe {
+            rust_kernel_linux_util::bindings::bd_kthread_run(
+                Some(bg_rc_migrate_thread),
+                (self.rc_connect_param.as_mut().unwrap() as *mut RCConnectParam).cast::<c_void>(),
+                b"bg thread\0".as_ptr() as *const i8,
+            )
+        };
+        if task.is_null() {
+            self.rc_connect_param.as_ref().unwrap().done.store(true, Ordering::Release);
+        }
+    }
+
+    /// Wait for the on-going background connection, if any
+    #[inline]
+    fn wait_rc_migrate(&self) {
+        if let Some(param) = self.rc_connect_param.as_ref() {
+            while !param.done.load(Ordering::Acquire) {
+                yield_now();
+            }
+        }
+    }
+
+    /// Reconnect the RC released by the reaper (or by a fatal error). Unless it migrates in the
+    /// background, the RC is connected right here; on failure the VQ stays released, so the
+    /// pushes use the DC QP, or fail with `not_connected` without `dct_qp`.
+    fn reconnect_rc(&mut self) {
+        let (port, vid, path) = match self.rc_conn {
+            Some(conn) => conn,
+            None => return,
+        };
+        #[cfg(all(feature = "dct_qp", feature = "migrate_qp"))]
+            {
+                // the DC QP serves the requests until the RC is back
+                let migrating = self.rc_connect_param.as_ref()
+                    .map_or(false, |p| !p.done.load(Ordering::Acquire));
+                if !migrating {
+                    self.spawn_rc_migrate(port, vid, path);
+                    self.rc_released = false;
+                }
+            }
+        #[cfg(not(all(feature = "dct_qp", feature = "migrate_qp")))]
+            {
+                if let Ok(Some(qp)) = qp_connect(vid, port, &path) {
+                    #[cfg(feature = "virtual_queue")]
+                        {
+                            self.virtual_queue = Some(qp);
+                            register_rc_holder(self as *mut VQ, &self.activity);
+                            self.rc_released = false;
+                            trace::migrate(self.trace_id(), port, vid, true);
+                        }
+                }
+            }
+    }
+
+    /// Whether the RC can be released without losing any work: nothing is in flight on it,
+    /// no rendezvous send waits for its ack, and no receive has been posted on it.
+    /// The receives are not tracked one by one, so an RC which has any is never reaped.
+    pub(crate) fn rc_drained(&self) -> bool {
+        self.inflight.len() == 0 && !self.rc_recvs_posted &&
+            self.rndv_sender.as_ref().map_or(true, |s| s.is_empty())
+    }
+
+    /// Destroy the RC, and ask the remote to deregister its end in the background.
+    /// The requests still in flight on it are failed to the following pops.
+    /// Called by the reaper (with the VQ claimed and drained) or when the VQ is closed.
+    pub(crate) fn release_rc(&mut self) {
+        if let Some(rc) = self.virtual_queue.take() {
+            #[cfg(feature = "meta_kv")]
+                {
+                    if let (Some(point), Some((_, vid, _))) =
+                    (self.local_cache.remote_endpoint.as_ref(), self.rc_conn) {
+                        crate::reaper::bg_disconnect_rc(point.self_clone(), vid);
+                    }
+                }
+            if let Some((port, vid, _)) = self.rc_conn {
+                trace::migrate(self.trace_id(), port, vid, false);
+            }
+            self.stale.reset(rc.get_cq());
+            // destroy the QP, which also disconnects its CM and flushes the user receives
+            drop(rc);
+            for mr in self.local_cache.user_mrs.values_mut() {
+                mr.recv_posted = false;
+            }
+            self.rc_recvs_posted = false;
+            let (replay, failed) = self.inflight.drain();
+            for req in replay.iter().chain(failed.iter()) {
+                self.failed_wcs.push_back(failed_wc(req, IB_WC_WR_FLUSH_ERR));
+            }
+            self.rc_released = true;
+        }
+    }
+}
+
 impl Drop for VQ<'_> {
-    fn drop(&mut self) {}
+    fn drop(&mut self) {
+        self.activity.enter();
+        // the background connection refers to this VQ
+        self.wait_rc_migrate();
+        unregister_rc_holder(self as *mut VQ);
+        // before the user regions are unpinned with the fields
+        self.release_rc();
+
+        self.detach_srq_ud();
+        self.local_cache.cached_client_endpoint.clear();
+        self.local_cache.remote_endpoint = None;
+        self.stats.unregister();
+        if let Some(port) = self.local_connect_port {
+            get_fair_share(port).remove(self.tenant_id());
+        }
+        self.activity.leave(false);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <deque>
+#include <vector>
+
+#include "../../include/krcore_co.hh"
+
+/*!
+  The coroutines of krcore_co.hh over a fake device: `ioctl` is interposed below, so the
+  pushed requests are recorded and the completions are whatever the test queues, e.g., a
+  late one of a failed push. No kernel module is needed.
+ */
+namespace fake {
+
+int push_status = ok;
+std::vector<core_req_t> pushed;
+std::size_t push_calls = 0;
+std::deque<user_wc_t> comps;
+std::deque<user_wc_t> msgs;
+
+user_wc_t
+wc_of(unsigned long long wr_id, unsigned int status = 0) {
+    user_wc_t wc = {};
+    wc.wc_status = status;
+    wc.wc_wr_id = wr_id;
+    return wc;
+}
+
+} // namespace fake
+
+extern "C" int
+ioctl(int, unsigned long cmd, ...) noexcept {
+    va_list args;
+    va_start(args, cmd);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+
+    switch (cmd) {
+        case Push: {
+            auto req = static_cast<push_req_t *>(arg);
+            fake::push_calls += 1;
+            for (unsigned int i = 0; i < req->core.req_len; ++i) {
+                fake::pushed.push_back(req->core.req_list[i]);
+            }
+            static_cast<reply_t *>(req->req.reply_buf)->status = fake::push_status;
+            return 0;
+        }
+        case Pop: {
+            auto reply = static_cast<pop_reply_t *>(static_cast<pop_req_t *>(arg)->req.reply_buf);
+            if (fake::comps.empty()) {
+                reply->header.status = nil;
+                return 0;
+            }
+            reply->wc[0] = fake::comps.front();
+            fake::comps.pop_front();
+            reply->header.status = ok;
+            return 0;
+        }
+        case PopMsgs: {
+            auto req = static_cast<pop_msgs_t *>(arg);
+            auto reply = static_cast<pop_reply_t *>(req->req.reply_buf);
+            unsigned int cnt = 0;
+            while (cnt < req->pop_count && !fake::msgs.empty()) {
+                reply->wc[cnt++] = fake::msgs.front();
+                fake::msgs.pop_front();
+            }
+            reply->pop_count = cnt;
+            reply->header.status = cnt > 0 ? ok : nil;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+using krcore::co::Reactor;
+using krcore::co::Result;
+using krcore::co::Task;
+
+static unsigned long long
+cookie_of(unsigned int gen, unsigned int idx) {
+    return (static_cast<unsigned long long>(gen) << 32) | (idx + 1);
+}
+
+// read `times` times, and record the result of each
+static Task
+reader(Reactor &r, unsigned long long off, int times, std::vector<Result> &out) {
+    for (int i = 0; i < times; ++i) {
+        out.push_back(co_await r.read(0, off, 64));
+    }
+}
+
+static Task
+receiver(Reactor &r, std::vector<unsigned long long> &out, int id) {
+    auto res = co_await r.recv();
+    assert(res.ok());
+    out.push_back(res.wc.wc_wr_id * 10 + id);
+}
+
+int
+main() {
+    krcore::Queue q(1024);
+    Reactor r(q);
+
+    // one round pushes all the awaited requests at once, each with the cookie of its slot
+    std::vector<Result> res[4];
+    for (int i = 0; i < 4; ++i) {
+        r.spawn(reader(r, i * 64, 1, res[i]));
+    }
+    assert(r.alive() == 4 && fake::pushed.empty());
+    r.poll();
+    assert(fake::push_calls == 1 && fake::pushed.size() == 4 && r.outstanding() == 4);
+    for (unsigned int i = 0; i < 4; ++i) {
+        assert(fake::pushed[i].cookie == cookie_of(0, i));
+        assert(fake::pushed[i].send_flags & req_signaled);
+        assert(fake::pushed[i].remote_addr == i * 64 && fake::pushed[i].type == Read);
+    }
+
+    // the completions resume exactly their awaiters, in any order
+    for (int i = 3; i >= 0; --i) {
+        fake::comps.push_back(fake::wc_of(cookie_of(0, i)));
+    }
+    r.poll();
+    for (int i = 0; i < 4; ++i) {
+        assert(res[i].size() == 1 && res[i][0].ok());
+        assert(res[i][0].wc.wc_wr_id == cookie_of(0, i));
+    }
+    assert(r.alive() == 0 && r.outstanding() == 0);
+
+    // a freed slot is reused with the next generation
+    std::vector<Result> again;
+    r.spawn(reader(r, 0, 1, again));
+    r.poll();
+    unsigned long long reused = fake::pushed.back().cookie;
+    assert((reused >> 32) == 1 && static_cast<unsigned int>(reused) - 1 < 4);
+    fake::comps.push_back(fake::wc_of(reused));
+    r.poll();
+    assert(again.size() == 1 && again[0].ok() && r.alive() == 0);
+
+    // a failed push resumes its awaiter with the status, which awaits again in the same slot
+    fake::pushed.clear();
+    fake::push_status = err;
+    std::vector<Result> retry;
+    r.spawn(reader(r, 128, 2, retry));
+    r.poll();
+    assert(retry.size() == 1 && retry[0].status == err && !retry[0].ok());
+    assert(r.outstanding() == 0);
+    unsigned long long failed = fake::pushed[0].cookie;
+
+    fake::push_status = ok;
+    r.poll();
+    unsigned long long fresh = fake::pushed[1].cookie;
+    assert(static_cast<unsigned int>(fresh) == static_cast<unsigned int>(failed));
+    assert((fresh >> 32) == (failed >> 32) + 1 && r.outstanding() == 1);
+
+    // the late completion of the failed push, and the unknown cookies, wake nobody
+    fake::comps.push_back(fake::wc_of(failed));
+    fake::comps.push_back(fake::wc_of(0));
+    fake::comps.push_back(fake::wc_of(cookie_of(0, 1000)));
+    r.poll();
+    assert(retry.size() == 1 && r.outstanding() == 1 && fake::comps.empty());
+
+    fake::comps.push_back(fake::wc_of(fresh, 12));
+    r.poll();
+    assert(retry.size() == 2 && retry[1].status == ok && !retry[1].ok());
+    assert(retry[1].wc.wc_wr_id == fresh && r.alive() == 0 && r.outstanding() == 0);
+
+    // the receivers are served in FIFO order, the others keep waiting
+    std::vector<unsigned long long> got;
+    r.spawn(receiver(r, got, 1));
+    r.spawn(receiver(r, got, 2));
+    r.poll();
+    assert(got.empty() && r.alive() == 2);
+
+    fake::msgs.push_back(fake::wc_of(7));
+    r.poll();
+    assert(got.size() == 1 && got[0] == 71 && r.alive() == 1);
+
+    r.spawn(receiver(r, got, 3));
+    fake::msgs.push_back(fake::wc_of(8));
+    fake::msgs.push_back(fake::wc_of(9));
+    r.run();
+    assert(got.size() == 3 && got[1] == 82 && got[2] == 93);
+
+    // the fd is not a real qd
+    q.release();
+    printf("test co passed\n");
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "../../include/krcore.hh"
+
+int
+main(int argc, char *argv[]) {
+    auto q = krcore::Queue::open();
+    assert(q.valid());
+
+    int ret = q.connect("fe80:0000:0000:0000:ec0d:9a03:0078:645e", 16);
+    printf("get qd connect res: %d\n", ret);
+
+    krcore::Batch<4> batch;
+    for (int i = 0; i < 4; ++i) {
+        batch.read(1024 * i, 2048, 1024, 0xc00c1e00 + i);
+    }
+    assert(batch.full() && !batch.read(0, 0, 8));
+    batch.signal_last();
+    int push_res = q.push(batch);
+    printf("push res: %d\n", push_res);
+
+    // the ring is reused by all the pops below
+    krcore::CompletionRing ring;
+    int cnt = 0;
+    while ((ret = q.pop(ring)) == nil) { ++cnt; }
+    printf("[%d] pop_res: %d, pop_count: %zu\n", cnt, ret, ring.size());
+    for (auto &wc : ring) {
+        printf("pop wc.status: %d, wc.cookie: %llx\n", wc.wc_status, wc.wc_wr_id);
+    }
+
+    printf("flush res: %d\n", q.flush());
+
+    // the qd moves along with its ownership, and is closed once
+    krcore::Queue other = std::move(q);
+    assert(!q.valid() && other.valid());
+    return 0;
+}
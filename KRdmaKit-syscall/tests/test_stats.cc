@@ -0,0 +1,51 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "../../include/syscall.h"
+
+static const char *names[StatCounterNum] = {
+        "read", "write", "send", "send_imm", "write_imm",
+        "bytes", "batches", "signaled", "unsignaled", "pop_empty",
+        "path_rc", "path_dc", "path_ud", "migrations", "errors",
+};
+
+static void
+dump(const char *title, const stats_t &stats) {
+    printf("%s:\n", title);
+    for (int i = 0; i < StatCounterNum; ++i) {
+        printf("  %-12s %llu\n", names[i], stats.counters[i]);
+    }
+}
+
+int
+main(int argc, char *argv[]) {
+    int qd = queue();
+    assert(qd >= 0);
+
+    // an empty pop is counted
+    pop_reply_t *pop_reply = new pop_reply_t;
+    qpop(qd, pop_reply);
+    delete pop_reply;
+
+    stats_reply_t reply;
+    int ret = qstats(qd, &reply);
+    printf("query vq stats res: %d\n", ret);
+    dump("vq", reply.stats);
+
+    ret = qstats(qd, &reply, StatsNIC, 0);
+    printf("query nic stats res: %d\n", ret);
+    dump("nic 0", reply.stats);
+
+    // filled only with profile_stages=1
+    static stage_hists_reply_t hists;
+    ret = qstage_hists(qd, &hists);
+    printf("query stage hists res: %d, tsc khz: %llu\n", ret, hists.hists.tsc_khz);
+    for (int s = 0; s < StageNum; ++s) {
+        unsigned long long cnt = 0;
+        for (int i = 0; i < hist_bucket_num; ++i) {
+            cnt += hists.hists.buckets[s][i];
+        }
+        printf("  stage %d: %llu samples\n", s, cnt);
+    }
+    return 0;
+}
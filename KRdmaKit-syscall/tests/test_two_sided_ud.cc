@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../include/syscall.h"
+
+/*!
+  A UD round trip through bind: the client sends without an RC (i.e., the module built with
+  Kbuild-DC), so the message goes through the batched UD path. The bind side replies to the
+  endpoint at the head of the message, which only arrives if the client sent it along.
+ */
+int
+main(int argc, char *argv[]) {
+    int server = queue();
+    int client = queue();
+    assert(server >= 0 && client >= 0);
+
+    const char *addr = "fe80:0000:0000:0000:ec0d:9a03:0078:645e";
+    const uint32_t vid = 1024;
+    assert(qbind(server, vid) == ok);
+    int ret = qconnect(client, addr, strlen(addr), 0, vid);
+    printf("client connect res: %d\n", ret);
+
+    assert(qpush_recv(server, 16) == ok);
+    assert(qpush_recv(client, 16) == ok);
+
+    core_req_t req = {
+            .addr = 1024,
+            .length = 64,
+            .lkey = 0,
+            .remote_addr = 0,
+            .rkey = 0,
+            .send_flags = req_signaled,
+            .vid = vid,
+            .type = Send,
+            .cookie = 73,
+    };
+    push_core_req_t push = {.req_len = 1, .req_list = &req};
+    static pop_reply_t reply;
+
+    // client => server
+    assert(qpush(client, &push, 1) == ok);
+    int cnt = 0;
+    while (qpop_msgs(server, &reply, 1) != ok && cnt <= 1000) { ++cnt; }
+    assert(reply.pop_count == 1 && reply.wc[0].wc_status == 0);
+    printf("server pop msg, cnt: %d, len: %u\n", cnt, reply.wc[0].byte_len);
+
+    // server => client, to the endpoint carried by the message
+    req.remote_addr = reply.wc[0].wc_wr_id;
+    assert(qpush(server, &push, 1) == ok);
+    cnt = 0;
+    while (qpop_msgs(client, &reply, 1) != ok && cnt <= 1000) { ++cnt; }
+    assert(reply.pop_count == 1 && reply.wc[0].wc_status == 0);
+    printf("client get reply, cnt: %d\n", cnt);
+
+    qunbind(server, vid);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../include/syscall.h"
+
+#define K 1024
+#define ENTRY_SZ (4 * K)
+#define ENTRY_NUM 64
+
+int
+main(int argc, char *argv[]) {
+    int qd = queue();
+    assert(qd >= 0);
+    int ret = qbind(qd, 73);
+    printf("bind res: %d\n", ret);
+
+    // page aligned, so that each entry is physically contiguous
+    void *ptr = aligned_alloc(ENTRY_SZ, ENTRY_SZ * ENTRY_NUM);
+    ret = qreg_mr(qd, (unsigned long long) ptr, ENTRY_SZ * ENTRY_NUM, 1);
+    printf("reg mr res: %d\n", ret);
+
+    recv_buf_t bufs[ENTRY_NUM];
+    for (int i = 0; i < ENTRY_NUM; ++i) {
+        bufs[i].addr = (unsigned long long) ptr + i * ENTRY_SZ;
+        bufs[i].length = ENTRY_SZ;
+        bufs[i].hint = 1;
+    }
+    ret = qpush_recv(qd, ENTRY_NUM, bufs);
+    printf("push user recv res: %d\n", ret);
+
+    static pop_reply_t reply;
+    ret = qpop_msgs(qd, &reply, 1);
+    for (unsigned int i = 0; i < reply.pop_count; ++i) {
+        printf("msg %u lands at %llx\n", i, reply.wc[i].wc_wr_id);
+    }
+
+    qunbind(qd, 73);
+    free(ptr);
+    return 0;
+}
@@ -5,6 +5,7 @@
 
 #include "allocator.hh"
 #include "logging.hh"
+#include "slab.hh"
 
 namespace r2 {
 
@@ -33,6 +34,22 @@ namespace r2 {
 
   - About concurrency
   Different allocator works in parallel.
+
+  - Slab allocator
+  Alternatively, the heap can be the slabs of per-NUMA-node regions, each
+  registered once by the callback (e.g., with rlib's RegHandler):
+
+      AllocatorMaster<73>::init_slab(2, 1GB, [&](usize node, char *mem, u64 sz) -> Option<MRKeys> {
+        ... // register (mem, sz) to the NIC near node
+      });
+      auto slab = AllocatorMaster<73>::get_thread_slab();
+      char *ptr = (char *)slab->alloc(4096);         // from the node of this thread
+      auto keys = AllocatorMaster<73>::lookup_mr(ptr); // (lkey, rkey) of ptr, O(1)
+      slab->dealloc(ptr);
+
+  Allocations are served by per-thread magazines, refilled from per-node
+  depots, so neither jemalloc nor the global lock is on the path.
+  An object is at most SlabMaster::kMaxObj bytes.
  */
 template <int NAME = 0>
 class AllocatorMaster {
@@ -88,6 +105,30 @@ class AllocatorMaster {
     return ret;
   }
 
+  static bool init_slab(const usize &nodes, const u64 &sz_per_node,
+                        const SlabMaster::reg_func_t &reg) {
+    return slab.init(nodes, sz_per_node, reg);
+  }
+
+  static bool slab_inited() { return slab.inited(); }
+
+  /*!
+    The slab cache of this thread, on the NUMA node the thread first runs on.
+    nullptr if init_slab is not called.
+   */
+  static SlabCache *get_thread_slab() {
+    if (likely(thread_slab))
+      return thread_slab.get();
+    if (!slab.inited())
+      return nullptr;
+    thread_slab.reset(new SlabCache(slab, slab.cur_node()));
+    return thread_slab.get();
+  }
+
+  static Option<MRKeys> lookup_mr(ptr_t p) { return slab.lookup(p); }
+
+  static bool within_slab(ptr_t p) { return slab.within_range(p); }
+
  public:
   static char *start_addr;
   static char *end_addr;
@@ -99,6 +140,9 @@ class AllocatorMaster {
 
   static thread_local Allocator *thread_allocator;
 
+  static SlabMaster slab;
+  static thread_local std::unique_ptr<SlabCache> thread_slab;
+
  private:
   /**
    * Hooks to different jemalloc callbacks.
@@ -171,6 +215,11 @@ template <int N> std::mutex AllocatorMaster<N>::lock;
 template <int N>
 thread_local Allocator *AllocatorMaster<N>::thread_allocator = nullptr;
 
+template <int N> SlabMaster AllocatorMaster<N>::slab;
+
+template <int N>
+thread_local std::unique_ptr<SlabCache> AllocatorMaster<N>::thread_slab;
+
 template <int N>
 extent_hooks_t AllocatorMaster<N>::hooks = {
   AllocatorMaster<N>::extent_alloc_hook,
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <sched.h>
+
+#include "../common.hh"
+
+namespace r2 {
+
+/*!
+  Spin with exponentially more pauses, then give up the CPU.
+  Used by the blocking calls of the channels, so a waiting core does not
+  keep hammering the cache line of the other side.
+ */
+class Backoff {
+public:
+  inline void spin() {
+    if (step <= kSpinLimit) {
+      for (usize i = 0; i < (1u << step); ++i)
+        relax_fence();
+      step += 1;
+    } else {
+      sched_yield();
+    }
+  }
+
+  inline void reset() { step = 0; }
+
+private:
+  static constexpr usize kSpinLimit = 6;
+  usize step = 0;
+};
+
+} // namespace r2
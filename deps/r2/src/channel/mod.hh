@@ -1,21 +1,45 @@
 #pragma once
 
-#include "../common.hpp"
-
+#include <algorithm>
+#include <atomic>
 #include <stdlib.h>
 
+#include "../common.hh"
+#include "./backoff.hh"
+#include "./mpmc.hh"
+
 namespace r2
 {
 
 /*!
-  TODO: add an example here
+  A bounded single-producer/single-consumer channel.
+  For multiple producers or consumers, use MPMCChannel (./mpmc.hh).
+
+  Example:
+  `
+    Channel<int> c(64);
+    // producer
+    c.enqueue_blocking(1);
+    int xs[3] = {2, 3, 4};
+    c.enqueue_n(xs, 3); // may enqueue less than 3 if full
+    // consumer
+    auto v = c.dequeue(); // Option<int>
+    int ys[8];
+    auto n = c.dequeue_n(ys, 8);
+  `
+
+  Each side caches the index of the other side, and only reloads it when the
+  cached one says full (or empty), so in the common case the two cores touch
+  their own index only. An index is published with a single release store,
+  which also covers all entries of a batch.
  */
 template <class T>
 class Channel
 {
 public:
   Channel(u64 max_entry_num = 1)
-      : max_entry_num(max_entry_num), head(0), tail(0)
+      : max_entry_num(max_entry_num), head(0), tail_cache(0), tail(0),
+        head_cache(0)
   {
     ASSERT(!(max_entry_num & (max_entry_num - 1)));
 
@@ -27,64 +51,82 @@ public:
 
   ~Channel() { free(ring_buf); }
 
-  inline u64 size() const { return head - tail; }
+  inline u64 size() const
+  {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
 
-  inline bool isEmpty() const { return head == tail; }
+  inline bool isEmpty() const { return size() == 0; }
 
-  inline bool enqueue(const T &value)
-  {
-    ASSERT(head >= tail);
-    if (head == tail + max_entry_num)
-    {
-      return false;
-    }
-    else
-    {
-      u64 index = head & (max_entry_num - 1);
+  /*!
+    Producer only
+   */
+  inline bool enqueue(const T &value) { return enqueue_n(&value, 1) == 1; }
 
-      ring_buf[index].value = value;
-      __sync_fetch_and_add(&head, 1);
-      return true;
-    }
+  /*!
+    Producer only: enqueue the first (at most) num values,
+    return the number enqueued
+   */
+  inline u64 enqueue_n(const T *values, u64 num)
+  {
+    const u64 h = head.load(std::memory_order_relaxed);
+    if (h + num > tail_cache + max_entry_num)
+      tail_cache = tail.load(std::memory_order_acquire);
+
+    const u64 n = std::min(num, tail_cache + max_entry_num - h);
+    for (u64 i = 0; i < n; ++i)
+      ring_buf[(h + i) & (max_entry_num - 1)].value = values[i];
+    if (n > 0)
+      head.store(h + n, std::memory_order_release);
+    return n;
   }
 
   inline void enqueue_blocking(const T &value)
   {
-    ASSERT(head >= tail);
-    while (head == tail + max_entry_num)
-      ;
-    u64 index = head & (max_entry_num - 1);
+    Backoff b;
+    while (!enqueue(value))
+      b.spin();
+  }
 
-    ring_buf[index].value = value;
-    __sync_fetch_and_add(&head, 1);
+  /*!
+    Consumer only
+   */
+  inline Option<T> dequeue()
+  {
+    T res;
+    if (dequeue_n(&res, 1) == 1)
+      return res;
+    return {};
   }
 
-  inline T dequeue_blocking()
+  /*!
+    Consumer only: dequeue at most num values to out,
+    return the number dequeued
+   */
+  inline u64 dequeue_n(T *out, u64 num)
   {
-    ASSERT(head >= tail);
-    while (head == tail)
-      ;
-    u64 index = tail & (max_entry_num - 1);
-
-    T ret = ring_buf[index].value;
-    __sync_fetch_and_add(&tail, 1);
-    return ret;
+    const u64 t = tail.load(std::memory_order_relaxed);
+    if (t + num > head_cache)
+      head_cache = head.load(std::memory_order_acquire);
+
+    const u64 n = std::min(num, head_cache - t);
+    for (u64 i = 0; i < n; ++i)
+      out[i] = ring_buf[(t + i) & (max_entry_num - 1)].value;
+    if (n > 0)
+      tail.store(t + n, std::memory_order_release);
+    return n;
   }
 
-  inline Option<T> dequeue()
+  inline T dequeue_blocking()
   {
-    ASSERT(head >= tail);
-    if (head == tail)
+    Backoff b;
+    while (true)
     {
-      return {};
-    }
-    else
-    {
-      u64 index = tail & (max_entry_num - 1);
-      auto res = Option<T>(ring_buf[index].value);
-      ::r2::compile_fence();
-      __sync_fetch_and_add(&tail, 1);
-      return res;
+      auto res = dequeue();
+      if (res)
+        return *res;
+      b.spin();
     }
   }
 
@@ -96,12 +138,16 @@ private:
     T value;
   } __attribute__((aligned(ENTRY_SIZE)));
 
-  // XD: why public?
-public:
-  volatile u64 __attribute__((aligned(kCacheLineSize))) head;
-  volatile u64 __attribute__((aligned(kCacheLineSize))) tail;
+  const u64 max_entry_num;
   Entry *ring_buf;
-  u64 max_entry_num;
+
+  // written by the producer
+  alignas(kCacheLineSize) std::atomic<u64> head;
+  u64 tail_cache;
+
+  // written by the consumer
+  alignas(kCacheLineSize) std::atomic<u64> tail;
+  u64 head_cache;
 } __attribute__((aligned(kCacheLineSize)));
 
 } // end namespace r2
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+#include "../common.hh"
+#include "./backoff.hh"
+
+namespace r2 {
+
+/*!
+  A bounded multi-producer/multi-consumer channel (Vyukov's array queue).
+  Each slot carries a sequence number, which tells whether the slot is free
+  for the producer of a turn, or filled for the consumer of the turn; so a
+  producer and a consumer only contend on the slot they both use, and the
+  producers (consumers) on the head (tail) with a CAS.
+
+  The batched calls claim a range of slots with one CAS, then fill (drain)
+  them; each slot is still published on its own sequence number, since the
+  consumers of the range may run in parallel.
+ */
+template <class T> class MPMCChannel {
+public:
+  explicit MPMCChannel(u64 max_entry_num = 1)
+      : max_entry_num(max_entry_num), head(0), tail(0) {
+    ASSERT(max_entry_num > 0 && !(max_entry_num & (max_entry_num - 1)));
+    ring_buf = static_cast<Entry *>(
+        ::aligned_alloc(kCacheLineSize, max_entry_num * sizeof(Entry)));
+    ASSERT(ring_buf != nullptr);
+    for (u64 i = 0; i < max_entry_num; ++i) {
+      new (&ring_buf[i]) Entry();
+      ring_buf[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MPMCChannel() {
+    for (u64 i = 0; i < max_entry_num; ++i)
+      ring_buf[i].~Entry();
+    free(ring_buf);
+  }
+
+  /*!
+    A hint, which may be stale once read
+   */
+  inline u64 size() const {
+    u64 h = head.load(std::memory_order_relaxed);
+    u64 t = tail.load(std::memory_order_relaxed);
+    return h > t ? h - t : 0;
+  }
+
+  inline bool isEmpty() const { return size() == 0; }
+
+  inline bool enqueue(const T &value) { return enqueue_n(&value, 1) == 1; }
+
+  /*!
+    Enqueue the first (at most) num values, return the number enqueued
+   */
+  u64 enqueue_n(const T *values, u64 num) {
+    u64 h = head.load(std::memory_order_relaxed);
+    u64 n = 0;
+    while (true) {
+      // the free slots in order from h
+      n = 0;
+      while (n < num && free_at(h + n))
+        n += 1;
+      if (n == 0) {
+        // full, unless someone has moved the head
+        const u64 cur = head.load(std::memory_order_relaxed);
+        if (cur == h)
+          return 0;
+        h = cur;
+        continue;
+      }
+      if (head.compare_exchange_weak(h, h + n, std::memory_order_relaxed,
+                                     std::memory_order_relaxed))
+        break;
+    }
+    for (u64 i = 0; i < n; ++i) {
+      auto &e = ring_buf[(h + i) & (max_entry_num - 1)];
+      e.value = values[i];
+      e.seq.store(h + i + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  inline void enqueue_blocking(const T &value) {
+    Backoff b;
+    while (!enqueue(value))
+      b.spin();
+  }
+
+  inline Option<T> dequeue() {
+    T res;
+    if (dequeue_n(&res, 1) == 1)
+      return res;
+    return {};
+  }
+
+  /*!
+    Dequeue at most num values to out, return the number dequeued
+   */
+  u64 dequeue_n(T *out, u64 num) {
+    u64 t = tail.load(std::memory_order_relaxed);
+    u64 n = 0;
+    while (true) {
+      n = 0;
+      while (n < num && filled_at(t + n))
+        n += 1;
+      if (n == 0) {
+        const u64 cur = tail.load(std::memory_order_relaxed);
+        if (cur == t)
+          return 0;
+        t = cur;
+        continue;
+      }
+      if (tail.compare_exchange_weak(t, t + n, std::memory_order_relaxed,
+                                     std::memory_order_relaxed))
+        break;
+    }
+    for (u64 i = 0; i < n; ++i) {
+      auto &e = ring_buf[(t + i) & (max_entry_num - 1)];
+      out[i] = e.value;
+      e.seq.store(t + i + max_entry_num, std::memory_order_release);
+    }
+    return n;
+  }
+
+  inline T dequeue_blocking() {
+    Backoff b;
+    while (true) {
+      auto res = dequeue();
+      if (res)
+        return *res;
+      b.spin();
+    }
+  }
+
+private:
+  struct Entry {
+    std::atomic<u64> seq;
+    T value;
+  } __attribute__((aligned(kCacheLineSize)));
+
+  // the slot of turn pos is free for its producer
+  inline bool free_at(u64 pos) const {
+    return ring_buf[pos & (max_entry_num - 1)].seq.load(
+               std::memory_order_acquire) == pos;
+  }
+
+  // the slot of turn pos is filled for its consumer
+  inline bool filled_at(u64 pos) const {
+    return ring_buf[pos & (max_entry_num - 1)].seq.load(
+               std::memory_order_acquire) == pos + 1;
+  }
+
+  const u64 max_entry_num;
+  Entry *ring_buf;
+
+  alignas(kCacheLineSize) std::atomic<u64> head;
+  alignas(kCacheLineSize) std::atomic<u64> tail;
+
+  DISABLE_COPY_AND_ASSIGN(MPMCChannel);
+} __attribute__((aligned(kCacheLineSize)));
+
+} // namespace r2
@@ -0,0 +1,412 @@
+#include "rlib/rdma_ctrl.hpp"
+
+#include "krcore_msg.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace rdmaio;
+
+namespace r2
+{
+
+// mr hint of the send region at each queue
+const u32 send_mr_hint = 1;
+const usize page_sz = 4096;
+
+static Result<std::string>
+to_result(int status)
+{
+  switch (status)
+  {
+  case ::ok:
+    return SUCC;
+  case ::not_connected:
+    return NOT_CONNECT;
+  default:
+    return ERR;
+  }
+}
+
+KrcoreAdapter::KrcoreAdapter(const Addr &my_addr, int port, u32 vid, usize msg_sz)
+    : my_addr(my_addr), port_(port), vid_(vid), msg_sz_(msg_sz), reply_(new pop_reply_t),
+      comp_(new pop_reply_t)
+{
+  // a slot never crosses a page, so that it is physically contiguous
+  ASSERT(msg_sz_ > sizeof(KrcoreMsgHeader) && msg_sz_ <= kMaxMsgSz &&
+         (msg_sz_ & (msg_sz_ - 1)) == 0)
+      << "invalid msg size " << msg_sz_;
+
+  send_buf_ = (char *)aligned_alloc(page_sz, kSendSlots * msg_sz_);
+  payloads_ = (char *)malloc(kRecvBatch * msg_sz_);
+  // the lowest slot is taken first
+  for (usize i = kSendSlots; i > 0; --i)
+    free_slots_.push_back(i - 1);
+
+  int qd = open_queue();
+  if (qd < 0)
+    return;
+  auto ret = qbind(qd, port_);
+  if (ret != ::ok)
+  {
+    LOG(4) << "bind krcore port " << port_ << " error: " << ret;
+    close(qd);
+    return;
+  }
+  bound_qd_ = qd;
+  queues_.push_back(qd);
+  states_[qd];
+}
+
+KrcoreAdapter::~KrcoreAdapter()
+{
+  flush_pending();
+  for (auto qd : queues_)
+  {
+    drain(qd);
+    if (qd == bound_qd_)
+      qunbind(qd, port_);
+    close(qd);
+  }
+  free(send_buf_);
+  free(payloads_);
+}
+
+int KrcoreAdapter::open_queue()
+{
+  int qd = queue();
+  if (qd < 0)
+  {
+    LOG(4) << "open krcore queue error, is the kernel module loaded?";
+    return -1;
+  }
+  auto ret = qreg_mr(qd, (unsigned long long)send_buf_, kSendSlots * msg_sz_, send_mr_hint);
+  if (ret != ::ok)
+  {
+    LOG(4) << "register the send region error: " << ret;
+    close(qd);
+    return -1;
+  }
+  return qd;
+}
+
+void KrcoreAdapter::add_host(u32 mac_id, const std::string &gid)
+{
+  gids_[mac_id] = gid;
+}
+
+Result<std::string>
+KrcoreAdapter::connect(const Addr &addr, const rdmaio::MacID &, int opt)
+{
+  // check if we already connected
+  auto it = routes_.find(addr.to_u32());
+  if (it != routes_.end() && it->second.qd != bound_qd_)
+    return SUCC;
+
+  auto gid = gids_.find(addr.mac_id);
+  if (gid == gids_.end())
+  {
+    LOG(4) << "no gid for mac " << addr.mac_id;
+    return ERR;
+  }
+
+  int qd = open_queue();
+  if (qd < 0)
+    return ERR;
+  int port = opt != 0 ? opt : port_;
+  auto ret = qconnect(qd, gid->second.c_str(), gid->second.size(), port, vid_);
+  if (ret == ::ok || ret == ::already_connected)
+    ret = qpush_recv(qd, kRecvDepth);
+  if (ret != ::ok)
+  {
+    close(qd);
+    return to_result(ret);
+  }
+
+  queues_.push_back(qd);
+  states_[qd];
+  routes_[addr.to_u32()] = {.qd = qd, .vid = vid_};
+  return SUCC;
+}
+
+Result<std::string>
+KrcoreAdapter::send_async(const Addr &addr, const char *msg, int size)
+{
+  if (unlikely(size < 0 || (usize)size + sizeof(KrcoreMsgHeader) > msg_sz_))
+    return ERR;
+
+  const auto &it = routes_.find(addr.to_u32());
+  if (unlikely(it == routes_.end()))
+    return NOT_CONNECT;
+  const auto &route = it->second;
+
+  if (pending_ == kMaxPending)
+  {
+    auto ret = flush_pending();
+    if (ret != SUCC)
+      return ret;
+  }
+  if (unlikely(free_slots_.empty()))
+  {
+    auto ret = wait_slot();
+    if (ret != SUCC)
+      return ret;
+  }
+
+  u32 idx = free_slots_.back();
+  free_slots_.pop_back();
+  char *slot = send_buf_ + idx * msg_sz_;
+  pending_ += 1;
+  auto header = (KrcoreMsgHeader *)slot;
+  header->from = my_addr.to_u32();
+  header->size = size;
+  memcpy(slot + sizeof(KrcoreMsgHeader), msg, size);
+
+  core_req_t req = {};
+  req.addr = (unsigned long long)slot;
+  req.length = sizeof(KrcoreMsgHeader) + size;
+  req.lkey = send_mr_hint;
+  req.send_flags = req_user_buf;
+  req.vid = route.vid;
+  req.type = SendImm;
+  req.cookie = 0;
+  auto &state = states_[route.qd];
+  state.pending.push_back(req);
+  state.pending_slots.push_back(idx);
+  return SUCC;
+}
+
+Result<std::string>
+KrcoreAdapter::flush_pending()
+{
+  if (pending_ == 0)
+    return SUCC;
+
+  int status = ::ok;
+  for (auto qd : queues_)
+  {
+    auto &state = states_[qd];
+    if (state.pending.empty())
+      continue;
+    // the last message to each vid is signaled, its completion frees the slots of the vid
+    std::unordered_map<u32, Inflight> pushed;
+    for (usize i = state.pending.size(); i > 0; --i)
+    {
+      auto &req = state.pending[i - 1];
+      auto &batch = pushed[req.vid];
+      if (batch.slots.empty())
+      {
+        batch.id = next_batch_++;
+        req.send_flags |= req_signaled;
+        req.cookie = batch.id;
+      }
+      batch.slots.push_back(state.pending_slots[i - 1]);
+    }
+    push_core_req_t push = {.req_len = (unsigned int)state.pending.size(),
+                            .req_list = state.pending.data()};
+    // never wait for the completions, which are reaped in poll_all
+    auto ret = qpush(qd, &push, 0, state.idle_recvs);
+    if (ret == ::ok)
+    {
+      state.idle_recvs = 0;
+      for (auto &batch : pushed)
+        state.inflight[batch.first].push_back(std::move(batch.second));
+    }
+    else
+    {
+      status = ret;
+      // nothing to complete
+      free_slots_.insert(free_slots_.end(), state.pending_slots.begin(),
+                         state.pending_slots.end());
+    }
+    state.pending.clear();
+    state.pending_slots.clear();
+  }
+  pending_ = 0;
+  return to_result(status);
+}
+
+void KrcoreAdapter::reap(int qd)
+{
+  for (auto &it : states_[qd].inflight)
+  {
+    auto &batches = it.second;
+    while (!batches.empty() && qpop(qd, comp_.get(), it.first) == ::ok)
+    {
+      const auto &wc = comp_->wc[0];
+      if (wc.wc_status != 0)
+        LOG(4) << "krcore send to vid " << it.first << " error wc status " << wc.wc_status;
+      // the earlier pushes to the vid have completed as well
+      while (!batches.empty() && batches.front().id <= wc.wc_wr_id)
+      {
+        auto &slots = batches.front().slots;
+        free_slots_.insert(free_slots_.end(), slots.begin(), slots.end());
+        batches.pop_front();
+      }
+    }
+  }
+}
+
+Result<std::string>
+KrcoreAdapter::wait_slot()
+{
+  // the pending messages hold slots as well
+  auto ret = flush_pending();
+  if (ret != SUCC)
+    return ret;
+  for (usize i = 0; free_slots_.empty() && i < kMaxReapSpins; ++i)
+  {
+    for (auto qd : queues_)
+      reap(qd);
+  }
+  return free_slots_.empty() ? TIMEOUT : SUCC;
+}
+
+void KrcoreAdapter::drain(int qd)
+{
+  auto &state = states_[qd];
+  auto busy = [&state]() {
+    for (auto &it : state.inflight)
+    {
+      if (!it.second.empty())
+        return true;
+    }
+    return false;
+  };
+  for (usize i = 0; busy() && i < kMaxReapSpins; ++i)
+    reap(qd);
+  if (busy())
+    LOG(2) << "krcore queue " << qd << " closed with sends in flight";
+}
+
+usize KrcoreAdapter::pop_queue(int qd)
+{
+  auto ret = qpop_msgs(qd, reply_.get(), kRecvBatch, msg_sz_, payloads_);
+  if (ret != ::ok)
+    return 0;
+  usize count = reply_->pop_count;
+  // the bound queue reposts its receives with the replies
+  if (qd != bound_qd_)
+    states_[qd].idle_recvs += count;
+  return count;
+}
+
+IncomingMsg KrcoreAdapter::take_msg(int qd, usize i)
+{
+  const auto &wc = reply_->wc[i];
+  ASSERT(wc.wc_status == 0) << "error wc status " << wc.wc_status;
+
+  auto header = (KrcoreMsgHeader *)(payloads_ + i * msg_sz_);
+  Addr from;
+  from.from_u32(header->from);
+  // a peer which connected to us is replied on the bound queue with its vid
+  if (qd == bound_qd_ && routes_.find(header->from) == routes_.end())
+    routes_[header->from] = {.qd = bound_qd_, .vid = wc.imm_data};
+
+  return {.msg = payloads_ + i * msg_sz_ + sizeof(KrcoreMsgHeader),
+          .size = (int)header->size,
+          .from = from};
+}
+
+int KrcoreAdapter::poll_all(const MsgProtocol::msg_callback_t &f)
+{
+  int total = 0;
+  for (usize q = 0; q < queues_.size(); ++q)
+  {
+    int qd = queues_[q];
+    usize count = pop_queue(qd);
+    for (usize i = 0; i < count; ++i)
+    {
+      auto msg = take_msg(qd, i);
+      f(msg.msg, msg.size, msg.from);
+    }
+    total += count;
+  }
+  flush_pending();
+  for (auto qd : queues_)
+    reap(qd);
+
+  // refill the connected queues which have nothing to push
+  for (auto qd : queues_)
+  {
+    auto &state = states_[qd];
+    if (state.idle_recvs > kRecvDepth / 2 && qpush_recv(qd, state.idle_recvs) == ::ok)
+      state.idle_recvs = 0;
+  }
+  return total;
+}
+
+Iter_p_t KrcoreAdapter::get_iter()
+{
+  return Iter_p_t(new KrcoreIncomingIter(this));
+}
+
+Buf_t KrcoreAdapter::get_my_conninfo()
+{
+  KrcoreConnInfo info = {.vid = vid_, .port = (u32)port_};
+  return Marshal::serialize_to_buf(info);
+}
+
+Result<std::string>
+KrcoreAdapter::connect_from_incoming(const Addr &addr, const Buf_t &connect_info)
+{
+  KrcoreConnInfo info;
+  if (!Marshal::deserialize(connect_info, info))
+    return ERR;
+  // a connected route of our own is kept
+  auto it = routes_.find(addr.to_u32());
+  if (it == routes_.end() || it->second.qd == bound_qd_)
+    routes_[addr.to_u32()] = {.qd = bound_qd_, .vid = info.vid};
+  return SUCC;
+}
+
+void KrcoreAdapter::disconnect(const Addr &addr)
+{
+  auto it = routes_.find(addr.to_u32());
+  if (it == routes_.end())
+    return;
+  int qd = it->second.qd;
+  routes_.erase(it);
+  if (qd == bound_qd_)
+    return;
+
+  // the pending messages to the peer are sent before closing
+  flush_pending();
+  drain(qd);
+  for (auto q = queues_.begin(); q != queues_.end(); ++q)
+  {
+    if (*q == qd)
+    {
+      queues_.erase(q);
+      break;
+    }
+  }
+  // the QP goes away with the queue, so the slots still in flight are free once it is closed
+  close(qd);
+  for (auto &it : states_[qd].inflight)
+  {
+    for (auto &batch : it.second)
+      free_slots_.insert(free_slots_.end(), batch.slots.begin(), batch.slots.end());
+  }
+  states_.erase(qd);
+}
+
+bool KrcoreIncomingIter::has_next()
+{
+  while (cur_ == count_)
+  {
+    if (queue_idx_ == adapter_->queues_.size())
+      return false;
+    cur_ = 0;
+    count_ = adapter_->pop_queue(adapter_->queues_[queue_idx_++]);
+  }
+  return true;
+}
+
+IncomingMsg KrcoreIncomingIter::next()
+{
+  ASSERT(has_next());
+  return adapter_->take_msg(adapter_->queues_[queue_idx_ - 1], cur_++);
+}
+
+} // end namespace r2
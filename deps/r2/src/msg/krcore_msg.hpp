@@ -0,0 +1,203 @@
+#pragma once
+
+#include "protocol.hpp"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../../../include/syscall.h"
+
+namespace r2
+{
+
+/*!
+  A MsgProtocol over the kernel managed queues of KRCORE (include/syscall.h),
+  so that the RPC services run on the connections of the kernel instead of the
+  QPs created in the user space.
+
+  Each adapter binds a queue at `port` (qbind), where the messages of the peers
+  arrive. The messages to a peer connected by `connect` go through a queue of its
+  own, connected to the peer's bound port (qconnect) with the `vid` of this adapter;
+  the peer replies on its bound queue with that vid. The immediate of the kernel
+  sends is taken by the vid, so each message carries a header with the sender's Addr.
+
+  The messages are copied into the slots of a region registered to each queue (qreg_mr)
+  and pushed from there with `req_user_buf`, one qpush per queue in flush_pending, which
+  never waits. Only the last message of a push to each vid is signaled: a vid is one QP,
+  which completes in order, so its completion frees the slots of all of them. The
+  completions are reaped in poll_all, or once the slots run out.
+  The received messages are copied out of the kernel receive buffers by qpop_msgs.
+ */
+struct KrcoreMsgHeader
+{
+  u32 from; // Addr of the sender
+  u32 size; // payload size
+};
+
+struct KrcoreConnInfo
+{
+  u32 vid;
+  u32 port;
+};
+
+class KrcoreIncomingIter;
+class KrcoreAdapter : public MsgProtocol
+{
+  friend class KrcoreIncomingIter;
+
+public:
+  // the kernel receive buffer is 2048 bytes per message
+  static const usize kMaxMsgSz = 2048;
+  // messages pushed between two flush_pending
+  static const usize kMaxPending = 64;
+  // slots of the send region, held by the pending and the in-flight messages
+  static const usize kSendSlots = 4 * kMaxPending;
+  // reaps to wait for a free slot, or for the in-flight messages of a closing queue
+  static const usize kMaxReapSpins = 1 << 20;
+  // messages popped from one queue per qpop_msgs
+  static const usize kRecvBatch = 64;
+  // receives posted to a connected queue
+  static const usize kRecvDepth = 256;
+
+  /*!
+    \param port: the port to bind, where the peers connect
+    \param vid: the identifier of this adapter at the peers, unique among their clients
+    \param msg_sz: max message size including the header, a power of two
+   */
+  KrcoreAdapter(const Addr &my_addr, int port, u32 vid, usize msg_sz = 1024);
+
+  ~KrcoreAdapter();
+
+  /*!
+    Record the gid of the NIC of `mac_id`, in the format of `ibstatus`,
+    e.g., fe80:0000:0000:0000:ec0d:9a03:00ca:2f4c
+   */
+  void add_host(u32 mac_id, const std::string &gid);
+
+  /*!
+    Connect to the adapter bound at port `opt` (or at the port of this adapter if 0)
+    on the host of `addr`.
+   */
+  Result<std::string> connect(const Addr &addr,
+                              const rdmaio::MacID &id,
+                              int opt) override;
+
+  Result<std::string> send_async(const Addr &addr,
+                                 const char *msg,
+                                 int size) override;
+
+  Result<std::string> flush_pending() override;
+
+  int poll_all(const MsgProtocol::msg_callback_t &f) override;
+
+  Iter_p_t get_iter() override;
+
+  /*!
+    Below methods handle connect related works.
+  */
+  rdmaio::Buf_t get_my_conninfo() override;
+
+  Result<std::string> connect_from_incoming(const Addr &addr,
+                                            const rdmaio::Buf_t &connect_info) override;
+
+  void disconnect(const Addr &addr) override;
+
+  bool valid() const { return bound_qd_ >= 0; }
+
+public:
+  const Addr my_addr;
+
+private:
+  // the queue and the vid to send to a peer
+  struct Route
+  {
+    int qd;
+    u32 vid;
+  };
+
+  // the slots of the messages pushed to one vid, freed by the completion of `id`
+  struct Inflight
+  {
+    u64 id;
+    std::vector<u32> slots;
+  };
+
+  // per queue
+  struct QueueState
+  {
+    std::vector<core_req_t> pending;
+    // the send slot of each pending message
+    std::vector<u32> pending_slots;
+    // per vid, in the order of the pushes
+    std::unordered_map<u32, std::deque<Inflight>> inflight;
+    // receives consumed since the last refill, only for the connected queues
+    usize idle_recvs = 0;
+  };
+
+  int open_queue();
+
+  /*!
+    Pop at most kRecvBatch messages of `qd` into payloads_,
+    return the number of the popped messages.
+   */
+  usize pop_queue(int qd);
+
+  // the i-th message of the last pop_queue, from a peer which is learned on the bound queue
+  IncomingMsg take_msg(int qd, usize i);
+
+  // free the slots of the completed pushes of `qd`
+  void reap(int qd);
+
+  // flush the pending messages, and reap until a send slot is free
+  Result<std::string> wait_slot();
+
+  // reap `qd` until nothing is in flight, or kMaxReapSpins
+  void drain(int qd);
+
+  const int port_;
+  const u32 vid_;
+  const usize msg_sz_;
+
+  int bound_qd_ = -1;
+  // the bound queue first, then the connected ones
+  std::vector<int> queues_;
+  std::unordered_map<int, QueueState> states_;
+  std::unordered_map<Addr_id_t, Route> routes_;
+  std::unordered_map<u32, std::string> gids_;
+
+  // kSendSlots slots of msg_sz_, registered to each queue
+  char *send_buf_ = nullptr;
+  std::vector<u32> free_slots_;
+  usize pending_ = 0;
+  // the cookie of the next signaled message
+  u64 next_batch_ = 1;
+
+  std::unique_ptr<pop_reply_t> reply_;
+  // the send completions, apart from the messages of reply_ being iterated
+  std::unique_ptr<pop_reply_t> comp_;
+  char *payloads_ = nullptr;
+
+  DISABLE_COPY_AND_ASSIGN(KrcoreAdapter);
+}; // end class KrcoreAdapter
+
+class KrcoreIncomingIter : public IncomingIter
+{
+public:
+  explicit KrcoreIncomingIter(KrcoreAdapter *adapter) : adapter_(adapter) {}
+
+  IncomingMsg next() override;
+
+  bool has_next() override;
+
+private:
+  KrcoreAdapter *adapter_;
+  // the queue being iterated, and its popped messages
+  usize queue_idx_ = 0;
+  usize cur_ = 0;
+  usize count_ = 0;
+};
+
+} // end namespace r2
@@ -0,0 +1,167 @@
+#include <sched.h>
+
+#include "./mshed.hh"
+
+namespace r2 {
+
+// (the scheduler, the core) of the calling thread
+static thread_local MScheduler *cur_sched = nullptr;
+static thread_local int cur_core_id = -1;
+
+MScheduler::MScheduler(usize num, usize coroutines_per_core, bool pin)
+    : coroutines_per_core(coroutines_per_core), pin(pin), injected_num(0),
+      running(false) {
+  ASSERT(num > 0 && coroutines_per_core > 0);
+  for (usize i = 0; i < num; ++i)
+    cores.emplace_back(new Core(i));
+}
+
+MScheduler::~MScheduler() {
+  stop();
+
+  // drop the tasks never started
+  for (auto &c : cores) {
+    while (auto t = c->tasks.take())
+      delete t;
+    for (auto t : c->affine)
+      delete t;
+  }
+  for (auto t : injected)
+    delete t;
+}
+
+int MScheduler::cur_core() { return cur_core_id; }
+
+void MScheduler::start() {
+  running = true;
+  for (usize i = 0; i < cores.size(); ++i) {
+    threads.emplace_back(new Thread<int>([this, i]() -> int {
+      this->run_core(i);
+      return 0;
+    }));
+    threads.back()->start();
+  }
+}
+
+void MScheduler::stop() {
+  running = false;
+  for (auto &t : threads)
+    t->join();
+  threads.clear();
+}
+
+void MScheduler::spawn(const task_func_t &f) {
+  auto t = new task_func_t(f);
+  if (cur_sched == this) {
+    cores[cur_core_id]->tasks.push(t);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(inject_lock);
+  injected.push_back(t);
+  injected_num.fetch_add(1, std::memory_order_release);
+}
+
+void MScheduler::spawn_on(const usize &core, const task_func_t &f) {
+  auto &c = *cores.at(core);
+  auto t = new task_func_t(f);
+  std::lock_guard<std::mutex> guard(c.affine_lock);
+  c.affine.push_back(t);
+  c.affine_num.fetch_add(1, std::memory_order_release);
+}
+
+MScheduler::task_func_t *MScheduler::take_affine(Core &c) {
+  if (c.affine_num.load(std::memory_order_acquire) == 0)
+    return nullptr;
+  std::lock_guard<std::mutex> guard(c.affine_lock);
+  if (c.affine.empty())
+    return nullptr;
+  auto t = c.affine.front();
+  c.affine.pop_front();
+  c.affine_num.fetch_sub(1, std::memory_order_relaxed);
+  return t;
+}
+
+MScheduler::task_func_t *MScheduler::take_injected() {
+  if (injected_num.load(std::memory_order_acquire) == 0)
+    return nullptr;
+  std::lock_guard<std::mutex> guard(inject_lock);
+  if (injected.empty())
+    return nullptr;
+  auto t = injected.front();
+  injected.pop_front();
+  injected_num.fetch_sub(1, std::memory_order_relaxed);
+  return t;
+}
+
+/*!
+  The pinned tasks first, then the own deque, the shared queue,
+  and at last one steal attempt from each other core, starting at a random one
+ */
+MScheduler::task_func_t *MScheduler::next_task(const usize &id) {
+  auto &c = *cores[id];
+  if (auto t = take_affine(c))
+    return t;
+  if (auto t = c.tasks.take())
+    return t;
+  if (auto t = take_injected())
+    return t;
+
+  const usize n = cores.size();
+  if (n == 1)
+    return nullptr;
+  // xorshift
+  c.seed ^= c.seed << 13;
+  c.seed ^= c.seed >> 7;
+  c.seed ^= c.seed << 17;
+  usize victim = c.seed % n;
+  for (usize i = 0; i < n; ++i, victim = (victim + 1) % n) {
+    if (victim == id)
+      continue;
+    if (auto t = cores[victim]->tasks.steal()) {
+      c.stolen.fetch_add(1, std::memory_order_relaxed);
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+void MScheduler::run_core(const usize &id) {
+  cur_sched = this;
+  cur_core_id = static_cast<int>(id);
+
+  if (pin) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(id % CPU_SETSIZE, &set);
+    // best effort, e.g., fewer CPUs than the cores
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  auto &c = *cores[id];
+  usize alive = coroutines_per_core;
+  SScheduler ssched;
+  for (usize i = 0; i < coroutines_per_core; ++i) {
+    ssched.spawn([this, id, &c, &alive](R2_ASYNC) {
+      while (running.load(std::memory_order_relaxed)) {
+        auto t = next_task(id);
+        if (t == nullptr) {
+          R2_YIELD;
+          continue;
+        }
+        (*t)(R2_ASYNC_WAIT);
+        delete t;
+        c.executed.fetch_add(1, std::memory_order_relaxed);
+      }
+      alive -= 1;
+      if (alive == 0)
+        R2_STOP();
+      R2_RET;
+    });
+  }
+  ssched.run();
+
+  cur_sched = nullptr;
+  cur_core_id = -1;
+}
+
+} // namespace r2
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "./libroutine.hh"
+#include "./thread.hh"
+#include "./ws_deque.hh"
+
+namespace r2 {
+
+/*!
+  MScheduler is a **multi-threaded** executor of R2 routines: one SScheduler
+  per core (thread), each running `coroutines_per_core` coroutines which take
+  the spawned tasks and run them one after another.
+  An example usage is:
+  `
+    MScheduler m(4);
+    m.start();
+    for (int i = 0; i < 1024; ++i)
+      m.spawn([](R2_ASYNC) {
+        ... // R2_YIELD, R2_WAIT_NUM, ... as in a SScheduler routine
+      });   // a task simply returns, instead of R2_RET
+    ...
+    m.stop();
+  `
+  Each core keeps its tasks in a work-stealing deque: the owner takes the
+  latest spawned one, and an idle core steals the oldest one of a random
+  victim, so a skewed load is spread over all the cores.
+  A task which has started never moves, since its waits are served by the
+  pollers of its core (SScheduler::shared_poller). So a task using a QP owned
+  by a core is spawned there with `spawn_on`, which is never stolen, and the
+  CQ of the QP is only polled on that core.
+ */
+class MScheduler {
+public:
+  using task_func_t = std::function<void(R2_ASYNC)>;
+
+  /*!
+    \param pin: bind the thread of core i to CPU i
+   */
+  explicit MScheduler(usize cores, usize coroutines_per_core = 8,
+                      bool pin = true);
+
+  ~MScheduler();
+
+  void start();
+
+  /*!
+    Stop the cores once their running tasks return, and wait for them.
+    The tasks not started are dropped.
+   */
+  void stop();
+
+  /*!
+    Spawn a task to the deque of the calling core, or to a shared queue
+    if called outside the cores.
+   */
+  void spawn(const task_func_t &f);
+
+  /*!
+    Spawn a task which must run on `core`
+   */
+  void spawn_on(const usize &core, const task_func_t &f);
+
+  usize num_cores() const { return cores.size(); }
+
+  /*!
+    The core of the calling thread, -1 if it is not a core of any MScheduler
+   */
+  static int cur_core();
+
+  /*!
+    Tasks executed, and stolen by `core`
+   */
+  u64 executed(const usize &core) const {
+    return cores.at(core)->executed.load(std::memory_order_relaxed);
+  }
+
+  u64 stolen(const usize &core) const {
+    return cores.at(core)->stolen.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct alignas(kCacheLineSize) Core {
+    WSDeque<task_func_t> tasks;
+
+    // the tasks pinned to this core, pushed by any thread
+    std::mutex affine_lock;
+    std::deque<task_func_t *> affine;
+    std::atomic<usize> affine_num;
+
+    std::atomic<u64> executed;
+    std::atomic<u64> stolen;
+
+    // the state of the random victim selection
+    u64 seed;
+
+    explicit Core(usize id)
+        : affine_num(0), executed(0), stolen(0), seed(id * 2654435761ULL + 1) {}
+  };
+
+  void run_core(const usize &id);
+
+  task_func_t *next_task(const usize &id);
+
+  task_func_t *take_affine(Core &c);
+
+  task_func_t *take_injected();
+
+  const usize coroutines_per_core;
+  const bool pin;
+
+  std::vector<std::unique_ptr<Core>> cores;
+  std::vector<std::unique_ptr<Thread<int>>> threads;
+
+  // the tasks spawned outside the cores
+  std::mutex inject_lock;
+  std::deque<task_func_t *> injected;
+  std::atomic<usize> injected_num;
+
+  std::atomic<bool> running;
+
+  DISABLE_COPY_AND_ASSIGN(MScheduler);
+};
+
+} // namespace r2
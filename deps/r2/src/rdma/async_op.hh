@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../libroutine.hh"
+#include "./rc_poller.hh"
 #include "rlib/core/qps/op.hh"
 
 namespace r2 {
@@ -35,38 +36,10 @@ struct AsyncOp : Op<NSGE> {
   }
 
   inline auto wait_one(const Arc<RC> &qp, R2_ASYNC) -> Result<ibv_wc> {
-    // to avoid performance overhead of Arc, we first extract QP's raw pointer
-    // out
-    RC *qp_ptr = ({  // unsafe code
-      RC *temp = qp.get();
-      temp;
-    });
-
     ibv_wc wc;
-    auto id = R2_COR_ID();
-
-    poll_func_t poll_future =
-        [qp_ptr, id]() -> Result<std::pair<::r2::Routine::id_t, usize>> {
-      auto wr_wc = qp_ptr->poll_rc_comp();
-      if (wr_wc) {
-        ::r2::Routine::id_t polled_cid =
-            static_cast<::r2::Routine::id_t>(std::get<0>(wr_wc.value()));
-        // wc = std::get<1>(wr_wc.value());
-        auto wc = std::get<1>(wr_wc.value());
-
-        if (wc.status == IBV_WC_SUCCESS) {
-          auto ret = std::make_pair(polled_cid, 1u);
-          return ::rdmaio::Ok(ret);
-        } else {
-          return ::rdmaio::Err(std::make_pair<::r2::Routine::id_t>(id, 1u));
-        }
-      }
-      // we still need to poll this future
-      return NotReady(std::make_pair<::r2::Routine::id_t>(0u, 0u));
-    };
-
-    // end spawning future
-    auto ret = R2_PAUSE_WAIT(poll_future, 1);
+    // the CQ is polled once per round for all the coroutines waiting on it
+    R2_EXECUTOR.shared_poller<RCPoller>(qp);
+    auto ret = R2_WAIT_NUM(1);
     return ::rdmaio::transfer(ret, wc);
   }
 };  // namespace rdma
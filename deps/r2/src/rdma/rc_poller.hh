@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+
+#include "rlib/core/qps/rc.hh"
+
+#include "../libroutine.hh"
+
+namespace r2 {
+
+namespace rdma {
+
+/*!
+  The poller of the CQ of an RC, shared by all the coroutines waiting on it.
+  Each completion carries the id of its coroutine in the wr_id (see
+  RC::encode_my_wr), so one poll reports the requests of all of them.
+  The RC is not kept alive by its poller, which is dropped once the RC is freed.
+ */
+class RCPoller : public Poller {
+  std::weak_ptr<::rdmaio::qp::RC> qp;
+
+public:
+  explicit RCPoller(const std::shared_ptr<::rdmaio::qp::RC> &qp) : qp(qp) {}
+
+  bool expired() const override { return qp.expired(); }
+
+  void poll(SScheduler &s) override {
+    auto rc = qp.lock();
+    if (unlikely(!rc))
+      return;
+    for (auto wr_wc = rc->poll_rc_comp(); wr_wc; wr_wc = rc->poll_rc_comp()) {
+      auto cid = static_cast<::r2::Routine::id_t>(std::get<0>(wr_wc.value()));
+      if (std::get<1>(wr_wc.value()).status == IBV_WC_SUCCESS)
+        s.complete(cid, 1);
+      else
+        s.fail(cid);
+    }
+  }
+};
+
+} // namespace rdma
+
+} // namespace r2
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "./common.hh"
+
+namespace r2 {
+
+/*!
+  A FIFO of ids in a power-of-two array, which doubles when it is full.
+  The scheduler keeps its runnable coroutines here instead of a linked list of
+  heap nodes, so a switch touches one contiguous array.
+ */
+template <typename T> class ReadyRing {
+public:
+  explicit ReadyRing(usize capacity = 64) : buf(round_up(capacity)) {}
+
+  bool empty() const { return head == tail; }
+
+  usize size() const { return static_cast<usize>(tail - head); }
+
+  usize capacity() const { return buf.size(); }
+
+  inline void push(const T &v) {
+    if (unlikely(size() == buf.size()))
+      grow();
+    buf[tail & (buf.size() - 1)] = v;
+    tail += 1;
+  }
+
+  /*!
+    \note: the ring must not be empty
+   */
+  inline T pop() {
+    auto res = buf[head & (buf.size() - 1)];
+    head += 1;
+    return res;
+  }
+
+private:
+  static usize round_up(usize n) {
+    usize res = 1;
+    while (res < n)
+      res <<= 1;
+    return res;
+  }
+
+  void grow() {
+    std::vector<T> temp(buf.size() * 2);
+    for (usize i = 0; i < size(); ++i)
+      temp[i] = buf[(head + i) & (buf.size() - 1)];
+    tail = size();
+    head = 0;
+    buf.swap(temp);
+  }
+
+  std::vector<T> buf;
+  u64 head = 0;
+  u64 tail = 0;
+};
+
+} // namespace r2
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+
+#include "../libroutine.hh"
+
+namespace r2 {
+
+namespace ring_msg {
+
+/*!
+  Flush the coalesced messages of a session once per scheduling round.
+  Register it by the coroutines sending with Session::send_coalesced:
+  `
+    R2_EXECUTOR.shared_poller<CoalesceFlusher<Session<R, kRingSz, kMaxMsg>>>(
+        session); // the Arc of the session
+  `
+  so the messages queued by all of them within a round go in one write.
+  The flusher only keeps a weak_ptr to the session, and is dropped by the
+  scheduler once the session is freed.
+ */
+template <class S> class CoalesceFlusher : public Poller {
+  std::weak_ptr<S> session;
+
+public:
+  explicit CoalesceFlusher(const std::shared_ptr<S> &s) : session(s) {}
+
+  bool expired() const override { return session.expired(); }
+
+  void poll(SScheduler &) override {
+    auto s = session.lock();
+    if (unlikely(!s))
+      return;
+    // a full remote ring keeps them queued, retried in the next round
+    s->flush_coalesced();
+  }
+};
+
+} // namespace ring_msg
+
+} // namespace r2
@@ -9,6 +9,14 @@ namespace ring_msg {
 using id_t = u16;
 using sz_t = u16;
 
+/*!
+  A coalesced write packs several messages, each prefixed with its
+  frame_len_t size; its imm sz is the total size with kBatchFlag set.
+  So only rings whose kMaxMsg < kBatchFlag support coalescing.
+ */
+using frame_len_t = u16;
+constexpr sz_t kBatchFlag = 1u << 15;
+
 class IDEncoder {
 public:
   static u32 encode_id_sz(const id_t &id, const sz_t &sz) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./cm.hh"
+#include "./flusher.hh"
 #include "./receiver.hh"
 #include "./session.hh"
 
@@ -40,6 +41,12 @@ namespace ring_msg {
   ASSERT(rs.connect(cm) == IOCode::Ok);
 
   // we need a bootstrap message, or whatever
+
+  // optionally, pack the small messages sent within a round into one write
+  rs.enable_coalescing(staging); // staging: registered, >= kMaxMsg
+  rs.send_coalesced(msg);
+  ...
+  rs.flush_coalesced();          // or by a CoalesceFlusher (./flusher.hh)
   `
  */
 
@@ -68,6 +75,11 @@ template <usize R, usize kRingSz, usize kMaxMsg> class RingRecvIter {
 
   usize msg_sz = 0;
 
+  // the coalesced message being unpacked; batch_sz is 0 if there is none
+  MemBlock batch;
+  usize batch_sz = 0;
+  usize batch_off = 0;
+
 public:
   RingRecvIter(Arc<Receiver<R, kRingSz, kMaxMsg>> r)
       : receiver(r),
@@ -81,6 +93,11 @@ public:
   }
 
   inline void begin() {
+    // the rest of a coalesced message is dropped, but its space is returned
+    if (batch_sz != 0) {
+      s_ptr->consume(batch_sz);
+      batch_sz = 0;
+    }
     this->idx = 0;
     this->total_msgs = ibv_poll_cq(receiver->recv_cq, receiver->num_wcs(),
                                    receiver->get_wcs_ptr());
@@ -88,8 +105,20 @@ public:
   }
 
   inline void next() {
-    // 2. then we update to the next message
-    s_ptr->update_recv_meta();
+    // 1. the next one in the coalesced message, if any
+    if (batch_sz != 0) {
+      batch_off += sizeof(frame_len_t) + msg_sz;
+      if (batch_off < batch_sz) {
+        msg_sz = frame_len(batch_off);
+        return;
+      }
+      // the whole coalesced message is consumed
+      msg_sz = batch_sz;
+      batch_sz = 0;
+    }
+
+    // 2. then we update to the next message, returning its space
+    s_ptr->consume(msg_sz);
     idx += 1;
 
     fill_cur_msg();
@@ -97,7 +126,13 @@ public:
 
   inline bool has_msgs() const { return idx < total_msgs; }
 
-  inline MemBlock cur_msg() { return cur_session()->cur_msg(msg_sz).value(); }
+  inline MemBlock cur_msg() {
+    if (batch_sz != 0)
+      return MemBlock(static_cast<char *>(batch.mem_ptr) + batch_off +
+                          sizeof(frame_len_t),
+                      msg_sz);
+    return cur_session()->cur_msg(msg_sz).value();
+  }
 
   /*!
     Current session correspond to this message
@@ -105,6 +140,12 @@ public:
   inline Session<R, kRingSz, kMaxMsg> *cur_session() { return s_ptr; }
 
 private:
+  inline usize frame_len(const usize &off) const {
+    frame_len_t len;
+    memcpy(&len, static_cast<char *>(batch.mem_ptr) + off, sizeof(frame_len_t));
+    return len;
+  }
+
   void fill_cur_msg() {
     if (!has_msgs())
       return;
@@ -121,11 +162,19 @@ private:
         // this is a session connect message, ignore
         // re-post the recv, into next message
         s_ptr = receiver->query_session(session_id, std::get<1>(decoded)).value();
+        msg_sz = std::get<1>(decoded);
         next();
       } else {
         // the message is filled
         s_ptr = s.value();
         msg_sz = std::get<1>(decoded);
+        if (kMaxMsg < kBatchFlag && (msg_sz & kBatchFlag)) {
+          // a coalesced one (see Session::send_coalesced), unpack it
+          batch_sz = msg_sz & ~static_cast<usize>(kBatchFlag);
+          batch = s_ptr->cur_msg(batch_sz).value();
+          batch_off = 0;
+          msg_sz = frame_len(0);
+        }
         break;
       }
 
@@ -11,19 +11,65 @@ namespace ring_msg {
 using namespace rdmaio::rmem;
 
 /*!
-  Remote ring store remote ring buffer information
+  Each ring is followed by a credit word, at ring_credit_off(kRingSz, kMaxMsg).
+  The receiver of the ring writes (RDMA WRITE) the total bytes it has
+  consumed into the credit word of the *sender's* local ring, so the sender
+  learns how much of the remote ring is free without any extra round trip.
+ */
+constexpr usize ring_credit_off(const usize &ring_sz, const usize &max_msg) {
+  return (ring_sz + max_msg + sizeof(u64) - 1) / sizeof(u64) * sizeof(u64);
+}
+
+constexpr usize ring_alloc_sz(const usize &ring_sz, const usize &max_msg) {
+  return ring_credit_off(ring_sz, max_msg) + sizeof(u64);
+}
+
+/*!
+  Remote ring store remote ring buffer information.
+  At most kRingSz bytes are in flight: sent but not yet consumed by the
+  remote; next_addr fails when a message would overwrite unread ones.
  */
 template <usize kRingSz> struct RemoteRing {
   usize tailer = 0;
   usize base_addr = 0;
   u32 mem_key = 0;
 
+  // total bytes sent, and the consumed ones reported by the remote
+  u64 sent = 0;
+  u64 consumed = 0;
+  volatile u64 *credits = nullptr;
+
   explicit RemoteRing(const usize &base_addr, const u32 &key)
       : base_addr(base_addr), mem_key(key) {}
 
   RemoteRing() = default;
 
-  usize next_addr(const usize &sz) {
+  /*!
+    \param credits: the credit word written by the remote
+   */
+  void bind_credits(volatile u64 *c) { credits = c; }
+
+  /*!
+    Bytes which can be sent without waiting for more credits
+   */
+  usize free_space() {
+    if (credits == nullptr)
+      return kRingSz;
+    if (sent != consumed) {
+      consumed = *credits;
+      compile_fence();
+    }
+    return static_cast<usize>(kRingSz - (sent - consumed));
+  }
+
+  /*!
+    Without credits bound, the ring is not flow controlled
+   */
+  Option<usize> next_addr(const usize &sz) {
+    if (credits != nullptr && unlikely(sent + sz - consumed > kRingSz) &&
+        sz > free_space())
+      return {};
+    sent += sz;
     auto ret = tailer;
     tailer = (tailer + sz) % kRingSz;
     return ret + base_addr;
@@ -8,6 +8,8 @@
 
 #include "./cm.hh"
 
+#include "../timer.hh"
+
 namespace r2 {
 
 namespace ring_msg {
@@ -33,6 +35,30 @@ template <usize R, usize kRingSz, usize kMaxMsg> class Session {
   const usize send_depth; // configured per QP
   usize pending_sends = 0;
 
+  /*!
+    Credits of my local ring: the bytes consumed, and the ones reported to
+    the remote (whose sender reads them from its credit word).
+    A report is written when kCreditBatch bytes are unreported, or half of
+    them if we are sending to the remote anyway.
+   */
+  static constexpr usize kCreditOff = ring_credit_off(kRingSz, kMaxMsg);
+  static constexpr usize kCreditBatch = kRingSz / 4 > 0 ? kRingSz / 4 : 1;
+  static constexpr usize kPiggybackBatch =
+      kCreditBatch / 2 > 0 ? kCreditBatch / 2 : 1;
+  u64 consumed_bytes = 0;
+  u64 reported_bytes = 0;
+
+  /*!
+    The coalescing mode: messages are packed into a slot (kMaxMsg bytes) of
+    staging, and the slot is written at once. The slots are used in turn, and
+    the QP is drained when they wrap around, so an in-flight write never
+    reads a slot being refilled.
+   */
+  MemBlock staging;
+  usize staging_slot = 0;
+  usize staged_sz = 0;
+  usize staged_num = 0;
+
 public:
   /*!
     \note: we use u16 for recording the message
@@ -57,11 +83,14 @@ public:
         recv_meta(std::make_shared<RecvBundler<R>>(alloc)),
         send_depth(qp->my_config.max_send_sz() / 2),
         local_ring(MemBlock(
-            std::get<0>(alloc->alloc_one_for_remote(kRingSz + kMaxMsg).value()),
+            std::get<0>(alloc->alloc_one_for_remote(
+                                 ring_alloc_sz(kRingSz, kMaxMsg))
+                            .value()),
             kRingSz + kMaxMsg)) {
     // TODO: allocate a local ring for remote to send back
     auto local_mr = std::get<1>(alloc->alloc_one_for_remote(0).value());
     qp->bind_local_mr(local_mr);
+    *local_credits() = 0;
   }
 
   /*!
@@ -79,6 +108,9 @@ public:
         remote_ring(addr, remote_mr.key),
         send_depth(qp->my_config.max_send_sz() / 2) {
     qp->bind_remote_mr(remote_mr);
+    // the ring is allocated with ring_alloc_sz by the RingManager
+    *local_credits() = 0;
+    remote_ring.bind_credits(local_credits());
   }
 
   ~Session() {
@@ -87,6 +119,48 @@ public:
 
   Result<int> update_recv_meta() { return recv_meta->consume_one(qp); }
 
+  /*!
+    A message of sz bytes in my local ring has been handled, so its space
+    can be returned to the remote sender
+   */
+  Result<int> consume(const usize &sz) {
+    consumed_bytes += sz;
+    if (consumed_bytes - reported_bytes >= kCreditBatch)
+      write_credits();
+    return update_recv_meta();
+  }
+
+  /*!
+    Report all the consumed bytes to the remote sender now, e.g., before
+    waiting for the remote to send more
+   */
+  void flush_credits() {
+    if (consumed_bytes != reported_bytes)
+      write_credits();
+  }
+
+  /*!
+    Bytes which can be sent to the remote without waiting for credits
+   */
+  usize remote_free_space() { return remote_ring.free_space(); }
+
+  /*!
+    Opt in the coalescing mode, see send_coalesced.
+    \param buf: the staging buffer, which must be in the local MR of the QP
+    and hold at least one kMaxMsg slot
+   */
+  void enable_coalescing(const MemBlock &buf) {
+    static_assert(kMaxMsg < kBatchFlag,
+                  "The coalesced size is encoded with kBatchFlag");
+    ASSERT(buf.sz >= kMaxMsg);
+    staging = buf;
+    staging_slot = 0;
+  }
+
+  bool coalescing() const { return staging.mem_ptr != nullptr; }
+
+  usize num_coalesced() const { return staged_num; }
+
   inline Option<MemBlock> cur_msg(const usize &sz) {
     return local_ring.cur_msg(sz);
   }
@@ -106,7 +180,8 @@ public:
                    const double &timeout_usec = 1000000) {
     // #1
     auto res =
-        cm.connect_for_ring(std::to_string(id), c_name, kRingSz + kMaxMsg, qp,
+        cm.connect_for_ring(std::to_string(id), c_name,
+                            ring_alloc_sz(kRingSz, kMaxMsg), qp,
                             nic_id, remote_qp_config, timeout_usec);
     if (res != IOCode::Ok) {
       return ::rdmaio::transfer(res, DummyDesc());
@@ -124,11 +199,12 @@ public:
     // 2. copy the remote MR attr
     ASSERT(qp_reply.base_off >= qp_reply.mr.buf)
         << "base off: " << qp_reply.base_off << "; mr buf: " << qp_reply.mr.buf;
-    ASSERT(qp_reply.base_off + kRingSz + kMaxMsg <=
+    ASSERT(qp_reply.base_off + ring_alloc_sz(kRingSz, kMaxMsg) <=
            qp_reply.mr.buf + qp_reply.mr.sz);
     auto base_addr = qp_reply.base_off - qp_reply.mr.buf;
     remote_ring =
         RemoteRing<kRingSz>(static_cast<usize>(base_addr), qp_reply.mr.key);
+    remote_ring.bind_credits(local_credits());
 
     qp->bind_remote_mr(qp_reply.mr);
 
@@ -144,6 +220,11 @@ public:
     return send_bootstrap();
   }
 
+  /*!
+    Wait (for at most timeout usec) if the remote ring is full.
+    \note: the credits are only returned when the remote consumes the
+    messages, so the caller should not be the one who drives the remote.
+   */
   Result<std::string> send_blocking(const MemBlock &msg,
                                     const double &timeout = 1000000) {
     // 1. calculate proper flag for sending
@@ -153,8 +234,18 @@ public:
     auto imm_data =
         IDEncoder::encode_id_sz(this->id, static_cast<sz_t>(msg.sz));
 
-    // 3. calculate the remote offset
-    auto remote_addr = remote_ring.next_addr(msg.sz);
+    // 3. calculate the remote offset, wait for the credits if necessary
+    piggyback_credits();
+    auto remote_addr_o = remote_ring.next_addr(msg.sz);
+    if (unlikely(!remote_addr_o))
+      flush_credits(); // the remote may also be waiting for mine
+    for (Timer t; unlikely(!remote_addr_o);
+         remote_addr_o = remote_ring.next_addr(msg.sz)) {
+      if (t.passed_msec() > timeout)
+        return ::rdmaio::Timeout(std::string("remote ring is full"));
+      relax_fence();
+    }
+    auto remote_addr = remote_addr_o.value();
 
     // 4. use post_send to write this message
     auto res_s = qp->send_normal(
@@ -177,28 +268,125 @@ public:
   }
 
   // following are sender methods
+  /*!
+    Return NotReady if the remote ring has no space for msg; the caller
+    should back off (e.g., yield) and retry.
+   */
   Result<std::string> send_unsignaled(const MemBlock &msg) {
+    return post_ring_write(msg, static_cast<sz_t>(msg.sz));
+  }
+
+  /*!
+    Queue msg to the current slot of the staging buffer, which is sent,
+    with all the messages queued before, in one RDMA_WRITE_WITH_IMM on
+    flush_coalesced (or once the slot is full). The receiver
+    (RingRecvIter) unpacks them as individual messages.
+    Usually flush_coalesced is called once per scheduling round, e.g., by a
+    CoalesceFlusher (./flusher.hh).
+    Return NotReady if msg cannot be queued since the remote ring is full.
+   */
+  Result<std::string> send_coalesced(const MemBlock &msg) {
+    ASSERT(coalescing());
+    const usize frame_sz = sizeof(frame_len_t) + msg.sz;
+    if (unlikely(frame_sz > kMaxMsg)) {
+      // too large to be packed, keep the order with the queued ones
+      auto res = flush_coalesced();
+      if (res != IOCode::Ok)
+        return res;
+      return send_unsignaled(msg);
+    }
+    if (staged_sz + frame_sz > kMaxMsg) {
+      auto res = flush_coalesced();
+      if (res != IOCode::Ok)
+        return res;
+    }
+
+    char *frame = cur_slot() + staged_sz;
+    const frame_len_t len = static_cast<frame_len_t>(msg.sz);
+    memcpy(frame, &len, sizeof(frame_len_t));
+    memcpy(frame + sizeof(frame_len_t), msg.mem_ptr, msg.sz);
+    staged_sz += frame_sz;
+    staged_num += 1;
+    return ::rdmaio::Ok(std::string(""));
+  }
+
+  /*!
+    Send the queued messages, if any.
+    The queued ones are kept if the remote ring is full (NotReady).
+   */
+  Result<std::string> flush_coalesced() {
+    if (staged_num == 0)
+      return ::rdmaio::Ok(std::string(""));
+
+    const usize num_slots = staging.sz / kMaxMsg;
+    const bool wrap = staging_slot + 1 == num_slots;
+    auto res = post_ring_write(MemBlock(cur_slot(), staged_sz),
+                               static_cast<sz_t>(staged_sz | kBatchFlag), wrap);
+    if (res == IOCode::Ok) {
+      staging_slot = wrap ? 0 : staging_slot + 1;
+      staged_sz = 0;
+      staged_num = 0;
+    }
+    return res;
+  }
 
+private:
+  /*!
+    Write msg to the remote ring, whose imm carries imm_sz.
+    \param drain: wait until all the sends (including this one) complete
+   */
+  Result<std::string> post_ring_write(const MemBlock &msg, const sz_t &imm_sz,
+                                      const bool &drain = false) {
     // 1. calculate proper flag for sending
     int write_flag = msg.sz <= ::rdmaio::qp::kMaxInlinSz ? IBV_SEND_INLINE : 0;
 
     // 2. calculate the imm msg
-    auto imm_data =
-        IDEncoder::encode_id_sz(this->id, static_cast<sz_t>(msg.sz));
+    auto imm_data = IDEncoder::encode_id_sz(this->id, imm_sz);
 
     // 3. calculate the remote offset
-    auto remote_addr = remote_ring.next_addr(msg.sz);
+    piggyback_credits();
+    auto remote_addr_o = remote_ring.next_addr(msg.sz);
+    if (unlikely(!remote_addr_o))
+      return ::rdmaio::NotReady(std::string("remote ring is full"));
+    auto remote_addr = remote_addr_o.value();
 
     // 4. use post_send to write this message
+    const bool signaled = drain || pending_sends == 0;
     auto res_s = qp->send_normal(
         {.op = IBV_WR_RDMA_WRITE_WITH_IMM,
-         .flags = write_flag | ((pending_sends == 0) ? (IBV_SEND_SIGNALED) : 0),
+         .flags = write_flag | (signaled ? (IBV_SEND_SIGNALED) : 0),
          .len = msg.sz,
          .wr_id = 0},
         {.local_addr = reinterpret_cast<RMem::raw_ptr_t>(msg.mem_ptr),
          .remote_addr = remote_addr,
          .imm_data = imm_data});
+    if (unlikely(res_s != IOCode::Ok))
+      return res_s;
 
+    if (drain) {
+      // the signaled one of the current window (if any), and this one
+      for (usize i = 0; i < (pending_sends > 0 ? 2 : 1); ++i) {
+        auto res_p = qp->wait_one_comp();
+        RDMA_ASSERT(res_p == IOCode::Ok)
+            << "wait completion error: " << RC::wc_status(res_p.desc);
+      }
+      pending_sends = 0;
+    } else {
+      track_unsignaled();
+    }
+    return res_s;
+  }
+
+  inline char *cur_slot() const {
+    return static_cast<char *>(staging.mem_ptr) + staging_slot * kMaxMsg;
+  }
+
+  volatile u64 *local_credits() {
+    return reinterpret_cast<volatile u64 *>(
+        static_cast<char *>(local_ring.local_mem.mem_ptr) + kCreditOff);
+  }
+
+  void track_unsignaled() {
     if (pending_sends >= send_depth) {
       auto res_p = qp->wait_one_comp();
       RDMA_ASSERT(res_p == IOCode::Ok)
@@ -207,11 +395,34 @@ public:
     } else {
       pending_sends += 1;
     }
+  }
 
-    return res_s;
+  inline void piggyback_credits() {
+    if (consumed_bytes - reported_bytes >= kPiggybackBatch)
+      write_credits();
+  }
+
+  /*!
+    Write the consumed bytes to the credit word of the remote's local ring,
+    which is right after the remote ring I send to.
+    The write is inlined, so reported_bytes can be the source.
+   */
+  void write_credits() {
+    static_assert(sizeof(u64) <= ::rdmaio::qp::kMaxInlinSz, "");
+    reported_bytes = consumed_bytes;
+    auto res_s = qp->send_normal(
+        {.op = IBV_WR_RDMA_WRITE,
+         .flags = IBV_SEND_INLINE |
+                  ((pending_sends == 0) ? (IBV_SEND_SIGNALED) : 0),
+         .len = sizeof(u64),
+         .wr_id = 0},
+        {.local_addr = reinterpret_cast<RMem::raw_ptr_t>(&reported_bytes),
+         .remote_addr = remote_ring.base_addr + kCreditOff,
+         .imm_data = 0});
+    RDMA_ASSERT(res_s == IOCode::Ok) << "write credits error: " << res_s.desc;
+    track_unsignaled();
   }
 
-private:
   // send the bootstrap message
   Result<> send_bootstrap() {
     auto local_mr = qp->local_mr.value();
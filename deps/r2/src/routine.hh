@@ -25,7 +25,7 @@ using routine_func_t = std::function<void(yield_f &)>;
 
 class Routine {
 public:
-  using id_t = u8;
+  using id_t = u32;
 
   const id_t id;
 
@@ -22,7 +22,12 @@ class BufFactory {
 
   char *alloc(int size) const {
     //char *ptr = (char *)Rmalloc(size + extra_padding);
-    char *ptr = (char *)(AllocatorMaster<>::get_thread_allocator()->alloc(size + extra_padding));
+    char *ptr = nullptr;
+    // prefer the node-local slabs
+    if (auto slab = AllocatorMaster<>::get_thread_slab())
+      ptr = (char *)slab->alloc(size + extra_padding);
+    if (ptr == nullptr)
+      ptr = (char *)(AllocatorMaster<>::get_thread_allocator()->alloc(size + extra_padding));
     //LOG(4) << "alloc ptr: " << (void *)ptr << " for sz: " << size;
     if(likely(ptr != nullptr))
       return ptr + extra_padding;
@@ -30,6 +35,10 @@ class BufFactory {
   }
 
   void  dealloc(char *ptr) const {
+    if (AllocatorMaster<>::within_slab(ptr - extra_padding)) {
+      AllocatorMaster<>::get_thread_slab()->dealloc(ptr - extra_padding);
+      return;
+    }
     (AllocatorMaster<>::get_thread_allocator()->free(ptr - extra_padding));
   }
 
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "./common.hh"
+
+namespace r2 {
+
+/*!
+  The (lkey, rkey) of a registered region
+ */
+struct MRKeys {
+  u32 lkey = 0;
+  u32 rkey = 0;
+};
+
+/*!
+  SlabMaster manages the RDMA-registered memory of the slab allocator.
+  Each NUMA node has one backing region, which is bound to the node and
+  registered once (by the reg_func_t passed to `init`). The regions are
+  laid out in one virtual range, `span` bytes apart, so the node (and thus
+  the keys) of a pointer is one shift away.
+
+  A region is carved into slabs of kSlabSize bytes, each one holding objects
+  of one size class (a power of two in [kMinObj, kMaxObj]). The free objects
+  of a (node, class) are kept in its depot, which the threads access in
+  batches of a magazine (see SlabCache); no lock is shared by all the nodes.
+
+  The regions are never unmapped, like the heap of AllocatorMaster.
+ */
+class SlabMaster {
+public:
+  using reg_func_t =
+      std::function<Option<MRKeys>(const usize &node, char *mem, const u64 &sz)>;
+
+  static constexpr usize kMinObjShift = 6;
+  static constexpr usize kMaxObjShift = 16;
+  static constexpr usize kNumClasses = kMaxObjShift - kMinObjShift + 1;
+  static constexpr usize kMinObj = 1u << kMinObjShift;
+  static constexpr usize kMaxObj = 1u << kMaxObjShift;
+
+  static constexpr usize kSlabShift = 18;
+  static constexpr u64 kSlabSize = 1ull << kSlabShift;
+
+  /*!
+    Map and register `nodes` regions of `sz_per_node` bytes each.
+    Return false if the memory cannot be mapped, or any region fails to
+    register.
+   */
+  bool init(const usize &nodes, const u64 &sz_per_node, const reg_func_t &reg) {
+    ASSERT(nodes > 0);
+    std::lock_guard<std::mutex> guard(init_lock);
+    if (inited()) {
+      LOG(2) << "slab master inited multiple times";
+      return false;
+    }
+
+    const u64 sz = round_up(sz_per_node, kSlabSize);
+    usize shift = kSlabShift;
+    while ((1ull << shift) < sz)
+      shift += 1;
+    const u64 span = 1ull << shift;
+
+    void *va = ::mmap(nullptr, span * nodes, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (va == MAP_FAILED)
+      return false;
+
+    std::vector<std::unique_ptr<Node>> temp;
+    for (usize i = 0; i < nodes; ++i) {
+      char *base = static_cast<char *>(va) + span * i;
+      if (::mprotect(base, sz, PROT_READ | PROT_WRITE) != 0) {
+        ::munmap(va, span * nodes);
+        return false;
+      }
+      bind_to_node(base, sz, i);
+
+      auto keys = reg(i, base, sz);
+      if (!keys) {
+        LOG(4) << "slab master failed to register the region of node " << i;
+        ::munmap(va, span * nodes);
+        return false;
+      }
+      temp.emplace_back(new Node(base, sz, keys.value()));
+    }
+
+    regions.swap(temp);
+    span_shift = shift;
+    start_addr = static_cast<char *>(va);
+    end_addr = start_addr + span * nodes;
+    return true;
+  }
+
+  bool inited() const { return start_addr != nullptr; }
+
+  usize num_nodes() const { return regions.size(); }
+
+  bool within_range(const void *p) const {
+    auto c = static_cast<const char *>(p);
+    return c >= start_addr && c < end_addr;
+  }
+
+  /*!
+    The node of a pointer allocated from the slabs, -1 if it is not
+   */
+  int node_of(const void *p) const {
+    if (!within_range(p))
+      return -1;
+    return static_cast<int>((static_cast<const char *>(p) - start_addr) >>
+                            span_shift);
+  }
+
+  /*!
+    The keys of the region holding `p`, in O(1)
+   */
+  Option<MRKeys> lookup(const void *p) const {
+    auto n = node_of(p);
+    if (n < 0)
+      return {};
+    return regions[n]->keys;
+  }
+
+  /*!
+    The NUMA node of the calling thread, mod the number of regions
+   */
+  usize cur_node() const {
+    unsigned cpu = 0, node = 0;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+      return 0;
+    return node % num_nodes();
+  }
+
+  static inline usize size_class(const u64 &sz) {
+    usize c = 0;
+    while ((static_cast<u64>(kMinObj) << c) < sz)
+      c += 1;
+    return c;
+  }
+
+  static inline u64 class_size(const usize &c) {
+    return static_cast<u64>(kMinObj) << c;
+  }
+
+  /*!
+    The number of objects moved between a depot and a thread at once
+   */
+  static inline usize magazine_size(const usize &c) {
+    u64 n = (kSlabSize / class_size(c)) / 4;
+    return static_cast<usize>(std::max<u64>(2, std::min<u64>(64, n)));
+  }
+
+  /*!
+    The size class of a pointer allocated from the slabs
+   */
+  usize class_of(const void *p) const {
+    auto &r = *regions[node_of(p)];
+    return r.slab_class[(static_cast<const char *>(p) - r.base) >> kSlabShift];
+  }
+
+  /*!
+    Move up to `num` free objects of class `c` on `node` to `out`.
+    A new slab is carved if the depot is empty, from the other nodes if
+    the node has run out of memory.
+    Return the number of objects moved.
+   */
+  usize get_batch(const usize &node, const usize &c, usize num,
+                  std::vector<void *> &out) {
+    for (usize i = 0; i < num_nodes(); ++i) {
+      auto &r = *regions[(node + i) % num_nodes()];
+      auto &d = r.depots[c];
+      std::lock_guard<std::mutex> guard(d.lock);
+      if (d.free.empty() && !carve(r, c))
+        continue;
+
+      usize n = std::min<usize>(num, d.free.size());
+      out.insert(out.end(), d.free.end() - n, d.free.end());
+      d.free.resize(d.free.size() - n);
+      return n;
+    }
+    return 0;
+  }
+
+  /*!
+    Return objects of class `c` to the depots of their nodes.
+   */
+  void put_batch(const usize &c, void **objs, const usize &num) {
+    usize i = 0;
+    while (i < num) {
+      auto n = node_of(objs[i]);
+      auto &d = regions[n]->depots[c];
+      std::lock_guard<std::mutex> guard(d.lock);
+      for (; i < num && node_of(objs[i]) == n; ++i)
+        d.free.push_back(objs[i]);
+    }
+  }
+
+  // the virtual range of all the regions
+  char *start_addr = nullptr;
+  char *end_addr = nullptr;
+
+private:
+  struct alignas(kCacheLineSize) Depot {
+    std::mutex lock;
+    std::vector<void *> free;
+  };
+
+  struct Node {
+    char *base;
+    const u64 sz;
+    const MRKeys keys;
+    std::atomic<u64> top;
+
+    // the size class of each slab
+    std::vector<u8> slab_class;
+    Depot depots[kNumClasses];
+
+    Node(char *base, const u64 &sz, const MRKeys &keys)
+        : base(base), sz(sz), keys(keys), top(0),
+          slab_class(sz >> kSlabShift, 0) {}
+  };
+
+  static u64 round_up(const u64 &v, const u64 &align) {
+    return (v + align - 1) / align * align;
+  }
+
+  /*!
+    Best effort, since the machine may have fewer nodes than the regions
+   */
+  static void bind_to_node(char *mem, const u64 &sz, const usize &node) {
+    // MPOL_BIND
+    const int kBind = 2;
+    unsigned long mask = 1ul << (node % (sizeof(mask) * 8));
+    if (::syscall(SYS_mbind, mem, sz, kBind, &mask, sizeof(mask) * 8 + 1, 0) !=
+        0)
+      LOG(2) << "slab master failed to bind the region to node " << node;
+  }
+
+  // with the lock of the depot held
+  bool carve(Node &r, const usize &c) {
+    u64 off = r.top.fetch_add(kSlabSize, std::memory_order_relaxed);
+    if (off + kSlabSize > r.sz) {
+      r.top.fetch_sub(kSlabSize, std::memory_order_relaxed);
+      return false;
+    }
+    r.slab_class[off >> kSlabShift] = static_cast<u8>(c);
+
+    auto &d = r.depots[c];
+    const u64 obj = class_size(c);
+    // the lowest address is handed out first
+    for (u64 i = kSlabSize; i >= obj; i -= obj)
+      d.free.push_back(r.base + off + i - obj);
+    return true;
+  }
+
+  std::vector<std::unique_ptr<Node>> regions;
+  usize span_shift = 0;
+  std::mutex init_lock;
+};
+
+/*!
+  The per-thread front of the slabs: one magazine of free objects per size
+  class, refilled from (and flushed to) the depots of the thread's node in
+  batches, so the common alloc/dealloc is a push/pop on a thread-local array.
+  Objects freed by another node go back to their own node's depot, so the
+  magazines only hold local memory.
+ */
+class SlabCache {
+public:
+  SlabCache(SlabMaster &master, const usize &node)
+      : node(node), master(master) {
+    for (usize c = 0; c < SlabMaster::kNumClasses; ++c)
+      mags[c].reserve(2 * SlabMaster::magazine_size(c));
+  }
+
+  ~SlabCache() { flush(); }
+
+  /*!
+    nullptr if sz > SlabMaster::kMaxObj, or all the regions are exhausted
+   */
+  inline void *alloc(const u64 &sz) {
+    if (unlikely(sz > SlabMaster::kMaxObj))
+      return nullptr;
+    auto c = SlabMaster::size_class(sz);
+    auto &m = mags[c];
+    if (unlikely(m.empty()) &&
+        master.get_batch(node, c, SlabMaster::magazine_size(c), m) == 0)
+      return nullptr;
+    auto res = m.back();
+    m.pop_back();
+    return res;
+  }
+
+  inline void dealloc(void *p) {
+    auto c = master.class_of(p);
+    if (unlikely(master.node_of(p) != static_cast<int>(node))) {
+      master.put_batch(c, &p, 1);
+      return;
+    }
+    auto &m = mags[c];
+    m.push_back(p);
+    auto batch = SlabMaster::magazine_size(c);
+    if (unlikely(m.size() >= 2 * batch)) {
+      master.put_batch(c, m.data() + m.size() - batch, batch);
+      m.resize(m.size() - batch);
+    }
+  }
+
+  /*!
+    Return all the cached objects to the depots
+   */
+  void flush() {
+    for (usize c = 0; c < SlabMaster::kNumClasses; ++c) {
+      master.put_batch(c, mags[c].data(), mags[c].size());
+      mags[c].clear();
+    }
+  }
+
+  const usize node;
+
+private:
+  SlabMaster &master;
+  std::vector<void *> mags[SlabMaster::kNumClasses];
+
+  DISABLE_COPY_AND_ASSIGN(SlabCache);
+};
+
+} // namespace r2
@@ -1,31 +1,29 @@
+#include <limits>
+
 #include "./libroutine.hh"
 
 namespace r2 {
 
-const usize kMaxRoutineSupported = 64;
-static_assert(
-    kMaxRoutineSupported + 1 <= std::numeric_limits<id_t>::max(),
-    "invalid id_t type, consider make it from u8 to a larger unsigned type");
+/*!
+  Coroutines are only bounded by the width of their ids
+ */
+const usize kMaxRoutineSupported = std::numeric_limits<Routine::id_t>::max();
 
 /*!
   The constructor will spawn a main coroutine for polling all the futures
  */
-SScheduler::SScheduler() : pending_futures(kMaxRoutineSupported, 0) {
-
-  routines.reserve(kMaxRoutineSupported + 1);
+SScheduler::SScheduler() {
 
   this->spawn([this](R2_ASYNC) {
     while (R2_EXECUTOR.running) {
-      // TODO, the body is not implemented
       this->poll_all_futures();
       R2_YIELD;
     }
     R2_RET;
   });
-  assert(cur_routine_ptr != nullptr);
 }
 
-Option<id_t> SScheduler::spawn(const sroutine_func_t &f) {
+Option<Routine::id_t> SScheduler::spawn(const sroutine_func_t &f) {
   auto cid = routines.size();
   if (cid >= kMaxRoutineSupported)
     return {};
@@ -33,28 +31,21 @@ Option<id_t> SScheduler::spawn(const sroutine_func_t &f) {
                                                  [](auto p) { delete p; });
   *wrapper = std::bind(f, std::placeholders::_1, std::ref(*this));
 
-  { // unsafe code
-    routines.push_back(new Node<Routine>(cid, wrapper));
-    Node<Routine> *cur_ptr = routines[cid];
-
-    auto cur = routine_chain.add(cur_ptr);
-    if (cur_routine_ptr == nullptr)
-      cur_routine_ptr = cur;
-  }
-  return cid;
+  routines.emplace_back(static_cast<Routine::id_t>(cid), wrapper);
+  pending_futures.push_back(0);
+  // the first one (the polling coroutine) runs first, on run()
+  if (cid != 0)
+    ready.push(static_cast<Routine::id_t>(cid));
+  return static_cast<Routine::id_t>(cid);
 }
 
 void SScheduler::exit(yield_f &f) {
-  auto temp = cur_routine_ptr;
-  cur_routine_ptr = routine_chain.leave_one(cur_routine_ptr);
-
-  // free resource
-  // FIXME: currently delete this cause segmentation fault, I dnonot know why
-  delete temp;
+  routines[cur].active = false;
 
+  // the routine is kept, since its coroutine is still running here
   // there are still remaining coroutines
-  if (cur_routine_ptr != temp) {
-    cur_routine_ptr->val.execute(f);
+  if (!ready.empty()) {
+    switch_to(ready.pop(), f);
   }
 }
 
@@ -80,7 +71,7 @@ void SScheduler::poll_all_futures() {
 
     if (res == IOCode::Err) {
       need_add = true;
-      routines.at(cid)->val.status = ::rdmaio::Err();
+      routines.at(cid).status = ::rdmaio::Err();
     }
 
     // if res == Ok, or Err, we need to eject this future
@@ -91,9 +82,28 @@ void SScheduler::poll_all_futures() {
 
     // finally we check whether we need to add back coroutine
     if (need_add) {
-      assert(routines.at(cid)->val.active == false);
-      //if (cid != 2)
-      routine_chain.add(routines.at(cid));
+      assert(routines.at(cid).active == false);
+      ready.push(cid);
+    }
+  }
+
+  for (usize i = 0; i < pollers.size();) {
+    if (unlikely(pollers[i].second->expired())) {
+      remove_poller(pollers[i].first);
+      continue;
+    }
+    pollers[i].second->poll(*this);
+    i += 1;
+  }
+}
+
+void SScheduler::remove_poller(const void *src) {
+  if (poller_index.erase(src) == 0)
+    return;
+  for (auto it = pollers.begin(); it != pollers.end(); ++it) {
+    if (it->first == src) {
+      pollers.erase(it);
+      return;
     }
   }
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "./ready_ring.hh"
 #include "./routine.hh"
 
 namespace r2 {
@@ -19,6 +22,26 @@ using poll_func_t =
 class SScheduler;
 using sroutine_func_t = std::function<void(yield_f &yield, SScheduler &r)>;
 
+/*!
+  A poller shared by all the coroutines waiting on one source, e.g., the CQ of a
+  QP. Instead of a future per outstanding request, a coroutine registers the
+  poller of its source once (SScheduler::shared_poller), and waits with
+  R2_WAIT_NUM; the poller reports the completed requests of any coroutine via
+  SScheduler::complete / SScheduler::fail.
+ */
+class Poller {
+public:
+  virtual void poll(SScheduler &s) = 0;
+
+  /*!
+    Whether the source is gone, e.g., a weak_ptr to it has expired;
+    an expired poller is dropped by the scheduler
+   */
+  virtual bool expired() const { return false; }
+
+  virtual ~Poller() {}
+};
+
 /*!
   SScheduler is a **single-threaded** executor who execute R2 routines.
   An example usage is:
@@ -43,12 +66,13 @@ using sroutine_func_t = std::function<void(yield_f &yield, SScheduler &r)>;
 class SScheduler {
 
   /*!
-    Each elemenent in routine_chain stores **pointers to** routines vector
-    element
+    Routines are never freed before the scheduler, so they are kept in a deque
+    whose elements never move; the runnable ones are queued by id in `ready`,
+    except the running one (`cur`).
    */
-  LinkedList<Routine> routine_chain;
-  std::vector<Node<Routine> *> routines;
-  Node<Routine> *cur_routine_ptr = nullptr;
+  std::deque<Routine> routines;
+  ReadyRing<Routine::id_t> ready;
+  Routine::id_t cur = 0;
 
   std::vector<usize> pending_futures;
 
@@ -57,17 +81,42 @@ class SScheduler {
    */
   std::deque<poll_func_t> futures;
 
+  /*!
+    Shared pollers, and their sources
+   */
+  std::vector<std::pair<const void *, std::unique_ptr<Poller>>> pollers;
+  std::unordered_map<const void *, Poller *> poller_index;
+
   volatile bool running = false;
 
   void poll_all_futures();
 
+  template <typename P, typename Arg> P &find_poller(const void *src, const Arg &arg) {
+    auto it = poller_index.find(src);
+    if (likely(it != poller_index.end())) {
+      if (likely(!it->second->expired()))
+        return *static_cast<P *>(it->second);
+      // the source is gone, and a new one lives at its address
+      remove_poller(src);
+    }
+    auto p = new P(arg);
+    pollers.emplace_back(src, std::unique_ptr<Poller>(p));
+    poller_index.emplace(src, p);
+    return *p;
+  }
+
+  inline void switch_to(const Routine::id_t &id, yield_f &f) {
+    cur = id;
+    routines[id].execute(f);
+  }
+
 public:
   SScheduler();
 
   /*!
     Spawn a coroutine to the SScheduer.
    */
-  Option<id_t> spawn(const sroutine_func_t &f);
+  Option<Routine::id_t> spawn(const sroutine_func_t &f);
 
   void emplace_future(poll_func_t &f) { futures.push_back(f); }
 
@@ -76,22 +125,70 @@ public:
     This means that the coroutine (id) should wait at least (num) requests.
     The request is monitored by the poll_func_t.
    */
-  void emplace_for_routine(const id_t &id, usize num, poll_func_t &f) {
+  void emplace_for_routine(const Routine::id_t &id, usize num, poll_func_t &f) {
     wait_num(id, num);
     futures.push_back(f);
   }
-  void wait_num(const id_t &id, usize num) { pending_futures[id] += num; }
+  void wait_num(const Routine::id_t &id, usize num) { pending_futures[id] += num; }
+
+  /*!
+    Return the poller of `src`, created as P(src) on the first call.
+    It is polled in each scheduling round, until remove_poller(src), which the
+    owner of `src` must call before freeing it.
+   */
+  template <typename P, typename Src> P &shared_poller(Src *src) {
+    return find_poller<P>(src, src);
+  }
+
+  /*!
+    The same, for a source owned elsewhere: P(src) keeps a weak_ptr to it, and
+    reports expired() once it is freed, when the poller is dropped.
+   */
+  template <typename P, typename Src>
+  P &shared_poller(const std::shared_ptr<Src> &src) {
+    return find_poller<P>(src.get(), src);
+  }
+
+  /*!
+    Drop the poller of `src`, if any.
+    Not called inside Poller::poll, since the pollers are being iterated.
+   */
+  void remove_poller(const void *src);
+
+  /*!
+    Called by the pollers: (num) requests of the coroutine (id) complete,
+    which is added back once all the requests it waits for have completed.
+   */
+  inline void complete(const Routine::id_t &id, usize num) {
+    ASSERT(pending_futures[id] >= num)
+        << " reduce num: " << num << " for cid: " << id;
+    pending_futures[id] -= num;
+    if (pending_futures[id] == 0) {
+      assert(routines[id].active == false);
+      ready.push(id);
+    }
+  }
+
+  /*!
+    Called by the pollers: a request of the coroutine (id) fails,
+    which is added back with an Err status.
+   */
+  inline void fail(const Routine::id_t &id) {
+    routines[id].status = ::rdmaio::Err();
+    if (pending_futures[id] > 0) {
+      pending_futures[id] = 0;
+      ready.push(id);
+    }
+  }
 
   void run() {
     this->running = true;
-    routines.at(0)->val.start();
+    routines.at(0).start();
   }
 
-  usize pending_future(const id_t &id) const { return pending_futures.at(id); }
+  usize pending_future(const Routine::id_t &id) const { return pending_futures.at(id); }
 
-  void addback_coroutine(const usize &id) {
-    routine_chain.add(routines.at(id));
-  }
+  void addback_coroutine(const usize &id) { ready.push(id); }
 
   /**********************************************************************************************/
 
@@ -101,10 +198,11 @@ public:
     Pause the current coroutine, and yield to others
    */
   Result<> pause_and_yield(yield_f &f) {
-    cur_routine_ptr->val.active = false;
-    cur_routine_ptr = routine_chain.leave_one(cur_routine_ptr);
-    cur_routine_ptr->val.execute(f);
-    return cur_routine_ptr->val.status;
+    routines[cur].active = false;
+    // the polling coroutine is always runnable
+    ASSERT(!ready.empty());
+    switch_to(ready.pop(), f);
+    return routines[cur].status;
   }
 
   Result<> pause(yield_f &f) {
@@ -114,14 +212,13 @@ public:
   }
 
   void yield_to_next(yield_f &f) {
-    auto temp = cur_routine_ptr;
-    cur_routine_ptr = cur_routine_ptr->next_p;
-
-    if (likely(temp != cur_routine_ptr))
-      cur_routine_ptr->val.execute(f);
+    if (unlikely(ready.empty()))
+      return;
+    ready.push(cur);
+    switch_to(ready.pop(), f);
   }
 
-  id_t cur_id() const { return cur_routine_ptr->val.id; }
+  Routine::id_t cur_id() const { return cur; }
 
   void exit(yield_f &f);
 
@@ -3,69 +3,340 @@
 #include "common.hh"
 #include "./utils/rdtsc.hh"
 
-#include <queue>
+#include <limits>
+#include <utility>
+#include <vector>
 
 namespace r2
 {
 
 /*!
  We use rdtsc(), namely cycles for timeout management;
- All pending routines are add towards a heap, which records its start time
+ All pending routines are kept in a hierarchical timing wheel of rdtsc ticks
+ (2^tick_shift cycles per tick): kLevels wheels of kSlots slots, where level L
+ holds the timeouts due within 2^(8 * (L + 1)) ticks. A slot of an upper level is
+ cascaded into the lower ones once the wheel below wraps, so insert and cancel
+ are O(1), and all timeouts of a tick expire at once.
+ A timeout never expires before its end_time, and at most one tick after it.
 */
 
+using cor_id_t = u32;
+
 struct TMElement
 {
-    u8 cor_id;
+    cor_id_t cor_id;
     u64 end_time;
     u32 seq; // seq is used to filter out duplicate
 
-    TMElement(const u8 &id, const u64 &end_time, const u32 &s)
-        : cor_id(id), end_time(end_time),seq(s) {}
+    TMElement(const cor_id_t &id, const u64 &end_time, const u32 &s)
+        : cor_id(id), end_time(end_time), seq(s) {}
 };
 
-struct TECmp
+class TMIter;
+class TM
 {
-    bool operator()(TMElement a, TMElement b)
+    friend class TMIter;
+
+public:
+    // (generation << 32) | index of the element, so that a stale handle cancels nothing
+    using handle_t = u64;
+
+    static const usize kLevelBits = 8;
+    static const usize kSlots = 1 << kLevelBits;
+    static const usize kLevels = 4;
+
+    explicit TM(usize tick_shift = 10, u64 now = RDTSC::read_tsc())
+        : tick_shift(tick_shift), cur_(now >> tick_shift)
     {
-        return a.end_time > b.end_time;
+        for (usize l = 0; l < kLevels; ++l)
+        {
+            for (usize s = 0; s < kSlots; ++s)
+                heads_[l][s] = kNil;
+            for (usize w = 0; w < kSlots / 64; ++w)
+                bits_[l][w] = 0;
+        }
     }
-};
 
-class TMIter;
-class TM
-{
+    handle_t enqueue(const cor_id_t &id, const u64 &end_time, const u32 &seq)
+    {
+        u32 idx;
+        if (!free_.empty())
+        {
+            idx = free_.back();
+            free_.pop_back();
+            nodes_[idx].e = TMElement(id, end_time, seq);
+        }
+        else
+        {
+            idx = static_cast<u32>(nodes_.size());
+            nodes_.emplace_back(TMElement(id, end_time, seq));
+        }
+        auto &n = nodes_[idx];
+        // the first tick starting after end_time
+        n.tick = (end_time >> tick_shift) + 1;
+        place(idx);
+        return (static_cast<u64>(n.gen) << 32) | idx;
+    }
 
-    friend class TMIter;
-    std::priority_queue<TMElement, std::vector<TMElement>, TECmp> q;
+    /*!
+     Remove a pending timeout, return false if it has expired, or has been cancelled
+    */
+    bool cancel(const handle_t &h)
+    {
+        u32 idx = static_cast<u32>(h);
+        if (idx >= nodes_.size() || nodes_[idx].gen != static_cast<u32>(h >> 32))
+            return false;
+        auto &n = nodes_[idx];
+        if (n.state == kInWheel)
+            unlink(idx);
+        else if (n.state != kExpired)
+            return false;
+        // an expired one is skipped by TMIter
+        release(idx);
+        return true;
+    }
+
+    /*!
+     Timeouts not returned by TMIter yet
+    */
+    usize size() const { return nodes_.size() - free_.size(); }
+
+    bool empty() const { return size() == 0; }
+
+    /*!
+     Move the wheels to `now`, collecting the expired timeouts
+    */
+    void advance(const u64 &now)
+    {
+        const u64 target = now >> tick_shift;
+        while (cur_ < target)
+        {
+            if (in_wheel_ == 0)
+            {
+                cur_ = target;
+                break;
+            }
+            u64 next = next_event();
+            cur_ = next < target ? next : target;
+            if ((cur_ & kMask) == 0)
+                cascade();
+            expire_slot(0, cur_ & kMask);
+        }
+    }
 
 public:
-    void enqueue(const u8 &id, const u64 &end_time,const u32 &seq)
+    const usize tick_shift;
+
+private:
+    static const u32 kNil = std::numeric_limits<u32>::max();
+    static const u64 kMask = kSlots - 1;
+
+    enum State : u8
+    {
+        kFree = 0,
+        kInWheel,
+        kExpired
+    };
+
+    struct Node
+    {
+        TMElement e;
+        u64 tick;
+        u32 prev = kNil;
+        u32 next = kNil;
+        u32 gen = 0;
+        u16 slot = 0; // level * kSlots + slot
+        State state = kFree;
+
+        explicit Node(const TMElement &e) : e(e), tick(0) {}
+    };
+
+    // put a node in the wheel by its tick, or expire it if it is due
+    void place(const u32 &idx)
     {
-        q.emplace(id, end_time,seq);
+        auto &n = nodes_[idx];
+        if (n.tick <= cur_)
+        {
+            n.state = kExpired;
+            expired_.push_back((static_cast<u64>(n.gen) << 32) | idx);
+            return;
+        }
+        u64 delta = n.tick - cur_;
+        usize level = 0;
+        while (level + 1 < kLevels && delta >= (1ULL << (kLevelBits * (level + 1))))
+            level += 1;
+        // beyond the top wheel: parked in its farthest slot, and cascaded again later
+        u64 tick = n.tick;
+        const u64 top_range = 1ULL << (kLevelBits * kLevels);
+        if (delta >= top_range)
+            tick = cur_ + top_range - 1;
+        usize slot = (tick >> (kLevelBits * level)) & kMask;
+
+        n.slot = static_cast<u16>(level * kSlots + slot);
+        n.prev = kNil;
+        n.next = heads_[level][slot];
+        if (n.next != kNil)
+            nodes_[n.next].prev = idx;
+        heads_[level][slot] = idx;
+        bits_[level][slot / 64] |= 1ULL << (slot % 64);
+        n.state = kInWheel;
+        in_wheel_ += 1;
+    }
+
+    void unlink(const u32 &idx)
+    {
+        auto &n = nodes_[idx];
+        usize level = n.slot / kSlots;
+        usize slot = n.slot % kSlots;
+        if (n.prev != kNil)
+            nodes_[n.prev].next = n.next;
+        else
+            heads_[level][slot] = n.next;
+        if (n.next != kNil)
+            nodes_[n.next].prev = n.prev;
+        if (heads_[level][slot] == kNil)
+            bits_[level][slot / 64] &= ~(1ULL << (slot % 64));
+        in_wheel_ -= 1;
+    }
+
+    void release(const u32 &idx)
+    {
+        auto &n = nodes_[idx];
+        n.state = kFree;
+        n.gen += 1;
+        free_.push_back(idx);
+    }
+
+    // detach the list of a slot, return its head
+    u32 take_slot(const usize &level, const usize &slot)
+    {
+        u32 head = heads_[level][slot];
+        heads_[level][slot] = kNil;
+        bits_[level][slot / 64] &= ~(1ULL << (slot % 64));
+        return head;
+    }
+
+    void expire_slot(const usize &level, const usize &slot)
+    {
+        for (u32 idx = take_slot(level, slot); idx != kNil;)
+        {
+            u32 next = nodes_[idx].next;
+            in_wheel_ -= 1;
+            nodes_[idx].state = kExpired;
+            expired_.push_back((static_cast<u64>(nodes_[idx].gen) << 32) | idx);
+            idx = next;
+        }
+    }
+
+    // level 0 wraps at cur_: re-place the slots of the upper levels due now, top down
+    void cascade()
+    {
+        usize top = 1;
+        while (top + 1 < kLevels && ((cur_ >> (kLevelBits * top)) & kMask) == 0)
+            top += 1;
+        for (usize level = top; level >= 1; --level)
+        {
+            for (u32 idx = take_slot(level, (cur_ >> (kLevelBits * level)) & kMask); idx != kNil;)
+            {
+                u32 next = nodes_[idx].next;
+                in_wheel_ -= 1;
+                place(idx);
+                idx = next;
+            }
+        }
+    }
+
+    // the first occupied slot of `level` from `from`, kSlots if none
+    usize find_slot(const usize &level, const usize &from) const
+    {
+        for (usize w = from / 64; w < kSlots / 64; ++w)
+        {
+            u64 word = bits_[level][w];
+            if (w == from / 64)
+                word &= ~0ULL << (from % 64);
+            if (word != 0)
+                return w * 64 + __builtin_ctzll(word);
+        }
+        return kSlots;
+    }
+
+    /*!
+     The next tick to process: the tick of an occupied slot ahead in the current round
+     of its level, or the next round of a level holding only the slots behind.
+     So the idle ticks are skipped, however far the next timeout is.
+    */
+    u64 next_event() const
+    {
+        u64 best = std::numeric_limits<u64>::max();
+        for (usize level = 0; level < kLevels; ++level)
+        {
+            const usize shift = kLevelBits * level;
+            const u64 round = 1ULL << (shift + kLevelBits);
+            const u64 base = cur_ & ~(round - 1);
+            usize slot = find_slot(level, ((cur_ >> shift) & kMask) + 1);
+            u64 tick;
+            if (slot < kSlots)
+                tick = base + (static_cast<u64>(slot) << shift);
+            else if (find_slot(level, 0) < kSlots)
+                tick = base + round;
+            else
+                continue;
+            if (tick < best)
+                best = tick;
+        }
+        return best;
     }
+
+    u64 cur_; // the last tick moved to
+
+    std::vector<Node> nodes_;
+    std::vector<u32> free_;
+    usize in_wheel_ = 0;
+
+    u32 heads_[kLevels][kSlots];
+    u64 bits_[kLevels][kSlots / 64];
+
+    // handles of the expired timeouts, in expiry order
+    std::vector<handle_t> expired_;
+    usize expired_head_ = 0;
 };
 
+/*!
+ Iterate over the timeouts expired at `time`, in the order of their ticks.
+*/
 class TMIter
 {
     TM *tm;
-    u64 time;
 
 public:
-    TMIter(TM &t, u64 time) : tm(&t), time(time)
+    TMIter(TM &t, u64 time) : tm(&t)
     {
+        tm->advance(time);
     }
 
     bool valid()
     {
-        return (!tm->q.empty()) && tm->q.top().end_time < time;
+        auto &q = tm->expired_;
+        // skip the cancelled ones
+        while (tm->expired_head_ < q.size())
+        {
+            auto h = q[tm->expired_head_];
+            if (tm->nodes_[static_cast<u32>(h)].gen == static_cast<u32>(h >> 32))
+                return true;
+            tm->expired_head_ += 1;
+        }
+        q.clear();
+        tm->expired_head_ = 0;
+        return false;
     }
 
-    std::pair<u8,u32> next()
+    std::pair<cor_id_t, u32> next()
     {
-        auto id = tm->q.top().cor_id;
-        auto seq = tm->q.top().seq;
-        tm->q.pop();
-        return std::make_pair(id,seq);
+        auto idx = static_cast<u32>(tm->expired_[tm->expired_head_++]);
+        auto &e = tm->nodes_[idx].e;
+        auto res = std::make_pair(e.cor_id, e.seq);
+        tm->release(idx);
+        return res;
     }
 };
 
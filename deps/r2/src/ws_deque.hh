@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "./common.hh"
+
+namespace r2 {
+
+/*!
+  A work-stealing deque of pointers (Chase-Lev, with the C11 orderings of
+  Le et al., PPoPP'13). The owner pushes and takes at the bottom without any
+  atomic RMW in the common case; the thieves take from the top with a CAS.
+  The array doubles when full; the replaced arrays are kept until the deque is
+  destroyed, since a thief may still be reading them.
+ */
+template <typename T> class WSDeque {
+  struct Array {
+    const i64 size;
+    std::unique_ptr<std::atomic<T *>[]> buf;
+
+    explicit Array(i64 size) : size(size), buf(new std::atomic<T *>[size]) {}
+
+    T *get(i64 i) const {
+      return buf[i & (size - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(i64 i, T *v) {
+      buf[i & (size - 1)].store(v, std::memory_order_relaxed);
+    }
+  };
+
+public:
+  explicit WSDeque(i64 capacity = 1024) : top(0), bottom(0) {
+    ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    arrays.emplace_back(new Array(capacity));
+    array.store(arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  /*!
+    Owner only
+   */
+  void push(T *v) {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_acquire);
+    Array *a = array.load(std::memory_order_relaxed);
+    if (unlikely(b - t > a->size - 1))
+      a = grow(a, t, b);
+    a->put(b, v);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /*!
+    Owner only: take the latest pushed one, nullptr if empty
+   */
+  T *take() {
+    i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    Array *a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 t = top.load(std::memory_order_relaxed);
+
+    T *res = nullptr;
+    if (t <= b) {
+      res = a->get(b);
+      if (t == b) {
+        // the last one, race with the thieves
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+          res = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+      }
+    } else {
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return res;
+  }
+
+  /*!
+    Any thread: take the oldest one, nullptr if empty or lost the race
+   */
+  T *steal() {
+    i64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+      return nullptr;
+    Array *a = array.load(std::memory_order_acquire);
+    T *res = a->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return res;
+  }
+
+  /*!
+    A hint, which may be stale once read
+   */
+  i64 size() const {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+private:
+  Array *grow(Array *a, i64 t, i64 b) {
+    auto n = new Array(a->size * 2);
+    for (i64 i = t; i < b; ++i)
+      n->put(i, a->get(i));
+    arrays.emplace_back(n);
+    array.store(n, std::memory_order_release);
+    return n;
+  }
+
+  alignas(kCacheLineSize) std::atomic<i64> top;
+  alignas(kCacheLineSize) std::atomic<i64> bottom;
+  std::atomic<Array *> array;
+  // owner only
+  std::vector<std::unique_ptr<Array>> arrays;
+
+  DISABLE_COPY_AND_ASSIGN(WSDeque);
+};
+
+} // namespace r2
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "../src/channel/mod.hh"
+
+using namespace r2;
+
+namespace test {
+
+TEST(Channel, SPSC) {
+  const u64 num = 100000;
+  Channel<u64> c(64);
+
+  std::thread producer([&c, num]() {
+    u64 next = 0;
+    u64 batch[8];
+    while (next < num) {
+      if (next % 3 == 0) {
+        c.enqueue_blocking(next++);
+        continue;
+      }
+      u64 n = std::min<u64>(8, num - next);
+      for (u64 i = 0; i < n; ++i)
+        batch[i] = next + i;
+      auto done = c.enqueue_n(batch, n);
+      if (done == 0)
+        std::this_thread::yield();
+      next += done;
+    }
+  });
+
+  u64 expected = 0;
+  u64 out[16];
+  while (expected < num) {
+    auto n = c.dequeue_n(out, 16);
+    if (n == 0)
+      std::this_thread::yield();
+    for (u64 i = 0; i < n; ++i)
+      ASSERT_EQ(out[i], expected++);
+  }
+  producer.join();
+  ASSERT_TRUE(c.isEmpty());
+  ASSERT_FALSE(c.dequeue());
+}
+
+TEST(Channel, Full) {
+  Channel<int> c(4);
+  int xs[6] = {0, 1, 2, 3, 4, 5};
+  ASSERT_EQ(c.enqueue_n(xs, 6), 4);
+  ASSERT_FALSE(c.enqueue(6));
+  ASSERT_EQ(c.dequeue_blocking(), 0);
+  ASSERT_TRUE(c.enqueue(6));
+  ASSERT_EQ(c.size(), 4);
+
+  MPMCChannel<int> m(4);
+  ASSERT_EQ(m.enqueue_n(xs, 6), 4);
+  ASSERT_FALSE(m.enqueue(6));
+  ASSERT_EQ(m.dequeue_blocking(), 0);
+  ASSERT_TRUE(m.enqueue(6));
+  int ys[8];
+  ASSERT_EQ(m.dequeue_n(ys, 8), 4);
+  ASSERT_EQ(ys[3], 6);
+  ASSERT_TRUE(m.isEmpty());
+}
+
+TEST(Channel, MPMC) {
+  const u64 producers = 3, consumers = 3, per_producer = 30000;
+  MPMCChannel<u64> c(128);
+  std::vector<std::atomic<u64>> seen(producers * per_producer);
+  std::atomic<u64> received(0);
+
+  std::vector<std::thread> threads;
+  for (u64 p = 0; p < producers; ++p)
+    threads.emplace_back([&c, p, per_producer]() {
+      u64 batch[4];
+      for (u64 i = 0; i < per_producer;) {
+        if (i % 2 == 0) {
+          c.enqueue_blocking(p * per_producer + i++);
+          continue;
+        }
+        u64 n = std::min<u64>(4, per_producer - i);
+        for (u64 j = 0; j < n; ++j)
+          batch[j] = p * per_producer + i + j;
+        auto done = c.enqueue_n(batch, n);
+        if (done == 0)
+          std::this_thread::yield();
+        i += done;
+      }
+    });
+  for (u64 i = 0; i < consumers; ++i)
+    threads.emplace_back([&]() {
+      u64 out[4];
+      while (received.load() < producers * per_producer) {
+        auto n = c.dequeue_n(out, 4);
+        if (n == 0)
+          std::this_thread::yield();
+        for (u64 j = 0; j < n; ++j)
+          seen[out[j]] += 1;
+        received += n;
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+
+  ASSERT_EQ(received.load(), producers * per_producer);
+  for (auto &s : seen)
+    ASSERT_EQ(s.load(), 1);
+}
+
+} // namespace test
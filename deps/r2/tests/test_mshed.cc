@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "../src/mshed.hh"
+
+using namespace r2;
+
+namespace test {
+
+TEST(MSched, Basic) {
+  const usize num = 1024;
+  std::vector<std::atomic<int>> runs(num);
+  std::atomic<usize> done(0);
+
+  MScheduler m(4, 4, false);
+  m.start();
+  for (usize i = 0; i < num; ++i)
+    m.spawn([&runs, &done, i](R2_ASYNC) {
+      runs[i] += 1;
+      R2_YIELD;
+      done += 1;
+    });
+  while (done < num)
+    usleep(100);
+  m.stop();
+
+  u64 executed = 0;
+  for (usize c = 0; c < m.num_cores(); ++c)
+    executed += m.executed(c);
+  ASSERT_EQ(executed, num);
+  for (usize i = 0; i < num; ++i)
+    ASSERT_EQ(runs[i], 1);
+}
+
+TEST(MSched, Steal) {
+  const usize num = 256;
+  std::atomic<usize> done(0);
+
+  MScheduler m(4, 2, false);
+  m.start();
+  // all the tasks are spawned to the deque of core 0
+  m.spawn_on(0, [&m, &done, num](R2_ASYNC) {
+    for (usize i = 0; i < num; ++i)
+      m.spawn([&done](R2_ASYNC) {
+        usleep(200);
+        done += 1;
+      });
+  });
+  while (done < num)
+    usleep(100);
+  m.stop();
+
+  u64 stolen = 0;
+  for (usize c = 1; c < m.num_cores(); ++c)
+    stolen += m.stolen(c);
+  ASSERT_GT(stolen, 0);
+  ASSERT_EQ(m.stolen(0), 0);
+}
+
+TEST(MSched, Affine) {
+  const usize num = 128;
+  std::atomic<usize> done(0);
+  std::atomic<usize> misplaced(0);
+
+  MScheduler m(3, 2, false);
+  m.start();
+  for (usize i = 0; i < num; ++i) {
+    usize core = i % m.num_cores();
+    m.spawn_on(core, [&done, &misplaced, core](R2_ASYNC) {
+      R2_YIELD;
+      if (MScheduler::cur_core() != static_cast<int>(core))
+        misplaced += 1;
+      done += 1;
+    });
+  }
+  while (done < num)
+    usleep(100);
+  m.stop();
+  ASSERT_EQ(misplaced, 0);
+}
+
+} // namespace test
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <thread>
+
+#include "../src/slab.hh"
+
+using namespace r2;
+
+namespace test {
+
+// a fake registration, whose keys tell the node
+static SlabMaster::reg_func_t fake_reg = [](const usize &node, char *,
+                                            const u64 &) -> Option<MRKeys> {
+  MRKeys keys;
+  keys.lkey = 100 + node;
+  keys.rkey = 200 + node;
+  return keys;
+};
+
+TEST(Slab, Basic) {
+  SlabMaster m;
+  ASSERT_TRUE(m.init(2, 8 * SlabMaster::kSlabSize, fake_reg));
+  ASSERT_FALSE(m.init(2, SlabMaster::kSlabSize, fake_reg));
+
+  SlabCache c(m, 1);
+  std::set<void *> ptrs;
+  for (usize sz : {1u, 64u, 65u, 1000u, 4096u, SlabMaster::kMaxObj}) {
+    auto p = static_cast<char *>(c.alloc(sz));
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(m.node_of(p), 1);
+    ASSERT_GE(SlabMaster::class_size(m.class_of(p)), sz);
+    auto keys = m.lookup(p + sz - 1);
+    ASSERT_TRUE(keys);
+    ASSERT_EQ(keys.value().lkey, 101);
+    ASSERT_EQ(keys.value().rkey, 201);
+    memset(p, 0, sz);
+    ASSERT_TRUE(ptrs.insert(p).second);
+  }
+  ASSERT_EQ(c.alloc(SlabMaster::kMaxObj + 1), nullptr);
+  ASSERT_FALSE(m.lookup(&ptrs));
+
+  // a freed object is reused by the cache
+  auto p = c.alloc(128);
+  c.dealloc(p);
+  ASSERT_EQ(c.alloc(128), p);
+}
+
+TEST(Slab, Exhausted) {
+  SlabMaster m;
+  ASSERT_TRUE(m.init(2, SlabMaster::kSlabSize, fake_reg));
+  SlabCache c(m, 0);
+
+  // one slab per node: node 0 first, then node 1
+  const usize num = SlabMaster::kSlabSize / SlabMaster::kMaxObj;
+  std::vector<void *> ptrs;
+  for (usize i = 0; i < 2 * num; ++i) {
+    auto p = c.alloc(SlabMaster::kMaxObj);
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(m.node_of(p), i < num ? 0 : 1);
+    ptrs.push_back(p);
+  }
+  ASSERT_EQ(c.alloc(64), nullptr);
+
+  for (auto p : ptrs)
+    c.dealloc(p);
+  c.flush();
+  ASSERT_NE(c.alloc(SlabMaster::kMaxObj), nullptr);
+}
+
+TEST(Slab, Threads) {
+  SlabMaster m;
+  ASSERT_TRUE(m.init(2, 64 * SlabMaster::kSlabSize, fake_reg));
+
+  const usize per_thread = 20000;
+  std::vector<std::vector<void *>> allocated(4);
+  std::vector<std::thread> threads;
+  for (usize t = 0; t < allocated.size(); ++t)
+    threads.emplace_back([&m, &allocated, t, per_thread]() {
+      SlabCache c(m, t % 2);
+      for (usize i = 0; i < per_thread; ++i) {
+        auto p = static_cast<u64 *>(c.alloc(64 << (i % 4)));
+        ASSERT_NE(p, nullptr);
+        *p = t;
+        if (i % 3 == 0)
+          c.dealloc(p);
+        else
+          allocated[t].push_back(p);
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+
+  std::set<void *> all;
+  for (usize t = 0; t < allocated.size(); ++t)
+    for (auto p : allocated[t]) {
+      ASSERT_EQ(*static_cast<u64 *>(p), t);
+      ASSERT_TRUE(all.insert(p).second);
+    }
+
+  // free the objects of the other node from a single thread
+  SlabCache c(m, 0);
+  for (auto p : allocated[1])
+    c.dealloc(p);
+  c.flush();
+}
+
+} // namespace test
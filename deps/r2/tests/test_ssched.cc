@@ -27,4 +27,162 @@ TEST(SSched, Basic) {
   ASSERT_EQ(12,counter);
 }
 
+TEST(SSched, Many) {
+
+  // far beyond the 8-bit ids
+  const usize num = 4096;
+  usize counter = 0;
+  usize finished = 0;
+  SScheduler ssched;
+  for (uint i = 0; i < num; ++i)
+    ssched.spawn([&counter, &finished, num](R2_ASYNC) {
+      for (uint j = 0; j < 4; ++j) {
+        counter += 1;
+        R2_YIELD;
+      }
+      finished += 1;
+      if (finished == num)
+        R2_STOP();
+      R2_RET;
+    });
+
+  ssched.run();
+  ASSERT_EQ(num * 4, counter);
+}
+
+/*!
+  A source completing one request of each waiting coroutine per poll
+ */
+struct FakeSource {
+  std::vector<Routine::id_t> waiting;
+  usize polls = 0;
+};
+
+class FakePoller : public Poller {
+  FakeSource *src;
+
+public:
+  explicit FakePoller(FakeSource *src) : src(src) {}
+
+  void poll(SScheduler &s) override {
+    src->polls += 1;
+    auto done = std::move(src->waiting);
+    src->waiting.clear();
+    for (auto id : done)
+      s.complete(id, 1);
+  }
+};
+
+TEST(SSched, SharedPoller) {
+
+  const usize num = 1000;
+  usize finished = 0;
+  FakeSource src;
+  SScheduler ssched;
+  for (uint i = 0; i < num; ++i)
+    ssched.spawn([&src, &finished, num](R2_ASYNC) {
+      for (uint j = 0; j < 3; ++j) {
+        R2_EXECUTOR.shared_poller<FakePoller>(&src);
+        src.waiting.push_back(R2_COR_ID());
+        auto ret = R2_WAIT_NUM(1);
+        ASSERT(ret == IOCode::Ok);
+      }
+      finished += 1;
+      if (finished == num)
+        R2_STOP();
+      R2_RET;
+    });
+
+  ssched.run();
+  ASSERT_EQ(num, finished);
+  // one poll serves all the waiting coroutines
+  ASSERT_LE(src.polls, 8);
+}
+
+TEST(SSched, RemovePoller) {
+
+  FakeSource src;
+  usize polls_at_removal = 0;
+  SScheduler ssched;
+  ssched.spawn([&src, &polls_at_removal](R2_ASYNC) {
+    R2_EXECUTOR.shared_poller<FakePoller>(&src);
+    src.waiting.push_back(R2_COR_ID());
+    ASSERT(R2_WAIT_NUM(1) == IOCode::Ok);
+
+    // e.g., by the owner before freeing the source
+    R2_EXECUTOR.remove_poller(&src);
+    polls_at_removal = src.polls;
+    for (uint i = 0; i < 8; ++i)
+      R2_YIELD;
+    ASSERT(src.polls == polls_at_removal);
+
+    // registered again, with a new poller
+    R2_EXECUTOR.shared_poller<FakePoller>(&src);
+    src.waiting.push_back(R2_COR_ID());
+    ASSERT(R2_WAIT_NUM(1) == IOCode::Ok);
+    R2_STOP();
+    R2_RET;
+  });
+
+  ssched.run();
+  ASSERT_GT(polls_at_removal, 0);
+  ASSERT_GT(src.polls, polls_at_removal);
+}
+
+/*!
+  A poller of a source owned elsewhere, by a weak_ptr
+ */
+class WeakFakePoller : public Poller {
+  std::weak_ptr<FakeSource> src;
+
+public:
+  static usize dropped;
+
+  explicit WeakFakePoller(const std::shared_ptr<FakeSource> &src) : src(src) {}
+
+  ~WeakFakePoller() { dropped += 1; }
+
+  bool expired() const override { return src.expired(); }
+
+  void poll(SScheduler &s) override {
+    auto p = src.lock();
+    if (!p)
+      return;
+    auto done = std::move(p->waiting);
+    p->waiting.clear();
+    for (auto id : done)
+      s.complete(id, 1);
+  }
+};
+
+usize WeakFakePoller::dropped = 0;
+
+TEST(SSched, ExpiredPoller) {
+
+  SScheduler ssched;
+  ssched.spawn([](R2_ASYNC) {
+    auto src = std::make_shared<FakeSource>();
+    R2_EXECUTOR.shared_poller<WeakFakePoller>(src);
+    src->waiting.push_back(R2_COR_ID());
+    ASSERT(R2_WAIT_NUM(1) == IOCode::Ok);
+
+    // freed by its owner, without telling the scheduler
+    src.reset();
+    for (uint i = 0; i < 4; ++i)
+      R2_YIELD;
+    ASSERT(WeakFakePoller::dropped == 1);
+
+    // a new source, maybe at the same address, gets its own poller
+    src = std::make_shared<FakeSource>();
+    R2_EXECUTOR.shared_poller<WeakFakePoller>(src);
+    src->waiting.push_back(R2_COR_ID());
+    ASSERT(R2_WAIT_NUM(1) == IOCode::Ok);
+    R2_STOP();
+    R2_RET;
+  });
+
+  ssched.run();
+  ASSERT_EQ(1, WeakFakePoller::dropped);
+}
+
 } // namespace test
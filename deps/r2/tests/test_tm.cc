@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../src/tm_manager.hh"
+
+using namespace r2;
+
+namespace test {
+
+// one tick per cycle, so that the tests control the time
+static std::vector<cor_id_t> expire(TM &tm, u64 time) {
+  std::vector<cor_id_t> res;
+  for (TMIter it(tm, time); it.valid();)
+    res.push_back(it.next().first);
+  return res;
+}
+
+TEST(TM, Basic) {
+  TM tm(0, 0);
+  for (uint i = 0; i < 12; ++i)
+    tm.enqueue(i, 100 + i * 10, i);
+  ASSERT_EQ(tm.size(), 12);
+
+  // never before end_time
+  ASSERT_TRUE(expire(tm, 100).empty());
+  auto res = expire(tm, 101);
+  ASSERT_EQ(res.size(), 1);
+  ASSERT_EQ(res[0], 0);
+
+  res = expire(tm, 1000);
+  ASSERT_EQ(res.size(), 11);
+  ASSERT_TRUE(tm.empty());
+}
+
+TEST(TM, Cancel) {
+  TM tm(0, 0);
+  auto h0 = tm.enqueue(0, 50, 0);
+  auto h1 = tm.enqueue(1, 50, 0);
+  tm.enqueue(2, 50, 0);
+  ASSERT_TRUE(tm.cancel(h1));
+  ASSERT_FALSE(tm.cancel(h1));
+
+  // an expired timeout is cancelled before it is iterated
+  tm.advance(60);
+  ASSERT_TRUE(tm.cancel(h0));
+  auto res = expire(tm, 60);
+  ASSERT_EQ(res.size(), 1);
+  ASSERT_EQ(res[0], 2);
+
+  // a reused slot is not cancelled by a stale handle
+  tm.enqueue(3, 100, 0);
+  ASSERT_FALSE(tm.cancel(h0));
+  ASSERT_EQ(tm.size(), 1);
+}
+
+TEST(TM, Levels) {
+  TM tm(0, 7);
+  // across all the levels, and beyond the top one
+  std::vector<u64> ends = {8, 300, 70000, 20000000, 5000000000ULL, 1ULL << 40};
+  for (uint i = 0; i < ends.size(); ++i)
+    tm.enqueue(i + 1000, ends[i], i);
+
+  u64 now = 7;
+  std::vector<cor_id_t> order;
+  for (uint i = 0; i < ends.size(); ++i) {
+    ASSERT_TRUE(expire(tm, ends[i]).empty());
+    auto res = expire(tm, ends[i] + 1);
+    ASSERT_EQ(res.size(), 1) << "end time " << ends[i];
+    ASSERT_EQ(res[0], i + 1000);
+    now = ends[i] + 1;
+  }
+  ASSERT_TRUE(tm.empty());
+  ASSERT_TRUE(expire(tm, now + 1000).empty());
+}
+
+TEST(TM, Many) {
+  TM tm(4, 0);
+  const uint num = 50000;
+  std::vector<TM::handle_t> handles;
+  for (uint i = 0; i < num; ++i)
+    handles.push_back(tm.enqueue(i, (i * 7919) % 100000, i));
+  for (uint i = 0; i < num; i += 2)
+    ASSERT_TRUE(tm.cancel(handles[i]));
+
+  std::vector<cor_id_t> res;
+  for (u64 t = 0; t < 110000; t += 997) {
+    auto batch = expire(tm, t);
+    res.insert(res.end(), batch.begin(), batch.end());
+  }
+  ASSERT_EQ(res.size(), num / 2);
+  std::sort(res.begin(), res.end());
+  for (uint i = 0; i < res.size(); ++i)
+    ASSERT_EQ(res[i], i * 2 + 1);
+}
+
+} // namespace test
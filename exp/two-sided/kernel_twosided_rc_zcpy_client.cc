@@ -127,11 +127,12 @@ worker_fn(const usize& worker_id, Statics* s)
     const int port = FLAGS_port + worker_id;
     qconnect(qd, gid_str, strlen(gid_str), port, vid);
     core_req_t req_list[FLAGS_or_sz];
-    bool large_msg = FLAGS_payload_sz >= 1024 * 64; // we name Large Message as the payload size larger than 64K
+    // large messages (>= 64K) are sent by the kernel's rendezvous protocol
+    bool large_msg = FLAGS_payload_sz >= 1024 * 64;
 
     for (int i = 0; i < FLAGS_or_sz; ++i) {
         req_list[i] = { .addr = 32,
-                .length = large_msg ? 8 : FLAGS_payload_sz,
+                .length = FLAGS_payload_sz,
                 .lkey = 32,
                 .remote_addr = 2048,
                 .rkey = 32,
@@ -100,7 +100,6 @@ usize
 worker_fn(const usize& worker_id, Statics* s)
 {
     int qd = queue();
-    int read_qd = queue();
     int res = 0;
     int vid = 0;
     const int req_len = FLAGS_or_sz;
@@ -114,21 +113,9 @@ worker_fn(const usize& worker_id, Statics* s)
     const char* gid_str = FLAGS_gid.c_str();
     const int port = FLAGS_port + worker_id;
     assert(1 == qbind(qd, port));
-    qconnect(read_qd, gid_str, strlen(gid_str), port, vid);
 
     core_req_t req_list[req_len];
 
-    core_req_t read_req = {
-            .addr = 1024,
-            .length = FLAGS_payload_sz,
-            .lkey = 32,
-            .remote_addr = 2048,
-            .rkey = 32,
-            .send_flags = 1,
-            .vid = 0,
-            .type = Read,
-    };
-
     for (int i = 0; i < req_len; ++i) {
         req_list[i] = { .addr = 1024,
                 .length = 0,
@@ -140,19 +127,17 @@ worker_fn(const usize& worker_id, Statics* s)
                 .type = SendImm };
     }
     push_core_req_t req;
-    bool large_msg = FLAGS_payload_sz >= 1024 * 64; // we name Large Message as the payload size larger than 64K
+    // large messages (>= 64K) are transferred by the kernel's rendezvous protocol,
+    // i.e., the i-th payload has been read into the i-th slot of `payloads` before qpop_msgs returns
+    bool large_msg = FLAGS_payload_sz >= 1024 * 64;
+    std::vector<char> payloads(large_msg ? FLAGS_or_sz * FLAGS_payload_sz : 0);
     while (running) {
         reply.pop_count = 0;
-        if (qpop_msgs(qd, &reply, FLAGS_or_sz , large_msg ? 0 : FLAGS_payload_sz) == ok &&
+        if (qpop_msgs(qd, &reply, FLAGS_or_sz, FLAGS_payload_sz,
+                      large_msg ? payloads.data() : nullptr) == ok &&
             reply.pop_count > 0) { // accept and poll recv cq
             int act_pop_cnt = reply.pop_count;
             assert(act_pop_cnt <= FLAGS_or_sz);
-#if 1
-            if (large_msg) {
-                req = { .req_len = act_pop_cnt, .req_list = &read_req };
-                assert(1 == qpush(read_qd, &req, 1, 0));
-            }
-#endif
 
             for (int i = 0; i < act_pop_cnt; ++i) {
                 vid = reply.wc[i].imm_data;
@@ -23,6 +23,10 @@ enum lib_r_cmd {
     UnBinds,
     RegMRs,
     RpcPoll,
+    SetShare,
+    QueryStats,
+    SetBatch,
+    Flush,
 };
 
 enum reply_status {
@@ -73,13 +77,21 @@ typedef struct {
     // remote params
     unsigned long long remote_addr;
     unsigned int rkey;
-    unsigned int send_flags;
+    unsigned int send_flags;    // bits of `req_flags`
 
     unsigned int vid;           // extended for twosided
     enum lib_r_req type; // RDMA request type
+    unsigned long long cookie;  // returned in `wc_wr_id` of the completion of a signaled request
 } core_req_t;
 
 
+/* Bits of `core_req_t.send_flags` */
+enum req_flags {
+    req_signaled = 1,       // generate a completion
+    req_fence = 1 << 1,     // start after the prior READs of the VQ have completed
+    req_user_buf = 1 << 2,  // `addr` is a user va in the region registered by `qreg_mr` with the hint `lkey`
+};
+
 typedef struct {
     unsigned int req_len;            // length of request element
     core_req_t *req_list;   // first request element address
@@ -103,7 +115,8 @@ typedef struct {
     unsigned int wc_op;     // ib_wc_op, should match the request QP
     unsigned int wc_status; // ib_wc_ok, etc
     unsigned int imm_data;
-    unsigned long long wc_wr_id;
+    unsigned int byte_len;  // bytes received, for a receive
+    unsigned long long wc_wr_id;    // `cookie` of the request, or the buffer address of a receive
 } user_wc_t;
 
 enum wc_consts {
@@ -150,14 +163,126 @@ typedef struct {
     req_t req;
     unsigned int pop_count;
     unsigned int payload_sz;
+    void *payload_buf;      // nullptr, or `pop_count * payload_sz` bytes for the payloads,
+                            // required by the rendezvous (>= 64KB) messages, which land there
 } pop_msgs_t ;
 
+/* User supplied receive buffer.
+ * The buffer must lie in a region registered by `qreg_mr` with the same hint,
+ * and must be physically contiguous (i.e., within one page or a huge page).
+ * The completion of the receive carries `addr` in `wc_wr_id`. */
+typedef struct {
+    unsigned long long addr;    // user virtual address of the buffer
+    unsigned int length;        // buffer length
+    unsigned int hint;          // mr hint used in qreg_mr
+} recv_buf_t;
+
 typedef struct {
     int push_count;
+    recv_buf_t *bufs;       // nullptr: use the kernel receive buffer
 } push_recv_t;
 
 typedef struct {
     req_t req;
     push_recv_t push_recv;
 } push_recv_req_t;
+
+/* Share of the physical QP shared with other queues */
+typedef struct {
+    unsigned int weight;                    // DRR weight, 0 resets to the default (1)
+    unsigned long long max_bytes_per_sec;   // rate limit, 0 means unlimited
+} share_t;
+
+typedef struct {
+    req_t req;
+    share_t share;
+} share_req_t;
+
+/* Chunk size of the push, i.e., the max requests posted at once */
+enum batch_consts {
+    batch_adaptive = 0,     // tuned by the kernel upon the send queue occupancy and latency
+    batch_max_chunk = 256,
+};
+
+typedef struct {
+    unsigned int chunk;     // 1 ~ batch_max_chunk, or batch_adaptive
+} batch_t;
+
+typedef struct {
+    req_t req;
+    batch_t batch;
+} batch_req_t;
+
+/* Statistics */
+enum stats_counter {
+    // requests by type, in the order of `lib_r_req`
+    StatRead = 0,
+    StatWrite,
+    StatSend,
+    StatSendImm,
+    StatWriteImm,
+    StatBytes,          // payload bytes of the requests
+    StatBatches,        // posted batches (one per 64 requests at most)
+    StatSignaled,
+    StatUnsignaled,
+    StatPopEmpty,       // pops which found no completion
+    StatPathRC,         // requests posted by path
+    StatPathDC,
+    StatPathUD,
+    StatMigrations,     // DC => RC migrations and RC => DC fallbacks
+    StatErrors,
+    StatCounterNum,
+};
+
+enum stats_scope {
+    StatsVQ = 0,        // the queue of the qd
+    StatsNIC,           // all the queues on one NIC, summed over the CPUs
+    StatsStages,        // latency histograms of the stages, see `stage_hists_t`
+};
+
+typedef struct {
+    unsigned long long counters[StatCounterNum];
+} stats_t;
+
+typedef struct {
+    int scope;
+    unsigned int nic;
+} query_stats_t;
+
+typedef struct {
+    req_t req;
+    query_stats_t query;
+} query_stats_req_t;
+
+typedef struct {
+    reply_t header;
+    stats_t stats;
+} stats_reply_t;
+
+/* Stages of push / pop, profiled if the module param `profile_stages` is set */
+enum stats_stage {
+    StageCopyIn = 0,    // ioctl entry (or the last stage) => the request copied from the user
+    StageBuild,         // building the work requests
+    StagePost,          // posting the work requests to the NIC
+    StageComp,          // waiting for the completions
+    StageCopyOut,       // copying the results to the user
+    StageTotal,         // ioctl entry => return
+    StageNum,
+};
+
+enum stats_hist_consts {
+    hist_bucket_num = 64,
+};
+
+typedef struct {
+    unsigned long long tsc_khz;     // TSC cycles per msec
+    // buckets[s][i] counts the samples of stage s that take [2^(i-1), 2^i) cycles,
+    // bucket 0 counts the ones of 0 cycle
+    unsigned long long buckets[StageNum][hist_bucket_num];
+} stage_hists_t;
+
+typedef struct {
+    reply_t header;
+    stage_hists_t hists;
+} stage_hists_reply_t;
 #endif
\ No newline at end of file
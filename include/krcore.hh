@@ -0,0 +1,264 @@
+#pragma once
+
+/*!
+  A header-only C++17 layer over syscall.h.
+
+  - `krcore::Queue`: owns a qd (closed on destruction), move-only.
+  - `krcore::Batch<N>`: up to N requests built in place, pushed with one `qpush`.
+  - `krcore::CompletionRing`: a reusable pop buffer, iterated over the popped entries only.
+
+  Nothing here allocates per operation: a batch lives wherever it is declared, and a ring
+  allocates its buffer once. e.g.,
+
+    auto q = krcore::Queue::open();
+    q.connect(gid);
+    krcore::Batch<16> batch;
+    batch.read(0, 4096, 64, cookie);
+    batch.signal_last();
+    q.push(batch);
+    krcore::CompletionRing ring;
+    while (q.pop(ring) == nil) {}
+    for (auto &wc : ring) { ... wc.wc_wr_id == cookie ... }
+ */
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#include "./syscall.h"
+
+namespace krcore {
+
+/*!
+  Completions popped by `Queue::pop` / `Queue::pop_msgs`.
+  The kernel writes the pop count behind all the `pop_wc_len` slots of a `pop_reply_t`,
+  so the buffer always has the full size; it is allocated once and never zeroed, and only
+  the popped entries are visited.
+ */
+class CompletionRing {
+public:
+    CompletionRing() : reply_(new pop_reply_t) {}
+
+    CompletionRing(CompletionRing &&) noexcept = default;
+
+    CompletionRing &operator=(CompletionRing &&) noexcept = default;
+
+    CompletionRing(const CompletionRing &) = delete;
+
+    CompletionRing &operator=(const CompletionRing &) = delete;
+
+    static constexpr std::size_t capacity() { return pop_wc_len; }
+
+    std::size_t size() const { return count_ - head_; }
+
+    bool empty() const { return size() == 0; }
+
+    const user_wc_t *begin() const { return reply_->wc + head_; }
+
+    const user_wc_t *end() const { return reply_->wc + count_; }
+
+    /// Take the oldest unvisited completion, nullptr if none
+    const user_wc_t *next() {
+        if (empty()) {
+            return nullptr;
+        }
+        return &reply_->wc[head_++];
+    }
+
+    void clear() { head_ = count_ = 0; }
+
+    pop_reply_t *raw() { return reply_.get(); }
+
+private:
+    friend class Queue;
+
+    // make the entries popped by the last call visible
+    int fill(int status, unsigned int count) {
+        head_ = 0;
+        count_ = status == ok ? count : 0;
+        return status;
+    }
+
+    std::unique_ptr<pop_reply_t> reply_;
+    unsigned int head_ = 0;
+    unsigned int count_ = 0;
+};
+
+/*!
+  At most N requests, built in place and pushed at once.
+  The local / remote addresses are offsets in the registered regions, as in `core_req_t`.
+ */
+template <std::size_t N>
+class Batch {
+    static_assert(N > 0, "an empty batch");
+
+public:
+    static constexpr std::size_t capacity() { return N; }
+
+    std::size_t size() const { return len_; }
+
+    bool empty() const { return len_ == 0; }
+
+    bool full() const { return len_ == N; }
+
+    void clear() { len_ = 0; }
+
+    core_req_t *data() { return reqs_.data(); }
+
+    const core_req_t &operator[](std::size_t i) const { return reqs_[i]; }
+
+    /// Append one request, return false if the batch is full
+    bool add(lib_r_req type, unsigned long long local, unsigned int length,
+             unsigned long long remote, unsigned long long cookie = 0,
+             unsigned int flags = 0, unsigned int vid = 0) {
+        if (full()) {
+            return false;
+        }
+        core_req_t &req = reqs_[len_++];
+        req.addr = local;
+        req.length = length;
+        req.lkey = 0;
+        req.remote_addr = remote;
+        req.rkey = 0;
+        req.send_flags = flags;
+        req.vid = vid;
+        req.type = type;
+        req.cookie = cookie;
+        return true;
+    }
+
+    bool read(unsigned long long local, unsigned long long remote, unsigned int length,
+              unsigned long long cookie = 0, unsigned int flags = 0) {
+        return add(Read, local, length, remote, cookie, flags);
+    }
+
+    bool write(unsigned long long local, unsigned long long remote, unsigned int length,
+               unsigned long long cookie = 0, unsigned int flags = 0) {
+        return add(Write, local, length, remote, cookie, flags);
+    }
+
+    bool send(unsigned long long local, unsigned int length, unsigned int vid = 0,
+              unsigned long long cookie = 0, unsigned int flags = 0) {
+        return add(Send, local, length, 0, cookie, flags, vid);
+    }
+
+    /// Request a completion for the last request, which covers the whole batch on an RC
+    void signal_last() {
+        if (!empty()) {
+            reqs_[len_ - 1].send_flags |= req_signaled;
+        }
+    }
+
+    /// Start the last request after the prior READs of the queue have completed
+    void fence_last() {
+        if (!empty()) {
+            reqs_[len_ - 1].send_flags |= req_fence;
+        }
+    }
+
+private:
+    std::array<core_req_t, N> reqs_;
+    std::size_t len_ = 0;
+};
+
+/*!
+  An owned qd. The methods return the `reply_status` of the call, or -1 if the ioctl fails.
+ */
+class Queue {
+public:
+    Queue() = default;
+
+    explicit Queue(int qd) : qd_(qd) {}
+
+    ~Queue() { reset(); }
+
+    Queue(Queue &&other) noexcept : qd_(std::exchange(other.qd_, -1)) {}
+
+    Queue &operator=(Queue &&other) noexcept {
+        if (this != &other) {
+            reset(std::exchange(other.qd_, -1));
+        }
+        return *this;
+    }
+
+    Queue(const Queue &) = delete;
+
+    Queue &operator=(const Queue &) = delete;
+
+    /// Open a new queue, check `valid()` for the result
+    static Queue open() { return Queue(queue()); }
+
+    bool valid() const { return qd_ >= 0; }
+
+    explicit operator bool() const { return valid(); }
+
+    int fd() const { return qd_; }
+
+    /// Give up the ownership of the qd
+    int release() { return std::exchange(qd_, -1); }
+
+    void reset(int qd = -1) {
+        if (qd_ >= 0) {
+            close(qd_);
+        }
+        qd_ = qd;
+    }
+
+    /// `gid` in the format of `ibstatus`, e.g., fe80:0000:0000:0000:ec0d:9a03:00ca:2f4c
+    int connect(std::string_view gid, int port = 0, int vid = 0) {
+        return qconnect(qd_, gid.data(), static_cast<int>(gid.size()), port, vid);
+    }
+
+    int bind(int port) { return qbind(qd_, port); }
+
+    int unbind(int port) { return qunbind(qd_, port); }
+
+    int reg_mr(unsigned long long address, unsigned int size, unsigned int hint) {
+        return qreg_mr(qd_, address, size, hint);
+    }
+
+    int push(core_req_t *reqs, std::size_t len, bool wait = false) {
+        push_core_req_t core = {.req_len = static_cast<unsigned int>(len), .req_list = reqs};
+        return qpush(qd_, &core, wait ? 1 : 0);
+    }
+
+    /// Push all the requests of `batch`, waiting for the signaled one if `wait`
+    template <std::size_t N>
+    int push(Batch<N> &batch, bool wait = false) {
+        return push(batch.data(), batch.size(), wait);
+    }
+
+    int push_recv(unsigned int count, recv_buf_t *bufs = nullptr) {
+        return qpush_recv(qd_, count, bufs);
+    }
+
+    /// Pop one completion into `ring`, `nil` if there is none
+    int pop(CompletionRing &ring, int vid = 0) {
+        return ring.fill(qpop(qd_, ring.raw(), vid), 1);
+    }
+
+    /// Pop at most `count` messages into `ring`, copying their payloads to `payload_buf` if set
+    int pop_msgs(CompletionRing &ring, unsigned int count = CompletionRing::capacity(),
+                 unsigned int payload_sz = 0, void *payload_buf = nullptr) {
+        if (count > CompletionRing::capacity()) {
+            count = CompletionRing::capacity();
+        }
+        int status = qpop_msgs(qd_, ring.raw(), count, payload_sz, payload_buf);
+        return ring.fill(status, status == ok ? ring.raw()->pop_count : 0);
+    }
+
+    int flush() { return qflush(qd_); }
+
+    int set_batch(unsigned int chunk = batch_adaptive) { return qset_batch(qd_, chunk); }
+
+    int set_share(unsigned int weight, unsigned long long max_bytes_per_sec = 0) {
+        return qset_share(qd_, weight, max_bytes_per_sec);
+    }
+
+private:
+    int qd_ = -1;
+};
+
+} // namespace krcore
@@ -0,0 +1,321 @@
+#pragma once
+
+/*!
+  C++20 coroutines over a krcore::Queue (-std=c++20, or -fcoroutines on GCC 10).
+
+  A `Reactor` drives the coroutines spawned on it from a single thread. The requests
+  awaited during one scheduling round are pushed with a single `qpush`; each carries the
+  cookie of its awaiter, so the completions popped afterwards resume exactly the coroutine
+  whose request completed, and any number of requests can be outstanding. e.g.,
+
+    krcore::co::Task
+    reader(krcore::co::Reactor &r, unsigned long long off) {
+        auto res = co_await r.read(0, off, 64);
+        if (!res.ok()) { ... }
+    }
+
+    krcore::co::Reactor r(q);
+    for (int i = 0; i < 256; ++i) r.spawn(reader(r, i * 64));
+    r.run();   // until all of them return
+
+  `recv()` hands the messages of `qpop_msgs` to the receiving coroutines in FIFO order;
+  the receives are still posted by the user (`Queue::push_recv`).
+ */
+
+#include "./krcore.hh"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+namespace krcore::co {
+
+class Reactor;
+
+struct Result {
+    int status;     // reply_status of the push / pop carrying the request
+    user_wc_t wc;   // its completion, valid if `status` is ok
+
+    bool ok() const { return status == ::ok && wc.wc_status == 0; }
+};
+
+/*!
+  A coroutine spawned on a reactor. It starts on `Reactor::spawn`, and its frame is freed
+  once it returns.
+ */
+class Task {
+public:
+    struct promise_type {
+        Reactor *reactor = nullptr;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { std::terminate(); }
+
+        ~promise_type();
+    };
+
+    Task(Task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+
+    Task(const Task &) = delete;
+
+    // a task never spawned is dropped here
+    ~Task() {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+private:
+    friend class Reactor;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+/// `co_await` a one-sided (or send) request, resumed with its completion
+class OpAwaiter {
+public:
+    OpAwaiter(Reactor *r, const core_req_t &req) : r_(r), req_(req) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h);
+
+    Result await_resume() const noexcept { return res_; }
+
+private:
+    friend class Reactor;
+
+    Reactor *r_;
+    core_req_t req_;
+    std::coroutine_handle<> h_;
+    Result res_ = {};
+};
+
+/// `co_await` one incoming message
+class RecvAwaiter {
+public:
+    explicit RecvAwaiter(Reactor *r) : r_(r) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h);
+
+    Result await_resume() const noexcept { return res_; }
+
+private:
+    friend class Reactor;
+
+    Reactor *r_;
+    std::coroutine_handle<> h_;
+    Result res_ = {};
+};
+
+class Reactor {
+public:
+    /// `payload_sz` is passed to `qpop_msgs` for the received messages
+    explicit Reactor(Queue &q, unsigned int payload_sz = 0) : q_(q), payload_sz_(payload_sz) {}
+
+    Reactor(const Reactor &) = delete;
+
+    Reactor &operator=(const Reactor &) = delete;
+
+    /// Start `task`, which runs until its first `co_await`
+    void spawn(Task task) {
+        auto h = std::exchange(task.h_, {});
+        h.promise().reactor = this;
+        alive_ += 1;
+        h.resume();
+    }
+
+    OpAwaiter read(unsigned long long local, unsigned long long remote, unsigned int length,
+                   unsigned int flags = 0) {
+        return OpAwaiter(this, make_req(Read, local, length, remote, flags, 0));
+    }
+
+    OpAwaiter write(unsigned long long local, unsigned long long remote, unsigned int length,
+                    unsigned int flags = 0) {
+        return OpAwaiter(this, make_req(Write, local, length, remote, flags, 0));
+    }
+
+    OpAwaiter send(unsigned long long local, unsigned int length, unsigned int vid = 0) {
+        return OpAwaiter(this, make_req(Send, local, length, 0, 0, vid));
+    }
+
+    RecvAwaiter recv() { return RecvAwaiter(this); }
+
+    /// Coroutines spawned and not returned yet
+    std::size_t alive() const { return alive_; }
+
+    /// Requests pushed and not completed yet
+    std::size_t outstanding() const { return inflight_; }
+
+    /*!
+      One scheduling round: push the requests awaited since the last round, then resume
+      the coroutines whose requests completed, and the receivers of the popped messages.
+     */
+    void poll() {
+        submit();
+        reap();
+        reap_msgs();
+    }
+
+    /// Poll until all the spawned coroutines have returned
+    void run() {
+        while (alive_ > 0) {
+            poll();
+        }
+    }
+
+private:
+    friend class OpAwaiter;
+    friend class RecvAwaiter;
+    friend struct Task::promise_type;
+
+    // the cookie of a request is (generation << 32) | (slot index + 1), so that a late
+    // completion of a failed push never wakes the next user of the slot
+    struct Slot {
+        OpAwaiter *op;
+        std::uint32_t gen;
+    };
+
+    static core_req_t make_req(lib_r_req type, unsigned long long local, unsigned int length,
+                               unsigned long long remote, unsigned int flags, unsigned int vid) {
+        core_req_t req = {};
+        req.addr = local;
+        req.length = length;
+        req.remote_addr = remote;
+        req.send_flags = flags | req_signaled;
+        req.vid = vid;
+        req.type = type;
+        return req;
+    }
+
+    void enqueue(OpAwaiter *op) {
+        std::uint32_t idx;
+        if (!free_.empty()) {
+            idx = free_.back();
+            free_.pop_back();
+        } else {
+            idx = static_cast<std::uint32_t>(slots_.size());
+            slots_.push_back({nullptr, 0});
+        }
+        slots_[idx].op = op;
+        op->req_.cookie = (static_cast<unsigned long long>(slots_[idx].gen) << 32) | (idx + 1);
+        pending_.push_back(op->req_);
+    }
+
+    void enqueue(RecvAwaiter *recv) { receivers_.push_back(recv); }
+
+    /// Resume the awaiter of `cookie`, return false if it is not waiting
+    bool complete(unsigned long long cookie, const Result &res) {
+        std::uint32_t idx = static_cast<std::uint32_t>(cookie) - 1;
+        if (idx >= slots_.size() || slots_[idx].op == nullptr ||
+            slots_[idx].gen != static_cast<std::uint32_t>(cookie >> 32)) {
+            return false;
+        }
+        OpAwaiter *op = std::exchange(slots_[idx].op, nullptr);
+        slots_[idx].gen += 1;
+        free_.push_back(idx);
+        op->res_ = res;
+        op->h_.resume();
+        return true;
+    }
+
+    void submit() {
+        if (pending_.empty()) {
+            return;
+        }
+        // the resumed coroutines may await again, into the next round
+        std::swap(pending_, round_);
+        int status = q_.push(round_.data(), round_.size());
+        if (status == ok) {
+            inflight_ += round_.size();
+        } else {
+            for (auto &req : round_) {
+                complete(req.cookie, Result{status, {}});
+            }
+        }
+        round_.clear();
+    }
+
+    void reap() {
+        // each pop returns one completion
+        while (inflight_ > 0 && q_.pop(ring_) == ok) {
+            while (auto wc = ring_.next()) {
+                // a late completion of a failed push is dropped
+                if (complete(wc->wc_wr_id, Result{ok, *wc})) {
+                    inflight_ -= 1;
+                }
+            }
+        }
+    }
+
+    void reap_msgs() {
+        if (receivers_.empty()) {
+            return;
+        }
+        std::swap(receivers_, recv_round_);
+        std::size_t served = 0;
+        if (q_.pop_msgs(ring_, static_cast<unsigned int>(recv_round_.size()), payload_sz_) == ok) {
+            while (auto wc = ring_.next()) {
+                recv_round_[served++]->res_ = Result{ok, *wc};
+            }
+        }
+        // the others keep their place ahead of the receivers of the next round
+        receivers_.insert(receivers_.end(), recv_round_.begin() + served, recv_round_.end());
+        for (std::size_t i = 0; i < served; ++i) {
+            recv_round_[i]->h_.resume();
+        }
+        recv_round_.clear();
+    }
+
+    Queue &q_;
+    unsigned int payload_sz_;
+    std::size_t alive_ = 0;
+    std::size_t inflight_ = 0;
+
+    std::vector<Slot> slots_;
+    std::vector<std::uint32_t> free_;
+    // requests of the current round, and the ones being pushed
+    std::vector<core_req_t> pending_;
+    std::vector<core_req_t> round_;
+    std::vector<RecvAwaiter *> receivers_;
+    std::vector<RecvAwaiter *> recv_round_;
+    CompletionRing ring_;
+};
+
+inline Task::promise_type::~promise_type() {
+    if (reactor != nullptr) {
+        reactor->alive_ -= 1;
+    }
+}
+
+inline void
+OpAwaiter::await_suspend(std::coroutine_handle<> h) {
+    h_ = h;
+    r_->enqueue(this);
+}
+
+inline void
+RecvAwaiter::await_suspend(std::coroutine_handle<> h) {
+    h_ = h;
+    r_->enqueue(this);
+}
+
+} // namespace krcore::co
+
+#endif // __cpp_impl_coroutine
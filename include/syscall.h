@@ -1,3 +1,5 @@
+#pragma once
+
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,6 +8,30 @@
 
 #include "./common.h"
 
+/*!
+  USDT probes (provider `krcore`) at the entry and the return of qpush / qpop / qpop_msgs.
+  `qpush` fires once per batch with its length, then `qpush_req` once per request of it,
+  e.g., `bpftrace -e 'usdt:./app:krcore:qpush_req { @[arg2] = hist(arg3); }'`.
+  They are nops until attached, and compiled out if <sys/sdt.h> (systemtap-sdt-dev)
+  is absent or KRCORE_NO_USDT is defined.
+ */
+#if !defined(KRCORE_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define KRCORE_USDT 1
+#endif
+#endif
+
+#ifdef KRCORE_USDT
+#define KRCORE_PROBE2(name, a1, a2) DTRACE_PROBE2(krcore, name, a1, a2)
+#define KRCORE_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(krcore, name, a1, a2, a3)
+#define KRCORE_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(krcore, name, a1, a2, a3, a4, a5)
+#else
+#define KRCORE_PROBE2(name, a1, a2) do {} while (0)
+#define KRCORE_PROBE3(name, a1, a2, a3) do {} while (0)
+#define KRCORE_PROBE5(name, a1, a2, a3, a4, a5) do {} while (0)
+#endif
+
 static inline int
 queue() {
     return open("/dev/krdma", O_WRONLY);
@@ -68,6 +94,10 @@ qreg_mr(int qd, unsigned long long address, unsigned int size, unsigned int hint
     return reply.status;
 }
 
+/*!
+  with `pop_res`, wait for the completion of the pushed requests; return `timeout` if it does
+  not arrive within the module param `comp_timeout_ms`
+ */
 static inline int
 qpush(int qd, const push_core_req_t *reqq, unsigned char pop_res = 0, unsigned int push_recv_cnt = 0) {
     push_req_t req;
@@ -75,10 +105,20 @@ qpush(int qd, const push_core_req_t *reqq, unsigned char pop_res = 0, unsigned i
     req.req.reply_buf = &reply;
     req.ext = {.push_recv_cnt = push_recv_cnt, .pop_res = pop_res};
 
+    // the batch size and the list, then (index, op type, length, vid) of each request
+    KRCORE_PROBE3(qpush, qd, reqq->req_len, reqq->req_list);
+#ifdef KRCORE_USDT
+    for (unsigned int i = 0; i < reqq->req_len; ++i) {
+        KRCORE_PROBE5(qpush_req, qd, i, reqq->req_list[i].type, reqq->req_list[i].length,
+                      reqq->req_list[i].vid);
+    }
+#endif
     memcpy(&req.core, reqq, sizeof(push_core_req_t));
     if (ioctl(qd, Push, &req) == -1) {
+        KRCORE_PROBE2(qpush_ret, qd, -1);
         return -1;
     }
+    KRCORE_PROBE2(qpush_ret, qd, reply.status);
     return reply.status;
 }
 
@@ -90,17 +130,27 @@ qpop(int qd, pop_reply_t *reply, int vid = 0) {
     req.req.reply_buf = reply;
     req.pop_vid.vid = vid;
 
+    KRCORE_PROBE2(qpop, qd, vid);
     if (ioctl(qd, Pop, &req) == -1) {
+        KRCORE_PROBE3(qpop_ret, qd, -1, 0);
         return -1;
     }
+    // the op type of the completion is only valid on ok
+    KRCORE_PROBE3(qpop_ret, qd, reply->header.status, reply->wc[0].wc_op);
     return reply->header.status;
 }
 
+/*!
+  post `push_count` receives to the queue.
+  if `bufs` is set, the messages land directly in the user buffers (registered by `qreg_mr`)
+  instead of the kernel receive buffer.
+ */
 static inline int
-qpush_recv(int qd, unsigned int push_count) {
+qpush_recv(int qd, unsigned int push_count, recv_buf_t *bufs = nullptr) {
     push_recv_req_t req;
     reply_t reply;
     req.push_recv.push_count = push_count;
+    req.push_recv.bufs = bufs;
     req.req.reply_buf = &reply;
 
     if (ioctl(qd, PushRecv, &req) == -1) {
@@ -109,17 +159,27 @@ qpush_recv(int qd, unsigned int push_count) {
     return reply.status;
 }
 
-// pop an RDMA request from the queue
+/*!
+  pop at most `pop_count` received messages from the queue.
+  with `payload_buf`, the first `payload_sz` bytes of the i-th message received in the kernel
+  buffer are copied to `payload_buf + i * payload_sz`; the messages in the user supplied
+  buffers are left in place.
+ */
 static inline int
-qpop_msgs(int qd, pop_reply_t *reply, unsigned int pop_count, unsigned int payload_sz = 0) {
+qpop_msgs(int qd, pop_reply_t *reply, unsigned int pop_count, unsigned int payload_sz = 0,
+          void *payload_buf = nullptr) {
     pop_msgs_t req;
     req.pop_count = pop_count;
     req.payload_sz = payload_sz;
+    req.payload_buf = payload_buf;
 
     req.req.reply_buf = reply;
+    KRCORE_PROBE3(qpop_msgs, qd, pop_count, payload_sz);
     if (ioctl(qd, PopMsgs, &req) == -1) {
+        KRCORE_PROBE3(qpop_msgs_ret, qd, -1, 0);
         return -1;
     }
+    KRCORE_PROBE3(qpop_msgs_ret, qd, reply->header.status, reply->pop_count);
     return reply->header.status;
 }
 
@@ -167,6 +227,91 @@ qpoll_rpc(int qd) {
     return reply.status;
 }
 
+/*!
+  wait until all the requests pushed before on this queue have completed at the remote NIC.
+  the completions of the earlier signaled requests are still returned by the following `qpop`s.
+  e.g., write the data, `qflush`, then write the commit flag; or mark the flag with `req_fence`
+  if the data is READ back before.
+ */
+static inline int
+qflush(int qd) {
+    req_t req;
+    reply_t reply;
+    req.reply_buf = &reply;
+
+    if (ioctl(qd, Flush, &req) == -1) {
+        return -1;
+    }
+    return reply.status;
+}
+
+/*!
+  set the share of this queue on the physical QP it shares with other queues (DC/UD path).
+  the queues are scheduled by weighted deficit round robin on the posted bytes.
+ */
+static inline int
+qset_share(int qd, unsigned int weight, unsigned long long max_bytes_per_sec = 0) {
+    share_req_t req;
+    reply_t reply;
+    req.req.reply_buf = &reply;
+    req.share.weight = weight;
+    req.share.max_bytes_per_sec = max_bytes_per_sec;
+
+    if (ioctl(qd, SetShare, &req) == -1) {
+        return -1;
+    }
+    return reply.status;
+}
+
+/*!
+  set the chunk size of `qpush`: the requests are copied in and posted `chunk` at a time
+  (64 if never set). `batch_adaptive` lets the kernel tune it upon the send queue occupancy
+  and the per-request latency.
+ */
+static inline int
+qset_batch(int qd, unsigned int chunk = batch_adaptive) {
+    batch_req_t req;
+    reply_t reply;
+    req.req.reply_buf = &reply;
+    req.batch.chunk = chunk;
+
+    if (ioctl(qd, SetBatch, &req) == -1) {
+        return -1;
+    }
+    return reply.status;
+}
+
+/*!
+  read the statistics counters (see `stats_counter`) of this queue,
+  or of all the queues on NIC `nic` if `scope` is `StatsNIC`.
+ */
+static inline int
+qstats(int qd, stats_reply_t *reply, int scope = StatsVQ, unsigned int nic = 0) {
+    query_stats_req_t req;
+    req.req.reply_buf = reply;
+    req.query.scope = scope;
+    req.query.nic = nic;
 
+    if (ioctl(qd, QueryStats, &req) == -1) {
+        return -1;
+    }
+    return reply->header.status;
+}
 
+/*!
+  read the latency histograms of the push / pop stages, summed over all the queues.
+  the histograms are only filled when the module is loaded with `profile_stages=1`
+  (or it is set in /sys/module/KRdmaKitSyscall/parameters).
+ */
+static inline int
+qstage_hists(int qd, stage_hists_reply_t *reply) {
+    query_stats_req_t req;
+    req.req.reply_buf = reply;
+    req.query.scope = StatsStages;
+    req.query.nic = 0;
 
+    if (ioctl(qd, QueryStats, &req) == -1) {
+        return -1;
+    }
+    return reply->header.status;
+}